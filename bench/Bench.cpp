@@ -0,0 +1,264 @@
+#include "Bench.h"
+
+#include <Stats.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+
+using namespace tube::bench;
+
+// Count every allocation of the benchmark process. With TUBE_STATS the
+// library replaces operator new and counts them itself
+
+#ifndef TUBE_STATS
+
+static std::atomic<size_t> numAllocations{ 0 };
+
+void* operator new(size_t size) {
+	numAllocations.fetch_add(1, std::memory_order_relaxed);
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+	free(p);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+	numAllocations.fetch_add(1, std::memory_order_relaxed);
+	size_t align = (size_t)alignment;
+	void* p = aligned_alloc(align, (std::max(size, (size_t)1) + align - 1) / align * align);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+	free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+	free(p);
+}
+
+#endif
+
+size_t tube::bench::allocationCount() {
+#ifdef TUBE_STATS
+	return heapAllocationCount();
+#else
+	return numAllocations.load(std::memory_order_relaxed);
+#endif
+}
+
+namespace {
+
+struct Case {
+	std::string name;
+	Function fn;
+	std::vector<long long> args;
+	bool expectLinear;
+	const char* flatCounter;
+};
+
+struct Result {
+	std::string name;
+	long long arg;
+	size_t iterations;
+	double nsPerIteration;
+	double nsPerItem;
+	std::map<std::string, double> counters;
+	std::string failure;
+};
+
+std::vector<Case>& registry() {
+	static std::vector<Case> cases;
+	return cases;
+}
+
+Result run(const Case& c, long long arg, double minSeconds) {
+	size_t iterations = 1;
+	while (true) {
+		State state(arg, iterations);
+		c.fn(state);
+		double seconds = state.seconds();
+		if (seconds >= minSeconds || iterations >= 1000000000) {
+			Result result;
+			result.name = c.name;
+			result.arg = arg;
+			result.iterations = iterations;
+			result.nsPerIteration = seconds * 1e9 / (double)iterations;
+			result.nsPerItem = state.itemsProcessed() > 0
+				? result.nsPerIteration / (double)state.itemsProcessed()
+				: 0.0;
+			result.counters = state.counters;
+			result.failure = state.failure();
+			return result;
+		}
+		// Predict the iteration count needed to fill the minimum time
+		double scale = seconds > 0.0 ? minSeconds / seconds * 1.4 : 10.0;
+		scale = std::min(std::max(scale, 2.0), 100.0);
+		iterations = (size_t)((double)iterations * scale);
+	}
+}
+
+void writeJson(std::ostream& out, const std::vector<Result>& results) {
+	out << "{\n  \"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const auto& r = results[i];
+		out << "    { \"name\": \"" << r.name << "/" << r.arg << "\""
+			<< ", \"case\": \"" << r.name << "\""
+			<< ", \"arg\": " << r.arg
+			<< ", \"iterations\": " << r.iterations
+			<< ", \"ns_per_iteration\": " << r.nsPerIteration
+			<< ", \"ns_per_item\": " << r.nsPerItem;
+		for (const auto& counter : r.counters)
+			out << ", \"" << counter.first << "\": " << counter.second;
+		out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+}
+
+State::State(long long arg, size_t iterations)
+	: mArg(arg), mIterations(iterations), mRemaining(iterations)
+{
+}
+
+long long State::arg() const {
+	return mArg;
+}
+
+size_t State::iterations() const {
+	return mIterations;
+}
+
+double State::seconds() const {
+	return mSeconds;
+}
+
+long long State::itemsProcessed() const {
+	return mItems;
+}
+
+bool State::keepRunning() {
+	if (mRemaining == mIterations)
+		mStart = Clock::now();
+	if (mRemaining == 0) {
+		mSeconds = std::chrono::duration<double>(Clock::now() - mStart).count();
+		return false;
+	}
+	mRemaining--;
+	return true;
+}
+
+void State::setItemsProcessed(long long items) {
+	mItems = items;
+}
+
+void State::fail(std::string message) {
+	if (mFailure.empty())
+		mFailure = std::move(message);
+}
+
+const std::string& State::failure() const {
+	return mFailure;
+}
+
+int tube::bench::registerCase(const char* name, Function fn, std::vector<long long> args, bool expectLinear,
+	const char* flatCounter) {
+	registry().push_back({ name, fn, args, expectLinear, flatCounter });
+	return (int)registry().size();
+}
+
+// Usage: tube_bench [--filter <substring>] [--min-time <seconds>]
+//                   [--max-arg <n>] [--json <file>]
+int main(int argc, char** argv) {
+	std::string filter;
+	std::string jsonPath;
+	double minSeconds = 0.2;
+	long long maxArg = -1;
+
+	for (int i = 1; i < argc; i++) {
+		bool hasValue = i + 1 < argc;
+		if (!strcmp(argv[i], "--filter") && hasValue)
+			filter = argv[++i];
+		else if (!strcmp(argv[i], "--min-time") && hasValue)
+			minSeconds = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--max-arg") && hasValue)
+			maxArg = atoll(argv[++i]);
+		else if (!strcmp(argv[i], "--json") && hasValue)
+			jsonPath = argv[++i];
+		else {
+			std::cerr << "Unknown argument: " << argv[i] << std::endl;
+			return 2;
+		}
+	}
+
+	std::vector<Result> results;
+	bool failed = false;
+
+	for (const auto& c : registry()) {
+		if (!filter.empty() && c.name.find(filter) == std::string::npos)
+			continue;
+
+		double fastest = 0.0;
+		double slowest = 0.0;
+		double lowestCounter = -1.0;
+		double highestCounter = 0.0;
+		for (long long arg : c.args) {
+			if (maxArg >= 0 && arg > maxArg)
+				continue;
+			Result result = run(c, arg, minSeconds);
+			printf("%-40s %12lld %14.1f ns %12.3f ns/item\n",
+				c.name.c_str(), arg, result.nsPerIteration, result.nsPerItem);
+			fflush(stdout);
+			if (!result.failure.empty()) {
+				printf("%-40s FAILED: %s\n", c.name.c_str(), result.failure.c_str());
+				failed = true;
+			}
+
+			if (result.nsPerItem > 0.0) {
+				fastest = fastest == 0.0 ? result.nsPerItem : std::min(fastest, result.nsPerItem);
+				slowest = std::max(slowest, result.nsPerItem);
+			}
+			if (c.flatCounter != nullptr) {
+				double value = result.counters[c.flatCounter];
+				lowestCounter = lowestCounter < 0.0 ? value : std::min(lowestCounter, value);
+				highestCounter = std::max(highestCounter, value);
+			}
+			results.push_back(result);
+		}
+
+		if (c.expectLinear && fastest > 0.0 && slowest > fastest * 2.0) {
+			printf("%-40s FAILED: time per item grew %.2fx across arguments\n",
+				c.name.c_str(), slowest / fastest);
+			failed = true;
+		}
+		if (c.flatCounter != nullptr && lowestCounter >= 0.0 && highestCounter > lowestCounter * 1.1 + 1.0) {
+			printf("%-40s FAILED: %s grew from %.1f to %.1f across arguments\n",
+				c.name.c_str(), c.flatCounter, lowestCounter, highestCounter);
+			failed = true;
+		}
+	}
+
+	if (!jsonPath.empty()) {
+		std::ofstream out(jsonPath);
+		writeJson(out, results);
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace tube {
+namespace bench {
+
+// Timing state passed to a benchmark case. Work outside of the
+// keepRunning() loop (setup) is not measured.
+class State {
+	using Clock = std::chrono::steady_clock;
+
+	long long mArg;
+	size_t mIterations;
+	size_t mRemaining;
+	Clock::time_point mStart;
+	double mSeconds = 0.0;
+	long long mItems = 0;
+	std::string mFailure;
+
+public:
+	std::map<std::string, double> counters;
+
+	State(long long arg, size_t iterations);
+
+	long long arg() const;
+	size_t iterations() const;
+	double seconds() const;
+	long long itemsProcessed() const;
+
+	bool keepRunning();
+
+	// Items processed by one iteration, used for per-item timings
+	void setItemsProcessed(long long items);
+
+	// Fail the run when a case finds a wrong result
+	void fail(std::string message);
+	const std::string& failure() const;
+};
+
+using Function = void (*)(State&);
+
+// Heap allocations made through operator new since the program started
+size_t allocationCount();
+
+// With flatCounter set, the counter of that name must not grow across the
+// arguments
+int registerCase(const char* name, Function fn, std::vector<long long> args, bool expectLinear = false,
+	const char* flatCounter = nullptr);
+
+template<typename T>
+inline void doNotOptimize(T const& value) {
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	const volatile char* sink = reinterpret_cast<const volatile char*>(&value);
+	(void)*sink;
+#endif
+}
+
+}
+}
+
+#define TUBE_BENCH_CONCAT_(a, b) a##b
+#define TUBE_BENCH_CONCAT(a, b) TUBE_BENCH_CONCAT_(a, b)
+
+// Register a case run once per argument
+#define TUBE_BENCH(fn, ...) \
+	static int TUBE_BENCH_CONCAT(fn##_registered_, __LINE__) = \
+		tube::bench::registerCase(#fn, fn, { __VA_ARGS__ })
+
+// Register a case whose time per item must stay flat across arguments.
+// The run fails if the slowest argument is more than twice as slow per item
+// as the fastest one, which catches accidental quadratic behaviour.
+#define TUBE_BENCH_LINEAR(fn, ...) \
+	static int TUBE_BENCH_CONCAT(fn##_registered_, __LINE__) = \
+		tube::bench::registerCase(#fn, fn, { __VA_ARGS__ }, true)
+
+// Register a case whose counter of the given name must stay flat across
+// arguments. The run fails if its largest value is more than 10% and one
+// above the smallest, which catches heap allocations growing with the input
+#define TUBE_BENCH_FLAT(fn, counter, ...) \
+	static int TUBE_BENCH_CONCAT(fn##_registered_, __LINE__) = \
+		tube::bench::registerCase(#fn, fn, { __VA_ARGS__ }, false, counter)
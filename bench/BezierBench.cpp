@@ -0,0 +1,145 @@
+#include "Bench.h"
+
+#include <Bezier.h>
+
+#include <cmath>
+
+using namespace tube;
+using namespace tube::bench;
+
+namespace {
+
+const int numCurves = 1024;
+
+// Uniform sampling as done before the specialized evaluators, kept as the
+// reference for accuracy and speed
+std::vector<glm::vec3> legacyCubicBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, int segments) {
+	std::vector<glm::vec3> points;
+	float step = 1.0f / (float)(segments - 1);
+	float t = 0.0f;
+	for (int i = 0; i < segments; i++) {
+		glm::vec3 a = glm::mix(p0, p1, t);
+		glm::vec3 b = glm::mix(p1, p2, t);
+		glm::vec3 c = glm::mix(p2, p3, t);
+		glm::vec3 d = glm::mix(a, b, t);
+		glm::vec3 e = glm::mix(b, c, t);
+		points.push_back(glm::mix(d, e, t));
+		t += step;
+	}
+	return points;
+}
+
+struct Exact {
+	double x, y, z;
+};
+
+// Cubic curve in double at the exact parameter
+Exact exactCubicBezier(const glm::vec3* p, int i, int segments) {
+	double t = (double)i / (double)(segments - 1);
+	double s = 1.0 - t;
+	double w[4] = { s * s * s, 3.0 * s * s * t, 3.0 * s * t * t, t * t * t };
+	Exact e = { 0.0, 0.0, 0.0 };
+	for (int k = 0; k < 4; k++) {
+		e.x += (double)p[k].x * w[k];
+		e.y += (double)p[k].y * w[k];
+		e.z += (double)p[k].z * w[k];
+	}
+	return e;
+}
+
+std::vector<glm::vec3> controlPoints() {
+	auto points = std::vector<glm::vec3>();
+	for (int c = 0; c < numCurves; c++) {
+		float x = (float)c * 3.0f;
+		points.push_back(glm::vec3(x, 0.0f, 0.0f));
+		points.push_back(glm::vec3(x + 1.0f, sinf((float)c) * 2.0f, 1.0f));
+		points.push_back(glm::vec3(x + 2.0f, cosf((float)c) * 2.0f, -1.0f));
+		points.push_back(glm::vec3(x + 3.0f, 0.5f, 0.0f));
+	}
+	return points;
+}
+
+double distance(glm::vec3 a, Exact b) {
+	double x = (double)a.x - b.x;
+	double y = (double)a.y - b.y;
+	double z = (double)a.z - b.z;
+	return sqrt(x * x + y * y + z * z);
+}
+
+// Largest distance from the exact curve of the legacy sampling, the
+// specialized evaluators and the batch, relative to the size of the curve
+void BezierAccuracy(State& state) {
+	int segments = (int)state.arg();
+	auto points = controlPoints();
+	auto batch = std::vector<glm::vec3>((size_t)numCurves * segments);
+	double legacyError = 0.0;
+	double newError = 0.0;
+	double batchError = 0.0;
+	double diffVsLegacy = 0.0;
+	while (state.keepRunning()) {
+		cubicBezierBatch(points.data(), numCurves, segments, batch.data());
+		for (int c = 0; c < numCurves; c++) {
+			const glm::vec3* p = points.data() + c * 4;
+			auto legacy = legacyCubicBezier(p[0], p[1], p[2], p[3], segments);
+			auto curve = cubicBezier(p[0], p[1], p[2], p[3], segments);
+			double size = glm::length(p[3] - p[0]);
+			for (int i = 0; i < segments; i++) {
+				auto exact = exactCubicBezier(p, i, segments);
+				legacyError = fmax(legacyError, distance(legacy[i], exact) / size);
+				newError = fmax(newError, distance(curve[i], exact) / size);
+				batchError = fmax(batchError, distance(batch[c * segments + i], exact) / size);
+				diffVsLegacy = fmax(diffVsLegacy, distance(curve[i], Exact{ legacy[i].x, legacy[i].y, legacy[i].z }) / size);
+			}
+		}
+	}
+	state.setItemsProcessed((long long)numCurves * segments);
+	state.counters["max_error_legacy"] = legacyError;
+	state.counters["max_error_new"] = newError;
+	state.counters["max_error_batch"] = batchError;
+	state.counters["max_diff_vs_legacy"] = diffVsLegacy;
+}
+
+void BezierLegacy(State& state) {
+	int segments = (int)state.arg();
+	auto points = controlPoints();
+	while (state.keepRunning()) {
+		for (int c = 0; c < numCurves; c++) {
+			const glm::vec3* p = points.data() + c * 4;
+			auto curve = legacyCubicBezier(p[0], p[1], p[2], p[3], segments);
+			doNotOptimize(curve.data());
+		}
+	}
+	state.setItemsProcessed((long long)numCurves * segments);
+}
+
+void BezierSpecialized(State& state) {
+	int segments = (int)state.arg();
+	auto points = controlPoints();
+	while (state.keepRunning()) {
+		for (int c = 0; c < numCurves; c++) {
+			const glm::vec3* p = points.data() + c * 4;
+			auto curve = cubicBezier(p[0], p[1], p[2], p[3], segments);
+			doNotOptimize(curve.data());
+		}
+	}
+	state.setItemsProcessed((long long)numCurves * segments);
+}
+
+void BezierBatch(State& state) {
+	int segments = (int)state.arg();
+	auto points = controlPoints();
+	auto out = std::vector<glm::vec3>((size_t)numCurves * segments);
+	while (state.keepRunning()) {
+		cubicBezierBatch(points.data(), numCurves, segments, out.data());
+		doNotOptimize(out.data());
+	}
+	state.setItemsProcessed((long long)numCurves * segments);
+}
+
+}
+
+// 33 and 1000 samples have no specialization and use forward differencing
+TUBE_BENCH(BezierAccuracy, 8, 32, 33, 64, 1000);
+TUBE_BENCH(BezierLegacy, 8, 32, 33, 64);
+TUBE_BENCH(BezierSpecialized, 8, 32, 33, 64);
+TUBE_BENCH(BezierBatch, 8, 32, 33, 64);
@@ -0,0 +1,139 @@
+#include "Bench.h"
+#include "Synthetic.h"
+
+#include <Path.h>
+
+using namespace tube;
+using namespace tube::bench;
+
+namespace {
+
+void PathToPoly(State& state) {
+	auto path = curvedPath(state.arg());
+	while (state.keepRunning()) {
+		auto poly = path.toPoly(Tessellation(8));
+		doNotOptimize(poly.points.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void PathToPolyAdaptive(State& state) {
+	auto path = curvedPath(state.arg());
+	size_t numPoints = 0;
+	while (state.keepRunning()) {
+		auto poly = path.toPoly(Tessellation::adaptive(0.01f));
+		doNotOptimize(poly.points.data());
+		numPoints = poly.points.size();
+	}
+	state.setItemsProcessed(state.arg());
+	state.counters["points_per_curve"] = (double)numPoints / (double)state.arg();
+}
+
+void PathLength(State& state) {
+	auto path = curvedPath(state.arg());
+	while (state.keepRunning()) {
+		// Measure building the table, not the cached lookup
+		path.invalidate();
+		float length = path.length();
+		doNotOptimize(length);
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void PathDash(State& state) {
+	auto path = wavyPath(state.arg());
+	while (state.keepRunning()) {
+		auto dashes = path.dash(0.6f, 0.4f);
+		doNotOptimize(dashes.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void PathEvenlyDistributed(State& state) {
+	auto path = wavyPath(state.arg());
+	while (state.keepRunning()) {
+		auto even = path.evenlyDistributed(0.5f);
+		doNotOptimize(even.points.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+// Curves resampled directly, against flattening them first
+void PathEvenlyDistributedCurved(State& state) {
+	auto path = curvedPath(state.arg());
+	while (state.keepRunning()) {
+		auto even = path.evenlyDistributed(0.5f);
+		doNotOptimize(even.points.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void PathEvenlyDistributedToPoly(State& state) {
+	auto path = curvedPath(state.arg());
+	while (state.keepRunning()) {
+		auto even = path.toPoly(Tessellation(8)).evenlyDistributed(0.5f);
+		doNotOptimize(even.points.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void PathBevelJoin(State& state) {
+	auto path = zigZagPath(state.arg());
+	while (state.keepRunning()) {
+		auto joined = path.bevelJoin(0.2f);
+		doNotOptimize(joined.points.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void PathRoundJoin(State& state) {
+	auto path = zigZagPath(state.arg());
+	while (state.keepRunning()) {
+		auto joined = path.roundJoin(0.2f);
+		doNotOptimize(joined.points.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void PathMiterJoin(State& state) {
+	auto path = zigZagPath(state.arg());
+	while (state.keepRunning()) {
+		auto joined = path.miterJoin(0.2f);
+		doNotOptimize(joined.points.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void PathMiterRingJoin(State& state) {
+	auto path = zigZagPath(state.arg());
+	while (state.keepRunning()) {
+		auto joined = path.miterRingJoin();
+		doNotOptimize(joined.points.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void PathWithRoundedCaps(State& state) {
+	auto path = curvedPath(state.arg());
+	while (state.keepRunning()) {
+		auto capped = path.withRoundedCaps(0.5f);
+		doNotOptimize(capped.points.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+}
+
+TUBE_BENCH(PathToPoly, 10, 1000, 100000, 1000000);
+TUBE_BENCH(PathToPolyAdaptive, 10, 1000, 100000, 1000000);
+TUBE_BENCH(PathLength, 10, 1000, 100000, 1000000);
+TUBE_BENCH(PathDash, 10, 1000, 100000, 1000000);
+TUBE_BENCH(PathEvenlyDistributed, 10, 1000, 100000, 1000000);
+TUBE_BENCH(PathEvenlyDistributedCurved, 10, 1000, 100000, 1000000);
+TUBE_BENCH(PathEvenlyDistributedToPoly, 10, 1000, 100000, 1000000);
+TUBE_BENCH_LINEAR(PathBevelJoin, 1000, 10000, 100000);
+TUBE_BENCH_LINEAR(PathRoundJoin, 1000, 10000, 100000);
+TUBE_BENCH_LINEAR(PathMiterJoin, 1000, 10000, 100000);
+// Marking corners is a copy of the points, bound by memory at large sizes
+TUBE_BENCH(PathMiterRingJoin, 1000, 10000, 100000);
+TUBE_BENCH(PathWithRoundedCaps, 10, 1000, 100000, 1000000);
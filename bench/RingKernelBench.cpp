@@ -0,0 +1,80 @@
+#include "Bench.h"
+
+#include <RingKernel.h>
+#include <Tube.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+using namespace tube;
+using namespace tube::bench;
+
+namespace {
+
+const int numRings = 256;
+
+RingTransform ringTransform(int ring) {
+	RingTransform t;
+	float a = (float)ring * 0.01f;
+	t.axisX = glm::vec3(cosf(a), sinf(a), 0.0f);
+	t.axisY = glm::vec3(-sinf(a), cosf(a), 0.0f);
+	t.axisZ = glm::vec3(0.0f, 0.0f, -1.0f);
+	t.origin = glm::vec3((float)ring, 0.0f, 0.0f);
+	return t;
+}
+
+void runKernel(State& state, RingKernel kernel) {
+	if (!isRingKernelSupported(kernel)) {
+		state.counters["skipped"] = 1;
+		while (state.keepRunning()) {}
+		return;
+	}
+	auto shape = Shapes::circle(1.0f, (int)state.arg());
+	auto soa = ShapeSoA(shape.verts);
+	auto out = std::vector<glm::vec3>(shape.verts.size());
+	while (state.keepRunning()) {
+		for (int ring = 0; ring < numRings; ring++) {
+			transformRing(kernel, ringTransform(ring), soa, out.data());
+			doNotOptimize(out.data());
+		}
+	}
+	state.setItemsProcessed(numRings * state.arg());
+}
+
+void RingKernelScalar(State& state) {
+	runKernel(state, RingKernel::SCALAR);
+}
+
+void RingKernelSSE(State& state) {
+	runKernel(state, RingKernel::SSE);
+}
+
+void RingKernelAVX(State& state) {
+	runKernel(state, RingKernel::AVX);
+}
+
+// The quat-quat-vec4-mat4 chain used per vertex before ring kernels
+void RingKernelQuatMat4(State& state) {
+	auto shape = Shapes::circle(1.0f, (int)state.arg());
+	auto out = std::vector<glm::vec3>(shape.verts.size());
+	while (state.keepRunning()) {
+		for (int ring = 0; ring < numRings; ring++) {
+			glm::mat4 identity = glm::mat4(1.0f);
+			glm::mat4 shapeMat = glm::translate(identity, glm::vec3((float)ring, 0.0f, 0.0f)) *
+				glm::scale(identity, glm::vec3(1.5f));
+			glm::quat shapeTilt = glm::quat(glm::vec3(0, 0, (float)ring * 0.01f));
+			glm::quat shapeLookAt = glm::quatLookAt(glm::vec3(1, 0, 0), glm::vec3(0, 0, 1));
+			for (size_t p = 0; p < shape.verts.size(); p++)
+				out[p] = shapeMat * (shapeLookAt * shapeTilt * glm::vec4(shape.verts[p], 1.0f));
+			doNotOptimize(out.data());
+		}
+	}
+	state.setItemsProcessed(numRings * state.arg());
+}
+
+}
+
+TUBE_BENCH(RingKernelQuatMat4, 32, 128);
+TUBE_BENCH(RingKernelScalar, 32, 128);
+TUBE_BENCH(RingKernelSSE, 32, 128);
+TUBE_BENCH(RingKernelAVX, 32, 128);
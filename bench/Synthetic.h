@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Path.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace tube {
+namespace bench {
+
+// Zig-zag polyline so every ring has a different direction
+inline Path zigZagPath(long long numPoints) {
+	Path path;
+	path.points.resize((size_t)numPoints);
+	for (long long i = 0; i < numPoints; i++)
+		path.points[(size_t)i] = Point(glm::vec3((float)i, (float)(i % 2), 0.0f));
+	return path;
+}
+
+// Path winding around a torus, with varying radius and tilt. Coordinates
+// stay small however long the path is, like in real scenes
+inline Path wavyPath(long long numPoints) {
+	Path path;
+	path.points.resize((size_t)numPoints);
+	for (long long i = 0; i < numPoints; i++) {
+		float t = (float)i;
+		float around = t * 0.02f;
+		float wave = t * 0.7f;
+		float distance = 50.0f + 2.0f * cosf(wave);
+		auto point = Point(glm::vec3(distance * cosf(around), distance * sinf(around), 2.0f * sinf(wave)));
+		point.radius = 1.0f + 0.25f * sinf(t * 0.1f);
+		point.tilt = t * 0.05f;
+		path.points[(size_t)i] = point;
+	}
+	return path;
+}
+
+// Closed concave profile with seven lobes, centroid fans overlap on it
+inline Shape flowerShape(long long numVerts) {
+	Shape shape;
+	shape.closed = true;
+	shape.verts.resize((size_t)numVerts);
+	for (long long i = 0; i < numVerts; i++) {
+		float angle = 6.2831853f * (float)i / (float)numVerts;
+		float radius = 0.5f + 0.2f * sinf(angle * 7.0f);
+		shape.verts[(size_t)i] = glm::vec3(radius * cosf(angle), radius * sinf(angle), 0.0f);
+	}
+	return shape;
+}
+
+// The same path with smooth bezier handles on every point
+inline Path curvedPath(long long numPoints) {
+	Path path = wavyPath(numPoints);
+	for (size_t i = 0; i < path.points.size(); i++) {
+		auto& point = path.points[i];
+		// Roughly a third of the way to the neighbours
+		const auto& next = path.points[std::min(i + 1, path.points.size() - 1)];
+		const auto& previous = path.points[i > 0 ? i - 1 : 0];
+		glm::vec3 handle = (next.pos - previous.pos) * (1.0f / 6.0f);
+		point.leftHandlePos = point.pos - handle;
+		point.rightHandlePos = point.pos + handle;
+		point.hasLeftHandle = true;
+		point.hasRightHandle = true;
+	}
+	return path;
+}
+
+}
+}
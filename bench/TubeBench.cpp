@@ -0,0 +1,519 @@
+#include "Bench.h"
+#include "Synthetic.h"
+
+#include <EarCut.h>
+#include <EditableTube.h>
+#include <InstancedTube.h>
+#include <Path.h>
+#include <LodChain.h>
+#include <Tube.h>
+#include <TubeFile.h>
+#include <TubeStream.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <stdexcept>
+
+using namespace tube;
+using namespace tube::bench;
+
+namespace {
+
+void TubeConstruct(State& state) {
+	auto path = zigZagPath(state.arg());
+	auto shape = Shapes::circle(0.5f, 32);
+	while (state.keepRunning()) {
+		auto tube = Tube(path, shape);
+		doNotOptimize(tube.indices.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void TubeConstructCurved(State& state) {
+	auto path = curvedPath(state.arg());
+	auto shape = Shapes::circle(0.5f, 8);
+	while (state.keepRunning()) {
+		auto tube = Tube(path, shape, Tessellation(8));
+		doNotOptimize(tube.indices.data());
+		state.counters["mesh_bytes_held"] = (double)(tube.vertices.size() * sizeof(glm::vec3) +
+			tube.texCoords.size() * sizeof(glm::vec2) + tube.indices.size() * sizeof(int));
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+// The same tube pushed point by point and handed out in chunks of 4096 rings
+void TubeStreamCurved(State& state) {
+	auto path = curvedPath(state.arg());
+	auto shape = Shapes::circle(0.5f, 8);
+	size_t allocations = allocationCount();
+	while (state.keepRunning()) {
+		size_t bytesHeld = 0;
+		auto stream = TubeStream(shape, [&](const TubeChunk& chunk) {
+			doNotOptimize(chunk.indices.data);
+			bytesHeld = std::max(bytesHeld, chunk.vertices.size * sizeof(glm::vec3) +
+				chunk.texCoords.size * sizeof(glm::vec2) + chunk.indices.size * sizeof(int));
+		}, 4096, Tessellation(8));
+		for (const auto& point : path.points)
+			stream.push(point);
+		stream.finish();
+		state.counters["mesh_bytes_held"] = (double)bytesHeld;
+	}
+	state.setItemsProcessed(state.arg());
+	state.counters["allocations_per_stream"] = (double)(allocationCount() - allocations) / (double)state.iterations();
+}
+
+void TubeCalculateNormals(State& state) {
+	auto path = wavyPath(state.arg());
+	auto shape = Shapes::circle(0.5f, 8);
+	auto tube = Tube(path, shape);
+	while (state.keepRunning()) {
+		tube.calculateNormals();
+		doNotOptimize(tube.normals.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+// Sweep with analytic normals, compare with TubeConstruct + TubeCalculateNormals
+void TubeConstructAnalyticNormals(State& state) {
+	auto path = wavyPath(state.arg());
+	auto shape = Shapes::circle(0.5f, 8);
+	while (state.keepRunning()) {
+		auto tube = Tube(path, shape, Tessellation(), VertexLayout::none(), TubeNormals::ANALYTIC);
+		doNotOptimize(tube.normals.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void TubeConstructFaceNormals(State& state) {
+	auto path = wavyPath(state.arg());
+	auto shape = Shapes::circle(0.5f, 8);
+	while (state.keepRunning()) {
+		auto tube = Tube(path, shape).calculateNormals();
+		doNotOptimize(tube.normals.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void TubeFillCaps(State& state) {
+	auto path = wavyPath(state.arg());
+	auto shape = Shapes::circle(0.5f, 8);
+	auto tube = Tube(path, shape);
+	while (state.keepRunning()) {
+		// fillCaps() appends in place, so fill a fresh copy every time
+		auto capped = tube.copy().fillCaps();
+		doNotOptimize(capped.indices.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+// Triangulation of a profile, made once per shape
+void EarCutProfile(State& state) {
+	auto shape = flowerShape(state.arg());
+	while (state.keepRunning()) {
+		auto triangles = earCut(shape.verts.data(), shape.verts.size());
+		doNotOptimize(triangles.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+// Ear cut caps of a short tube, the triangulation of the shape is reused
+void TubeFillCapsEarCut(State& state) {
+	auto path = wavyPath(2);
+	auto shape = flowerShape(state.arg());
+	auto tube = Tube(path, shape);
+	while (state.keepRunning()) {
+		auto capped = tube.copy().fillCaps(TubeCaps::EAR_CUT);
+		doNotOptimize(capped.indices.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+void TubeToXYZUVNormal(State& state) {
+	auto path = wavyPath(state.arg());
+	auto shape = Shapes::circle(0.5f, 8);
+	auto tube = Tube(path, shape).calculateNormals();
+	while (state.keepRunning()) {
+		auto attribs = tube.toXYZUVNormal();
+		doNotOptimize(attribs.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+// Many short pathes of 100 points, the typical input of Builder
+void BuilderApply(State& state) {
+	auto pathes = std::vector<Path>((size_t)std::max(state.arg() / 100, 1LL));
+	for (auto& path : pathes)
+		path = wavyPath(std::min(state.arg(), 100LL));
+	auto builder = Builder(pathes, Shapes::circle(0.5f, 8));
+	size_t allocations = allocationCount();
+	while (state.keepRunning()) {
+		auto tube = builder.apply();
+		doNotOptimize(tube.indices.data());
+	}
+	state.setItemsProcessed(state.arg());
+	state.counters["allocations_per_apply"] = (double)(allocationCount() - allocations) / (double)state.iterations();
+}
+
+// The same with one arena reused by every apply()
+void BuilderApplyArena(State& state) {
+	auto pathes = std::vector<Path>((size_t)std::max(state.arg() / 100, 1LL));
+	for (auto& path : pathes)
+		path = wavyPath(std::min(state.arg(), 100LL));
+	Arena arena;
+	auto builder = Builder(pathes, Shapes::circle(0.5f, 8)).withArena(&arena);
+	// Warm up so the arena holds one block big enough for a build
+	builder.apply();
+	arena.reset();
+	size_t allocations = allocationCount();
+	while (state.keepRunning()) {
+		auto tube = builder.apply();
+		doNotOptimize(tube.indices.data());
+		arena.reset();
+	}
+	state.setItemsProcessed(state.arg());
+	state.counters["allocations_per_apply"] = (double)(allocationCount() - allocations) / (double)state.iterations();
+}
+
+std::vector<Path> curvedPathes(long long numPoints) {
+	auto pathes = std::vector<Path>((size_t)std::max(numPoints / 100, 1LL));
+	for (auto& path : pathes)
+		path = curvedPath(std::min(numPoints, 100LL));
+	return pathes;
+}
+
+// Triangles of an index buffer, each turned to start at its smallest
+// index so that equal triangles of the same winding compare equal.
+// Strips skip the empty triangles of repeated vertices
+std::vector<std::array<uint32_t, 3>> decodeTriangles(const IndexBuffer& buffer) {
+	std::vector<std::array<uint32_t, 3>> triangles;
+	auto add = [&](uint32_t a, uint32_t b, uint32_t c) {
+		if (a == b || b == c || a == c)
+			return;
+		if (b < a && b < c)
+			triangles.push_back({ b, c, a });
+		else if (c < a && c < b)
+			triangles.push_back({ c, a, b });
+		else
+			triangles.push_back({ a, b, c });
+	};
+	size_t numIndices = buffer.numIndices();
+	if (buffer.topology == IndexTopology::TRIANGLES) {
+		for (size_t i = 0; i + 2 < numIndices; i += 3)
+			add(buffer[i], buffer[i + 1], buffer[i + 2]);
+	}
+	else {
+		size_t start = 0;
+		for (size_t i = 0; i <= numIndices; i++) {
+			if (i < numIndices && buffer[i] != buffer.restartIndex())
+				continue;
+			// Every other triangle of a strip is flipped to keep the winding
+			for (size_t k = start; k + 2 < i; k++) {
+				if ((k - start) % 2 == 0)
+					add(buffer[k], buffer[k + 1], buffer[k + 2]);
+				else
+					add(buffer[k + 1], buffer[k], buffer[k + 2]);
+			}
+			start = i + 1;
+		}
+	}
+	std::sort(triangles.begin(), triangles.end());
+	return triangles;
+}
+
+// Split a tube for 16-bit indices and write one strip per ring pair.
+// The strips of every part must make the triangles of its list, and the
+// whole tube must refuse 16-bit indices when it is too big
+void TubeSplitStrips16(State& state) {
+	auto path = wavyPath(state.arg());
+	auto shape = Shapes::circle(0.5f, 32);
+	auto tube = Tube(path, shape).fillCaps();
+	size_t stripBytes = 0;
+	while (state.keepRunning()) {
+		stripBytes = 0;
+		for (const auto& part : tube.split()) {
+			auto buffer = part.packIndices(IndexFormat::UINT16, IndexTopology::TRIANGLE_STRIP);
+			stripBytes += buffer.data.size();
+		}
+		doNotOptimize(stripBytes);
+	}
+	state.setItemsProcessed(state.arg());
+	state.counters["index_bytes_int"] = (double)(tube.indices.size() * sizeof(int));
+	state.counters["index_bytes_strip16"] = (double)stripBytes;
+
+	for (const auto& part : tube.split()) {
+		auto list = part.packIndices(IndexFormat::UINT16, IndexTopology::TRIANGLES);
+		auto strips = part.packIndices(IndexFormat::UINT16, IndexTopology::TRIANGLE_STRIP);
+		if (decodeTriangles(strips) != decodeTriangles(list))
+			state.fail("strips do not make the triangles of the list");
+	}
+	if (tube.vertices.size() > 65536) {
+		try {
+			tube.packIndices(IndexFormat::UINT16);
+			state.fail("16-bit indices of a tube too big for them");
+		}
+		catch (const std::length_error&) {
+		}
+	}
+}
+
+// Reorder a tube for the post-transform cache, the counters are the
+// simulated cache miss ratios before and after
+void TubeVertexCache(State& state) {
+	auto path = wavyPath(state.arg());
+	auto shape = Shapes::circle(0.5f, 33);
+	auto tube = Tube(path, shape, Tessellation(), VertexLayout(), TubeNormals::ANALYTIC).fillCaps();
+	VertexCacheStats before = tube.vertexCacheStats();
+	VertexCacheStats after;
+	while (state.keepRunning()) {
+		auto optimized = tube.copy().optimizeVertexCache();
+		after = optimized.vertexCacheStats();
+		doNotOptimize(optimized.indices.data());
+	}
+	state.setItemsProcessed(state.arg());
+	state.counters["acmr_before"] = before.acmr;
+	state.counters["acmr_after"] = after.acmr;
+	state.counters["atvr_before"] = before.atvr;
+	state.counters["atvr_after"] = after.atvr;
+}
+
+// Tube with packed vertices and normals as an application would build it
+// on startup
+Tube startupTube(long long numPoints) {
+	auto path = wavyPath(numPoints);
+	auto shape = Shapes::circle(0.5f, 32);
+	return Tube(path, shape, Tessellation(), VertexLayout(), TubeNormals::ANALYTIC).fillCaps();
+}
+
+// Sum of the bytes of a buffer, read as an upload to the GPU would
+unsigned int checksum(Span<const unsigned char> data) {
+	unsigned int sum = 0;
+	for (unsigned char byte : data)
+		sum += byte;
+	return sum;
+}
+
+void TubeRegenerate(State& state) {
+	while (state.keepRunning()) {
+		auto tube = startupTube(state.arg());
+		doNotOptimize(checksum(tube.vertexData()));
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+// The same tube mapped from a file saved once, reading the packed vertices
+void TubeMappedLoad(State& state) {
+	const char* fileName = "tube_bench_mapped.tube";
+	auto tube = startupTube(state.arg());
+	if (!saveTube(tube, fileName))
+		return;
+	while (state.keepRunning()) {
+		MappedTube mapped(fileName);
+		doNotOptimize(checksum(mapped.vertexData()));
+	}
+	std::remove(fileName);
+	state.setItemsProcessed(state.arg());
+	state.counters["packed_bytes"] = (double)tube.vertexData().size;
+}
+
+// Bundle of thin fibers of 20 points each
+std::vector<Path> fiberPathes(long long numFibers) {
+	auto pathes = std::vector<Path>((size_t)numFibers);
+	for (long long i = 0; i < numFibers; i++) {
+		auto& path = pathes[(size_t)i];
+		path = wavyPath(20);
+		auto offset = glm::vec3((float)(i % 317) * 0.01f, (float)(i / 317) * 0.01f, 0.0f);
+		for (auto& point : path.points) {
+			point.pos += offset;
+			point.radius = 0.002f;
+		}
+	}
+	return pathes;
+}
+
+void FibersTube(State& state) {
+	auto pathes = fiberPathes(state.arg());
+	auto shape = Shapes::circle(1.0f, 8);
+	size_t bytes = 0;
+	while (state.keepRunning()) {
+		auto tube = Tube(pathes, shape, Tessellation(), 0, VertexLayout(), TubeNormals::ANALYTIC);
+		doNotOptimize(tube.vertexData().data);
+		bytes = tube.vertexData().size + tube.indexData().size * sizeof(int);
+	}
+	state.setItemsProcessed(state.arg());
+	state.counters["gpu_bytes"] = (double)bytes;
+}
+
+// The same fibers as rings for instancing
+void FibersInstanced(State& state) {
+	auto pathes = fiberPathes(state.arg());
+	auto shape = Shapes::circle(1.0f, 8);
+	size_t bytes = 0;
+	while (state.keepRunning()) {
+		auto tube = InstancedTube(pathes, shape, Tessellation(), 0, TubeNormals::ANALYTIC);
+		doNotOptimize(tube.rings.data());
+		bytes = tube.rings.size() * sizeof(RingInstance) + tube.ringPairs.size() * sizeof(unsigned int);
+	}
+	state.setItemsProcessed(state.arg());
+	state.counters["gpu_bytes"] = (double)bytes;
+}
+
+// Four levels of detail built one by one with fewer curve samples and
+// profile segments each
+void LodSeparateBuilds(State& state) {
+	auto path = curvedPath(state.arg());
+	while (state.keepRunning()) {
+		std::vector<Tube> levels;
+		for (int level = 0; level < 4; level++) {
+			auto shape = Shapes::circle(0.5f, 33 >> level);
+			levels.push_back(Tube(path, shape, Tessellation(32 >> level), VertexLayout::none(), TubeNormals::ANALYTIC));
+		}
+		doNotOptimize(levels.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+// The same number of levels from one tessellation and frame computation
+void LodChainBuild(State& state) {
+	auto path = curvedPath(state.arg());
+	auto shape = Shapes::circle(0.5f, 33);
+	while (state.keepRunning()) {
+		auto chain = LodChain(path, shape, 4, Tessellation(32), VertexLayout::none(), TubeNormals::ANALYTIC);
+		doNotOptimize(chain.levels.data());
+	}
+	state.setItemsProcessed(state.arg());
+}
+
+// One point in the middle of the path moved back and forth. Only the rings
+// around it are rebuilt, but v of every ring follows the new path length
+void EditableTubeUpdate(State& state) {
+	auto path = curvedPath(state.arg());
+	auto shape = Shapes::circle(0.5f, 32);
+	auto editable = EditableTube(path, shape, Tessellation(), VertexLayout());
+	size_t index = path.points.size() / 2;
+	Point point = path.points[index];
+	float offset = 0.1f;
+	while (state.keepRunning()) {
+		point.pos.y += offset;
+		offset = -offset;
+		editable.setPoint(index, point);
+		editable.update();
+		doNotOptimize(editable.tube().vertices.data());
+	}
+	state.setItemsProcessed(1);
+}
+
+// A chain of builder steps on named builders, every step copies the pathes
+void BuilderChainLvalue(State& state) {
+	auto builder = Builder(curvedPathes(state.arg()), Shapes::circle(0.5f, 8));
+	size_t allocations = allocationCount();
+	while (state.keepRunning()) {
+		auto tessellated = builder.withTessellation(Tessellation(8));
+		auto withNormals = tessellated.withNormals();
+		auto capped = withNormals.withRoundedCaps(0.3f);
+		auto layout = capped.withLayout(VertexLayout());
+		doNotOptimize(&layout);
+	}
+	state.setItemsProcessed(state.arg());
+	state.counters["allocations_per_chain"] = (double)(allocationCount() - allocations) / (double)state.iterations();
+}
+
+// The same chain on temporaries, the pathes are copied once and moved on
+void BuilderChainRvalue(State& state) {
+	auto builder = Builder(curvedPathes(state.arg()), Shapes::circle(0.5f, 8));
+	size_t allocations = allocationCount();
+	while (state.keepRunning()) {
+		auto layout = builder.copy()
+			.withTessellation(Tessellation(8))
+			.withNormals()
+			.withRoundedCaps(0.3f)
+			.withLayout(VertexLayout());
+		doNotOptimize(&layout);
+	}
+	state.setItemsProcessed(state.arg());
+	state.counters["allocations_per_chain"] = (double)(allocationCount() - allocations) / (double)state.iterations();
+}
+
+// Tessellate, resample and cap with every step run on all pathes before
+// the next one, as before steps were fused
+void BuilderStepsEager(State& state) {
+	auto shape = Shapes::circle(0.5f, 8);
+	auto pathes = curvedPathes(state.arg());
+	size_t allocations = allocationCount();
+	while (state.keepRunning()) {
+		auto poly = Builder(pathes, shape).toPoly().result();
+		auto even = Builder(std::move(poly), shape).evenlyDistributed(0.5f).result();
+		auto tube = Builder(std::move(even), shape).withRoundedCaps(0.3f).apply();
+		doNotOptimize(tube.indices.data());
+	}
+	state.setItemsProcessed(state.arg());
+	state.counters["allocations_per_apply"] = (double)(allocationCount() - allocations) / (double)state.iterations();
+}
+
+// The same steps fused path by path inside apply()
+void BuilderStepsFused(State& state) {
+	auto shape = Shapes::circle(0.5f, 8);
+	auto pathes = curvedPathes(state.arg());
+	size_t allocations = allocationCount();
+	while (state.keepRunning()) {
+		auto tube = Builder(pathes, shape).toPoly().evenlyDistributed(0.5f).withRoundedCaps(0.3f).apply();
+		doNotOptimize(tube.indices.data());
+	}
+	state.setItemsProcessed(state.arg());
+	state.counters["allocations_per_apply"] = (double)(allocationCount() - allocations) / (double)state.iterations();
+}
+
+// Fused steps on 4 pathes of a growing number of points, with one arena
+// reused by every apply(). Steps allocate the points of each path they
+// produce, so the allocations grow with the number of pathes but not with
+// their length
+void BuilderStepsArena(State& state) {
+	auto shape = Shapes::circle(0.5f, 8);
+	auto pathes = std::vector<Path>(4, curvedPath(state.arg()));
+	Arena arena;
+	auto builder = Builder(pathes, shape).withTessellation(Tessellation(8)).withThreads(1).withArena(&arena)
+		.toPoly().evenlyDistributed(0.5f).roundJoin(0.1f).withRoundedCaps(0.3f);
+	builder.apply();
+	arena.reset();
+	size_t allocations = allocationCount();
+	while (state.keepRunning()) {
+		auto tube = builder.apply();
+		doNotOptimize(tube.indices.data());
+		arena.reset();
+	}
+	state.setItemsProcessed(state.arg() * 4);
+	state.counters["allocations_per_apply"] = (double)(allocationCount() - allocations) / (double)state.iterations();
+}
+
+}
+
+// Mesh assembly must stay linear in the number of rings
+TUBE_BENCH_LINEAR(TubeConstruct, 1000, 4000, 16000, 64000);
+// Curves are split into 7 rings each, so 100000 points give 700000 rings
+TUBE_BENCH(TubeConstructCurved, 10, 1000, 100000);
+// Memory held stays the same however long the path is
+TUBE_BENCH(TubeStreamCurved, 10, 1000, 100000, 1000000);
+TUBE_BENCH(TubeCalculateNormals, 10, 1000, 100000, 1000000);
+TUBE_BENCH(TubeConstructAnalyticNormals, 10, 1000, 100000, 1000000);
+TUBE_BENCH(TubeConstructFaceNormals, 10, 1000, 100000, 1000000);
+TUBE_BENCH(TubeFillCaps, 10, 1000, 100000, 1000000);
+TUBE_BENCH(EarCutProfile, 10, 100, 1000, 10000);
+TUBE_BENCH(TubeFillCapsEarCut, 10, 100, 1000, 10000);
+TUBE_BENCH(TubeToXYZUVNormal, 10, 1000, 100000, 1000000);
+TUBE_BENCH(BuilderApply, 10, 1000, 100000, 1000000);
+// A build with a reused arena makes the same few heap allocations at any size
+TUBE_BENCH_FLAT(BuilderApplyArena, "allocations_per_apply", 10, 1000, 100000, 1000000);
+TUBE_BENCH(BuilderChainLvalue, 1000, 100000, 1000000);
+TUBE_BENCH(BuilderChainRvalue, 1000, 100000, 1000000);
+TUBE_BENCH(BuilderStepsEager, 1000, 10000, 100000);
+TUBE_BENCH(BuilderStepsFused, 1000, 10000, 100000);
+TUBE_BENCH_FLAT(BuilderStepsArena, "allocations_per_apply", 10, 100, 1000, 10000);
+TUBE_BENCH(TubeSplitStrips16, 10, 1000, 100000);
+TUBE_BENCH(TubeVertexCache, 10, 1000, 100000);
+TUBE_BENCH(TubeRegenerate, 1000, 100000);
+TUBE_BENCH(TubeMappedLoad, 1000, 100000);
+TUBE_BENCH(FibersTube, 10, 1000, 100000);
+TUBE_BENCH(FibersInstanced, 10, 1000, 100000);
+TUBE_BENCH(LodSeparateBuilds, 10, 1000, 10000);
+TUBE_BENCH(LodChainBuild, 10, 1000, 10000);
+TUBE_BENCH(EditableTubeUpdate, 100, 1000, 10000);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <mutex>
+
+namespace tube {
+
+// Monotonic memory for the scratch buffers of a build, usable by std::pmr
+// containers. Allocation bumps a pointer in the current block and freeing
+// does nothing. reset() releases everything at once and keeps one block
+// big enough for everything allocated so far, so an arena reused across
+// builds of a similar size stops allocating from the heap.
+// Allocation is safe from several threads.
+class Arena : public std::pmr::memory_resource {
+	struct Block {
+		Block* previous;
+		size_t size;
+	};
+
+	std::pmr::memory_resource* mUpstream;
+	std::mutex mMutex;
+	Block* mBlock = nullptr;
+	size_t mUsed = 0;
+	size_t mNextBlockSize;
+	size_t mBytesAllocated = 0;
+	size_t mNumBlockAllocations = 0;
+
+	void addBlock(size_t minSize);
+	void releaseBlocks();
+
+protected:
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+public:
+	explicit Arena(size_t initialSize = 64 * 1024,
+		std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	// Forget every allocation. Memory given out before must not be used anymore
+	void reset();
+
+	// Bytes given out since the last reset
+	size_t bytesAllocated() const;
+	// Blocks taken from the upstream resource since construction
+	size_t numBlockAllocations() const;
+};
+
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <memory_resource>
 #include <vector>
 
 namespace tube {
@@ -8,8 +9,33 @@ namespace tube {
 // Linear interpolation
 float lerpf(float a, float b, float t);
 
+// Sample a curve at segments uniform parameters, end points included
 std::vector<glm::vec3> quadraticBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, int segments = 32);
 std::vector<glm::vec3> cubicBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, int segments = 32);
+// The same, writing segments samples to out
+void quadraticBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, int segments, glm::vec3* out);
+void cubicBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, int segments, glm::vec3* out);
+
+// Sample many curves at once with the vectorized ring kernels. Control
+// points are given 3 (quadratic) or 4 (cubic) per curve, and out receives
+// segments samples per curve, one curve after another
+void quadraticBezierBatch(const glm::vec3* controlPoints, size_t numCurves, int segments, glm::vec3* out);
+void cubicBezierBatch(const glm::vec3* controlPoints, size_t numCurves, int segments, glm::vec3* out);
+
+// Flatten a curve by recursive subdivision until every piece is closer than
+// tolerance to its chord and turns by less than angleTolerance (in radians,
+// zero disables the angle check). If params is not null, the curve parameter
+// of every returned vertex is written to it.
+std::vector<glm::vec3> adaptiveQuadraticBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2,
+	float tolerance, float angleTolerance = 0.0f, std::vector<float>* params = nullptr);
+std::vector<glm::vec3> adaptiveCubicBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3,
+	float tolerance, float angleTolerance = 0.0f, std::vector<float>* params = nullptr);
+// The same, appending vertices and their parameters to vectors that may
+// live in an Arena
+void adaptiveQuadraticBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2,
+	float tolerance, float angleTolerance, std::pmr::vector<glm::vec3>& verts, std::pmr::vector<float>& params);
+void adaptiveCubicBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3,
+	float tolerance, float angleTolerance, std::pmr::vector<glm::vec3>& verts, std::pmr::vector<float>& params);
 
 struct TwoQuadraticBeziers {
 	// First curve
@@ -29,4 +55,12 @@ struct TwoCubicBeziers {
 
 TwoCubicBeziers divideCubicBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float t);
 
+// Point and first derivative of a curve at parameter t, without dividing it
+glm::vec3 cubicBezierPoint(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float t);
+glm::vec3 cubicBezierDerivative(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float t);
+// Arc length of a curve between parameters t0 and t1 by five point
+// Gauss-Legendre quadrature. Close to exact when the curve bends little
+// between t0 and t1, split longer spans and add the lengths
+float cubicBezierLength(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float t0, float t1);
+
 }
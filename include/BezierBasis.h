@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+namespace tube {
+
+// Bernstein weights of a curve of the given degree at the uniform
+// parameters t = i / (Segments - 1), computed at compile time in double
+template<int Degree, int Segments>
+struct BezierBasis {
+	static_assert(Degree >= 1, "Curves need at least two control points");
+	static_assert(Segments >= 2, "Curves need at least two samples");
+
+	// Weight of control point k at sample i
+	float weights[Degree + 1][Segments] = {};
+
+	constexpr BezierBasis() {
+		double binomial[Degree + 1] = {};
+		binomial[0] = 1.0;
+		for (int k = 1; k <= Degree; k++)
+			binomial[k] = binomial[k - 1] * (double)(Degree - k + 1) / (double)k;
+
+		for (int i = 0; i < Segments; i++) {
+			double t = (double)i / (double)(Segments - 1);
+			for (int k = 0; k <= Degree; k++) {
+				double weight = binomial[k];
+				for (int j = 0; j < k; j++)
+					weight *= t;
+				for (int j = 0; j < Degree - k; j++)
+					weight *= 1.0 - t;
+				weights[k][i] = (float)weight;
+			}
+		}
+	}
+};
+
+template<int Degree, int Segments>
+constexpr BezierBasis<Degree, Segments> bezierBasis = BezierBasis<Degree, Segments>();
+
+// Sample a curve with Degree + 1 control points into Segments vertices.
+// Weights are compile-time constants and the loop has a fixed trip count,
+// so the compiler unrolls and vectorizes it. Positions are taken relative
+// to the first control point, and both end points are exact.
+template<int Degree, int Segments>
+inline void evaluateBezier(const glm::vec3* controlPoints, glm::vec3* out) {
+	constexpr const BezierBasis<Degree, Segments>& basis = bezierBasis<Degree, Segments>;
+
+	glm::vec3 origin = controlPoints[0];
+	glm::vec3 offsets[Degree];
+	for (int k = 0; k < Degree; k++)
+		offsets[k] = controlPoints[k + 1] - origin;
+
+	for (int i = 0; i < Segments - 1; i++) {
+		glm::vec3 point = origin;
+		for (int k = 0; k < Degree; k++)
+			point += offsets[k] * basis.weights[k + 1][i];
+		out[i] = point;
+	}
+	out[Segments - 1] = controlPoints[Degree];
+}
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <mutex>
+#include <vector>
+
+namespace tube {
+
+// Triangulate a simple polygon by ear clipping. Points are in order and
+// either winding, the last one connects back to the first, and a last
+// point that repeats the first one up to rounding is skipped. Returns
+// three point indices per counter-clockwise triangle. Repeated points and
+// straight runs are skipped too. Polygons of more than 80 points look up
+// ears through a z-order curve hash, which keeps large profiles close to
+// O(n log n). Self-intersecting polygons are cut apart where possible.
+// A port of Mapbox's earcut, see the ISC License in EarCut.cpp
+std::vector<int> earCut(const glm::vec2* points, size_t numPoints);
+
+// The same for a flat polygon in 3D, projected onto its plane first.
+// Triangles wind the same way as the polygon
+std::vector<int> earCut(const glm::vec3* points, size_t numPoints);
+
+// Cap triangles of a profile for TubeCaps::EAR_CUT. Shapes keep one, so
+// the profile is triangulated once for both caps of every tube swept
+// with the shape
+class CapTriangulation {
+	std::vector<glm::vec3> mVerts;
+	std::vector<int> mIndices;
+	std::once_flag mOnce;
+
+public:
+	explicit CapTriangulation(std::vector<glm::vec3> verts);
+
+	// Profile vertices the triangles are made for
+	const std::vector<glm::vec3>& verts() const;
+	// Three profile vertex indices per triangle. The profile is
+	// triangulated on the first call, calls may come from several threads
+	const std::vector<int>& indices();
+};
+
+}
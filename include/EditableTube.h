@@ -0,0 +1,81 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <Tube.h>
+
+namespace tube {
+
+// Tube of one path that is updated in place when some of its points change.
+// Every path segment owns a block of rings in the mesh: the rings of its
+// curve, then copies of its last ring as slack, so the block can take more
+// rings later. Quads skip the slack, so no triangle is degenerate, and the
+// indices are only rewritten when the number of rings of a curve changes.
+// update() only tessellates the curves around the edited points and
+// rewrites their blocks, so the geometry of an edit costs about the same on
+// any path length. The frames of the rewritten rings are twisted to meet
+// the untouched rings after them. Texture coordinates v follow the length
+// of the path like in a fresh build, so an edit that changes the length
+// rewrites v of every vertex. A curve that outgrows its block rebuilds
+// the whole tube.
+class EditableTube {
+	Path mPath;
+	Shape mShape;
+	ShapeSoA mShapeSoA;
+	ShapeSoA mProfileNormals;
+	Tessellation mTessellation;
+	Tube mTube;
+
+	// Polyline point and frame of every ring of the mesh
+	std::vector<Point> mRings;
+	std::vector<Frame> mFrames;
+	// First ring of the block of every segment, plus the number of rings.
+	// Segments own their rings without the end point, which is the first
+	// ring of the next segment, except the last segment
+	std::vector<size_t> mBlockStarts;
+	// Rings of every segment before its slack
+	std::vector<size_t> mRingCounts;
+	// Distance of every ring from the previous one, zero for slack
+	std::vector<float> mStepLengths;
+
+	bool mIsDirty = false;
+	size_t mDirtyFirst = 0;
+	size_t mDirtyLast = 0;
+
+	// Append the rings a segment owns
+	void tessellateSegment(size_t segment, std::vector<Point>& out) const;
+	void updateSegments(size_t firstSegment, size_t lastSegment);
+	// Neighbouring rings of the path, skipping slack. False at the ends
+	bool previousRing(size_t ring, size_t& out) const;
+	bool nextRing(size_t ring, size_t& out) const;
+	// Copy the last ring of a segment over its slack
+	void writeSlack(size_t segment);
+	void writeIndices();
+	void writeTexCoords();
+	void packRings(size_t firstRing, size_t endRing);
+
+public:
+	EditableTube(Path path, Shape shape, Tessellation tessellation = Tessellation(),
+		VertexLayout layout = VertexLayout::none());
+
+	const Path& path() const;
+	// Mesh with normals, valid until the next update()
+	const Tube& tube() const;
+
+	// Replace a point of the path. Changes are applied by update()
+	void setPoint(size_t index, Point point);
+	// Rebuild the rings of the curves around the points changed since the
+	// last update
+	void update();
+	// Build the whole tube again, with texture coordinates along the
+	// length of the path
+	void rebuild();
+
+	size_t numSegments() const;
+	// First ring of the block of a segment. Its slots end at the first ring
+	// of the next block, slack included
+	size_t firstRingOfSegment(size_t segment) const;
+	size_t segmentOfRing(size_t ring) const;
+};
+
+}
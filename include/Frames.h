@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace tube {
+
+struct Point;
+
+// Orientation of one ring of a tube. The x axis of the shape maps to
+// normal, its y axis to binormal and its z axis to -tangent.
+struct Frame {
+	glm::vec3 tangent = glm::vec3(0.0f, 0.0f, 1.0f);
+	glm::vec3 normal = glm::vec3(1.0f, 0.0f, 0.0f);
+	glm::vec3 binormal = glm::vec3(0.0f, 1.0f, 0.0f);
+};
+
+// Frame oriented like glm::quatLookAt with Z up, or with Y up when the
+// tangent is vertical
+Frame initialFrame(glm::vec3 tangent);
+
+// Carry a frame along the segment from one point to the next with the
+// double reflection method, so the frame turns with minimal twist
+Frame transportFrame(const Frame& frame, glm::vec3 from, glm::vec3 to, glm::vec3 nextTangent);
+
+// Rotate a frame around its tangent
+Frame twistFrame(const Frame& frame, float angle);
+
+// Angle that turns frame a into frame b around the tangent of b
+float twistBetween(const Frame& a, const Frame& b);
+
+// Mean direction of the segments around point i of a polyline with at
+// least two points. previous is the tangent of point i - 1, used when the
+// point has no direction of its own
+glm::vec3 pointTangent(const std::vector<Point>& points, bool closed, size_t i, glm::vec3 previous);
+glm::vec3 pointTangent(const Point* points, size_t numPoints, bool closed, size_t i, glm::vec3 previous);
+
+// Mean direction of the segments around every point
+std::vector<glm::vec3> pointTangents(const std::vector<Point>& points, bool closed);
+
+// Rotation-minimizing frames for the points of a polyline. In closed
+// pathes the remaining twist is spread along the path, so the frames meet
+// where the path closes.
+std::vector<Frame> rotationMinimizingFrames(const std::vector<Point>& points, bool closed);
+// The same, writing numPoints frames without allocating
+void rotationMinimizingFrames(const Point* points, size_t numPoints, bool closed, Frame* frames);
+
+}
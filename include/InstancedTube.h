@@ -0,0 +1,79 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <Tube.h>
+
+namespace tube {
+
+// One ring of an InstancedTube, 48 bytes for a GPU buffer. A profile
+// vertex (x, y, z) of the ring is placed by
+//   q = radius * rotate((x, y), tilt)
+//   q += miter * dot(q, miter)
+//   position + rotation * (q.x, q.y, radius * z)
+// where rotation takes x to the frame normal, y to the binormal and z to
+// minus the tangent of the ring
+struct RingInstance {
+	// Unit quaternion as x, y, z, w
+	glm::vec4 rotation = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	glm::vec3 position = glm::vec3(0.0f);
+	float radius = 1.0f;
+	// Angle the profile turns by around the tangent
+	float tilt = 0.0f;
+	// Texture coordinate along the path
+	float v = 0.0f;
+	// Rings of miter points are stretched across the turn of the path by
+	// 1 + dot(miter, miter). Zero for other rings
+	glm::vec2 miter = glm::vec2(0.0f);
+};
+
+// Tube for drawing with instancing. Only the rings are computed, every
+// ring is one transform of the same profile, and the GPU expands them: one
+// instance of the pair template per ring pair, with the vertices of ring 0
+// of the template taken from ring ringPairs[instance] and those of ring 1
+// from the ring after it. Texture coordinate u of profile vertex p is
+// p / (number of profile vertices - 1), like in a swept Tube. CPU work and
+// memory shrink by about the number of profile vertices.
+class InstancedTube {
+	// RingInstance::miter of a miter point, read back from the axes
+	// Tube::miterRing() stretches
+	static glm::vec2 miterStretch(const Point* points, size_t numPoints, bool closed, size_t i,
+		const Frame& frame);
+
+	void build(size_t numSources, const PathSource& source, const Shape& shape,
+		Tessellation tessellation, unsigned int numThreads, TubeNormals normals, Arena* arena);
+
+public:
+	// Profile vertices of every ring, with crease vertices split when
+	// normals are asked for
+	std::vector<glm::vec3> profile;
+	// 2D normal of every profile vertex with TubeNormals::ANALYTIC, empty
+	// otherwise. They are turned by the tilt and the rotation of a ring,
+	// but do not lean with radius changes along the path like the normals
+	// of a swept Tube
+	std::vector<glm::vec2> profileNormals;
+	// Triangles between two rings, profile vertex p of ring 0 is vertex p
+	// and of ring 1 vertex p + profile.size()
+	std::vector<int> pairIndices;
+	std::vector<RingInstance> rings;
+	// First ring of every ring pair to draw. Pathes follow each other in
+	// rings, so rings at the end of a path start no pair
+	std::vector<unsigned int> ringPairs;
+
+	// Rings of every path, using up to numThreads threads (zero uses all
+	// hardware threads). Scratch memory of the build comes from the arena,
+	// or from a temporary one when it is null
+	InstancedTube(const std::vector<Path>& pathes, const Shape& shape, Tessellation tessellation = Tessellation(),
+		unsigned int numThreads = 0, TubeNormals normals = TubeNormals::NONE, Arena* arena = nullptr);
+	// Rings of the pathes of numSources inputs, see Tube
+	InstancedTube(size_t numSources, const PathSource& source, const Shape& shape,
+		Tessellation tessellation = Tessellation(), unsigned int numThreads = 0,
+		TubeNormals normals = TubeNormals::NONE, Arena* arena = nullptr);
+
+	// Expand the rings on the CPU, for checks and for renderers without
+	// instancing. Positions and texture coordinates match a Tube of the
+	// same pathes up to rounding
+	Tube toTube() const;
+};
+
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <Tube.h>
+
+namespace tube {
+
+struct LodLevel {
+	Tube tube;
+	size_t numRings = 0;
+	// Vertices of every ring of the mesh
+	size_t shapeNumVerts = 0;
+	// Upper bound of the distance between this level and the finest one
+	float geometricError = 0.0f;
+
+	// Size of the geometric error in pixels when seen from distance by a
+	// perspective camera with a vertical field of view fovY in radians
+	float screenSpaceError(float distance, float viewportHeight, float fovY) const;
+};
+
+// Meshes of one path with less and less detail. The path is tessellated
+// and its frames and lengths are computed once, then every level keeps
+// about half of the rings and profile vertices of the level before it,
+// dropping those that change the surface least first. Levels share their
+// texture coordinates along the path. Levels are swept on up to numThreads
+// threads, zero uses all hardware threads.
+class LodChain {
+public:
+	// Level 0 is the same mesh as a Tube of the path. There may be fewer
+	// levels than asked when rings and profile cannot be reduced further
+	std::vector<LodLevel> levels;
+
+	LodChain(const Path& path, const Shape& shape, size_t numLevels = 4,
+		Tessellation tessellation = Tessellation(), VertexLayout layout = VertexLayout::none(),
+		TubeNormals normals = TubeNormals::NONE, unsigned int numThreads = 0);
+
+	// Coarsest level whose screen space error is at most maxPixelError
+	size_t select(float distance, float viewportHeight, float fovY, float maxPixelError = 1.0f) const;
+};
+
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace tube {
+
+// Number of hardware threads, at least one
+unsigned int hardwareThreads();
+
+// Call fn(i) for every i in [0, count) on up to numThreads threads of a
+// shared thread pool, including the calling one. Zero uses all hardware
+// threads. Items are claimed one by one from a shared counter, so uneven
+// items balance themselves. Nested calls run on the calling thread.
+// When fn throws, the items not started yet are skipped and the first
+// exception is rethrown on the calling thread once every thread stopped.
+void parallelFor(size_t count, unsigned int numThreads, const std::function<void(size_t)>& fn);
+
+}
@@ -1,11 +1,36 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
 #include <vector>
+#include <Frames.h>
+#include <VertexLayout.h>
 
 namespace tube {
 
 struct ThreePoints;
+class Arena;
+
+// How curves are flattened to polylines. By default every curve is sampled
+// uniformly with segmentsPerCurve points. A positive tolerance switches to
+// adaptive subdivision: nearly straight curves get few points and tight
+// curves get as many as they need.
+struct Tessellation {
+	int segmentsPerCurve = 32;
+	// Maximum distance between a curve and its polyline
+	float tolerance = 0.0f;
+	// Maximum turn of one polyline segment in radians, zero disables it
+	float angleTolerance = 0.0f;
+
+	Tessellation();
+	Tessellation(int segmentsPerCurve);
+
+	static Tessellation adaptive(float tolerance, float angleTolerance = 0.0f);
+	bool isAdaptive() const;
+};
 
 struct Point {
 	glm::vec3 pos;
@@ -13,6 +38,9 @@ struct Point {
 	glm::vec3 leftHandlePos = glm::vec3(0.0f);
 	bool hasRightHandle = false;
 	bool hasLeftHandle = false;
+	// The ring of the point is stretched across the turn of the path, so
+	// it meets both segments of a corner. Set by Path::miterRingJoin()
+	bool isMiter = false;
 	float radius = 1.0f;
 	float tilt = 0.0f;
 
@@ -23,8 +51,12 @@ struct Point {
 
 	static ThreePoints divide(Point start, Point end, float t);
 	static float length(Point start, Point end);
-	static std::vector<glm::vec3> toVectors(Point start, Point end, int segments = 32);
-	static std::vector<Point> toPoly(Point start, Point end, int segments = 32);
+	static std::vector<glm::vec3> toVectors(Point start, Point end, Tessellation tessellation = Tessellation());
+	static std::vector<Point> toPoly(Point start, Point end, Tessellation tessellation = Tessellation());
+	// Append the polyline of the curve to out, without its first point
+	// unless withStart is set. Scratch memory comes from out's allocator
+	static void toPoly(const Point& start, const Point& end, Tessellation tessellation,
+		std::pmr::vector<Point>& out, bool withStart);
 };
 
 struct ThreePoints {
@@ -34,34 +66,133 @@ struct ThreePoints {
 struct TwoPathes;
 struct Shape;
 class Tube;
+class CapTriangulation;
+class InstancedTube;
+struct BuildStats;
+
+// Cumulative arc lengths of a path. Segments connect neighbouring points
+// (and the last point with the first one in closed pathes). Each segment
+// keeps a small table of lengths sampled at uniform curve parameters, so
+// length queries never tessellate the curves again.
+struct ArcLengthTable {
+	// Length of the path at the start of each segment and at its end
+	std::vector<float> segmentStarts;
+	// Offset of each segment's samples in sampleLengths, plus the end
+	std::vector<size_t> sampleStarts;
+	// Length from the segment start at t = k / (numSamples - 1)
+	std::vector<float> sampleLengths;
+
+	size_t numPoints = 0;
+	bool closed = false;
+
+	static ArcLengthTable build(const std::vector<Point>& points, bool closed, int samplesPerCurve = 32);
+
+	size_t numSegments() const;
+	float length() const;
+	float segmentLength(size_t segment) const;
+	// Length from the segment start to the local curve parameter t
+	float lengthAtT(size_t segment, float t) const;
+	// Local curve parameter at the length from the segment start
+	float tAtLength(size_t segment, float len) const;
+	// Segment and local curve parameter at the length from the path start
+	size_t locate(float len, float& t) const;
+};
+
+enum class JoinType {
+	BEVEL,
+	ROUND,
+	MITER,
+	// The corner point stays and its ring is stretched instead, see
+	// Path::miterRingJoin()
+	MITER_RING
+};
 
 struct Path {
 	std::vector<Point> points;
 	bool closed = false;
 
-	bool hasNonPoly();
+	bool hasNonPoly() const;
 
 	TwoPathes divide(float t);
 	Path slice(float start, float end);
 	std::vector<Path> dash(float dashLength, float gapLength, float offset = 0.0f);
-	Path bevelJoin(float radius);
-	Path roundJoin(float radius);
-	Path miterJoin(float radius);
-	Path withRoundedCaps(float radius, int segments = 24);
-	Path withSquareCaps(float radius);
+	// Dash with a pattern of alternating dash and gap lengths. The offset
+	// moves the pattern start along the path, like SVG's stroke-dashoffset.
+	// Patterns with an odd number of lengths are repeated twice.
+	std::vector<Path> dash(const std::vector<float>& pattern, float offset = 0.0f);
+	// The same, appending the dashes to out
+	void dash(const std::vector<float>& pattern, float offset, std::vector<Path>& out);
+	// These operations copy the points of an lvalue path. On an rvalue,
+	// like std::move(path).bevelJoin(r), they change its points in place
+	Path bevelJoin(float radius) &;
+	Path bevelJoin(float radius) &&;
+	Path roundJoin(float radius) &;
+	Path roundJoin(float radius) &&;
+	Path miterJoin(float radius) &;
+	Path miterJoin(float radius) &&;
+	// Miter every corner with a single ring on the plane halfway between
+	// its segments, stretched across the turn, instead of adding points.
+	// Rings of corners sharper than about 150 degrees are stretched less
+	// than a miter needs
+	Path miterRingJoin() &;
+	Path miterRingJoin() &&;
+	Path withRoundedCaps(float radius, int segments = 24) &;
+	Path withRoundedCaps(float radius, int segments = 24) &&;
+	Path withSquareCaps(float radius) &;
+	Path withSquareCaps(float radius) &&;
+	Path close() &;
+	Path close() &&;
 	Path taper();
 	Path copy();
-	Path close();
+	// Polyline with a point every len along the path, starting at the
+	// first point. Curves are resampled directly at their exact arc
+	// length, with no toPoly() first. Radius and tilt follow the curve
+	// parameter like in toPoly()
 	Path evenlyDistributed(float len);
-	Path toPoly(int segmentsPerCurve = 32);
-	Shape toShape(int segmentsPerCurve = 32);
+	// The same, writing the unit tangent of the path at every point
+	Path evenlyDistributed(float len, std::vector<glm::vec3>& tangents);
+	Path toPoly(Tessellation tessellation = Tessellation());
+	Shape toShape(Tessellation tessellation = Tessellation());
 	float getTAtLength(float len, std::vector<float>& lengths);
+	float getTAtLength(float len);
 	Point getPointAtT(float t);
+	Point getPointAtLength(float len);
 	std::vector<float> getPolyLengths();
 	float length();
 
+	// Arc-length table of the path, built on first use and shared by copies.
+	// It is rebuilt when the number of points or closed changes. Call
+	// invalidate() after moving points in place, debug builds assert on
+	// a stale table
+	const ArcLengthTable& arcLengths();
+	// Rotation-minimizing frame of every point of a polyline path, built on
+	// first use and shared by copies like arcLengths()
+	const std::vector<Frame>& frames();
+	// Drop the cached tables, needed after editing points in place. The
+	// operations of Path call it themselves
+	void invalidate();
+
 private:
-	Path bevelOrRoundJoin(float radius, bool isRound);
+	std::shared_ptr<const ArcLengthTable> mArcLengths;
+	std::shared_ptr<const std::vector<Frame>> mFrames;
+	// Point count and closed flag the tables were built for
+	size_t mArcLengthsSize = 0;
+	size_t mFramesSize = 0;
+	bool mArcLengthsClosed = false;
+	bool mFramesClosed = false;
+	// Fingerprints of the points the tables were built for, debug builds
+	// check them against forgotten invalidate() calls
+	uint64_t mArcLengthsFingerprint = 0;
+	uint64_t mFramesFingerprint = 0;
+
+	uint64_t fingerprint() const;
+
+	// Join every corner, writing the points once into a new buffer
+	void joinInPlace(JoinType type, float radius);
+	void roundedCapsInPlace(float radius, int segments);
+	void squareCapsInPlace(float radius);
+	void closeInPlace();
+	Path evenlyDistributed(float len, std::vector<glm::vec3>* tangents);
 };
 
 struct TwoPathes {
@@ -72,28 +203,127 @@ struct TwoPathes {
 struct Shape {
 	std::vector<glm::vec3> verts;
 	bool closed = false;
+	// Profile corners sharper than this angle in radians get hard edges
+	// with TubeNormals::ANALYTIC. The default keeps every corner smooth
+	float creaseAngle = 3.14159265f;
+	// Cap triangles for TubeCaps::EAR_CUT, set by the first tube swept with
+	// the shape and shared by every later tube and copy of the shape.
+	// Tubes make a new one when the vertices have changed
+	std::shared_ptr<CapTriangulation> capTriangulation;
+};
+
+enum class TubeNormals {
+	// No normals, calculateNormals() can add them later
+	NONE,
+	// Normals computed while sweeping from the ring frames and the
+	// normals of the profile
+	ANALYTIC
 };
 
+// Step of a Builder chain. It changes the pathes made so far from one
+// input path, and may add or remove pathes
+using BuilderStage = std::function<void(std::vector<Path>& pathes)>;
+
+// Builder steps are recorded, not run. apply() runs all of them fused for
+// every input path on the worker threads and tessellates the result right
+// away, so the intermediate pathes of a chain only exist for the inputs
+// in flight instead of for all of them at every step
 struct Builder {
-	std::vector<Path> pathes;
 	Shape shape;
+	Tessellation tessellation;
+	// Threads used by apply(), zero uses all hardware threads
+	unsigned int threads = 0;
+	// Packed vertex buffer written by apply(), empty by default
+	VertexLayout layout = VertexLayout::none();
+	TubeNormals normals = TubeNormals::NONE;
+	// Scratch memory of apply(), a temporary arena when null
+	Arena* arena = nullptr;
+	// apply() runs Tube::optimizeVertexCache() with this cache size on the
+	// result when it is not zero. The result has no rings left for
+	// fillCaps() or split(), cap the pathes with a step instead
+	size_t vertexCacheSize = 0;
+	// Statistics of every apply() are written here when it is not null,
+	// see BuildStats
+	BuildStats* stats = nullptr;
 
 	Builder(std::vector<Path> pathes, Shape shape);
 	Builder(std::vector<Path> pathes);
 	Builder(Path path);
 	Builder(Shape shape);
 
-	Builder withShape(Shape s);
-	Builder bevelJoin(float radius);
-	Builder roundJoin(float radius);
-	Builder miterJoin(float radius);
-	Builder withRoundedCaps(float radius, int segments = 24);
-	Builder withSquareCaps(float radius);
-	Builder evenlyDistributed(float len);
-	Builder toPoly();
+	// Every step has two forms. On an lvalue builder it returns a new
+	// builder and leaves this one unchanged. On an rvalue, like the
+	// temporaries of Builder(pathes).bevelJoin(r).apply(), it moves the
+	// pathes and steps into the result. Recorded steps change the points
+	// of their pathes in place
+	Builder withShape(Shape s) &;
+	Builder withShape(Shape s) &&;
+	// Tessellation used by toPoly() and by apply() for curved pathes
+	Builder withTessellation(Tessellation t) &;
+	Builder withTessellation(Tessellation t) &&;
+	Builder withThreads(unsigned int numThreads) &;
+	Builder withThreads(unsigned int numThreads) &&;
+	Builder withLayout(VertexLayout l) &;
+	Builder withLayout(VertexLayout l) &&;
+	Builder withNormals(TubeNormals n = TubeNormals::ANALYTIC) &;
+	Builder withNormals(TubeNormals n = TubeNormals::ANALYTIC) &&;
+	// Reuse the arena for the scratch memory of every apply(). The sweep
+	// then makes the same few heap allocations however many pathes it
+	// takes. Recorded steps are not arena-backed, they allocate the points
+	// of every path they produce. That is a few allocations per path
+	// whatever its length, besides one per piece for dash() and a growing
+	// buffer for an adaptive toPoly()
+	Builder withArena(Arena* a) &;
+	Builder withArena(Arena* a) &&;
+	Builder withVertexCacheOptimization(size_t cacheSize = 32) &;
+	Builder withVertexCacheOptimization(size_t cacheSize = 32) &&;
+	Builder withStats(BuildStats* s) &;
+	Builder withStats(BuildStats* s) &&;
+	Builder bevelJoin(float radius) &;
+	Builder bevelJoin(float radius) &&;
+	Builder roundJoin(float radius) &;
+	Builder roundJoin(float radius) &&;
+	Builder miterJoin(float radius) &;
+	Builder miterJoin(float radius) &&;
+	Builder miterRingJoin() &;
+	Builder miterRingJoin() &&;
+	Builder withRoundedCaps(float radius, int segments = 24) &;
+	Builder withRoundedCaps(float radius, int segments = 24) &&;
+	Builder withSquareCaps(float radius) &;
+	Builder withSquareCaps(float radius) &&;
+	Builder evenlyDistributed(float len) &;
+	Builder evenlyDistributed(float len) &&;
+	Builder toPoly() &;
+	Builder toPoly() &&;
 	Builder copy();
-    Builder dash(float dashLength, float gapLength, float offset = 0.0f);
-	Tube apply();
+	Builder dash(float dashLength, float gapLength, float offset = 0.0f) &;
+	Builder dash(float dashLength, float gapLength, float offset = 0.0f) &&;
+	Builder dash(const std::vector<float>& pattern, float offset = 0.0f) &;
+	Builder dash(const std::vector<float>& pattern, float offset = 0.0f) &&;
+	// Add a custom step
+	Builder then(BuilderStage stage) &;
+	Builder then(BuilderStage stage) &&;
+	Tube apply() &;
+	// Consume the builder, every path is freed as soon as it is tessellated
+	Tube apply() &&;
+	// Rings for drawing with instancing instead of a mesh, see
+	// InstancedTube. The layout and the vertex cache option do not apply
+	InstancedTube applyInstanced() &;
+	InstancedTube applyInstanced() &&;
+	// Input pathes, the recorded steps are not applied to them
+	const std::vector<Path>& pathes() const;
+	// Pathes after all steps, without building a tube
+	std::vector<Path> result() &;
+	std::vector<Path> result() &&;
+
+private:
+	std::vector<Path> mPathes;
+	std::vector<BuilderStage> mStages;
+
+	// Run the recorded steps on one input path
+	std::vector<Path> runStages(Path path) const;
+	// Options applied to the tube after sweeping
+	Tube finish(Tube tube) const;
 };
 
 }
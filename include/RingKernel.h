@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+namespace tube {
+
+// Affine transform placing the shape on a ring:
+// origin + axisX * x + axisY * y + axisZ * z
+struct RingTransform {
+	glm::vec3 axisX;
+	glm::vec3 axisY;
+	glm::vec3 axisZ;
+	glm::vec3 origin;
+};
+
+// Shape vertices split by coordinate, so that several vertices can be
+// transformed with one vector instruction
+struct ShapeSoA {
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+
+	ShapeSoA(const std::vector<glm::vec3>& verts);
+
+	size_t size() const;
+};
+
+enum class RingKernel {
+	SCALAR,
+	SSE,
+	AVX
+};
+
+// Fastest kernel supported by the running CPU
+RingKernel bestRingKernel();
+bool isRingKernelSupported(RingKernel kernel);
+
+// Transform every vertex of the shape and write the ring to out
+void transformRing(const RingTransform& transform, const ShapeSoA& shape, glm::vec3* out);
+void transformRing(RingKernel kernel, const RingTransform& transform, const ShapeSoA& shape, glm::vec3* out);
+
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tube {
+
+// Parts of a build that are timed
+enum class BuildStage {
+	// Curves tessellated into polylines
+	TO_POLY,
+	JOINS,
+	// Caps added to pathes
+	CAPS,
+	DASH,
+	RESAMPLE,
+	FRAMES,
+	SWEEP,
+	// Caps filled in a tube
+	FILL_CAPS,
+	NORMALS,
+	MERGE,
+	VERTEX_CACHE
+};
+
+const size_t NUM_BUILD_STAGES = 11;
+
+// Lower case name used in traces
+const char* buildStageName(BuildStage stage);
+
+struct StageStats {
+	// Wall time summed over every call on every thread
+	double seconds = 0.0;
+	size_t calls = 0;
+};
+
+// One call of a stage, times in microseconds since the recording started
+struct StageEvent {
+	BuildStage stage;
+	// Small number of the thread, the same for every recording
+	unsigned int thread;
+	double start;
+	double duration;
+};
+
+// Statistics of the builds made while a StatsRecording lives. They are
+// only recorded when the library is compiled with TUBE_STATS, otherwise
+// everything stays zero and recording costs nothing
+struct BuildStats {
+	std::array<StageStats, NUM_BUILD_STAGES> stages;
+	// Wall time of the whole recording
+	double seconds = 0.0;
+	// Path points swept, rings written and triangles made
+	size_t numPoints = 0;
+	size_t numRings = 0;
+	size_t numTriangles = 0;
+	// Heap allocations of the process during the recording and the most
+	// heap memory in use at once above what was used when it started.
+	// Other threads allocating at the same time are counted too. Every
+	// recording has its own peak, nested ones do not reset the outer one
+	size_t numAllocations = 0;
+	size_t peakBytes = 0;
+	std::vector<StageEvent> events;
+
+	const StageStats& stage(BuildStage stage) const;
+
+	// Events and counters in the Chrome trace event format, for
+	// chrome://tracing or Perfetto
+	std::string toChromeTrace() const;
+};
+
+// Record into stats what the calling thread builds while the object lives,
+// including work it hands to other threads with parallelFor(). Stats are
+// cleared first. Null stats record nothing. Recordings may be nested, the
+// innermost one of a thread gets the events
+class StatsRecording {
+	BuildStats* mStats;
+	StatsRecording* mPrevious = nullptr;
+	std::mutex mMutex;
+	std::chrono::steady_clock::time_point mStart;
+	size_t mStartAllocations = 0;
+	size_t mStartBytes = 0;
+	// Slot of the high-water mark of the heap, -1 without one
+	int mPeakSlot = -1;
+
+	friend class StageTimer;
+	friend class StatsBinding;
+	friend void countStat(size_t BuildStats::* counter, size_t count);
+
+public:
+	explicit StatsRecording(BuildStats* stats);
+	~StatsRecording();
+
+	StatsRecording(const StatsRecording&) = delete;
+	StatsRecording& operator=(const StatsRecording&) = delete;
+
+	// Recording of the calling thread, null when there is none
+	static StatsRecording* current();
+};
+
+#ifdef TUBE_STATS
+
+// Times a stage from construction to destruction
+class StageTimer {
+	StatsRecording* mRecording;
+	BuildStage mStage;
+	std::chrono::steady_clock::time_point mStart;
+
+public:
+	explicit StageTimer(BuildStage stage);
+	~StageTimer();
+};
+
+// Make recording the current one of the calling thread while the object lives
+class StatsBinding {
+	StatsRecording* mPrevious;
+
+public:
+	explicit StatsBinding(StatsRecording* recording);
+	~StatsBinding();
+};
+
+void countStat(size_t BuildStats::* counter, size_t count);
+
+// Heap allocations made through operator new since the program started
+size_t heapAllocationCount();
+
+#define TUBE_STATS_CONCAT_(a, b) a##b
+#define TUBE_STATS_CONCAT(a, b) TUBE_STATS_CONCAT_(a, b)
+// Time the rest of the scope as a stage
+#define TUBE_STATS_STAGE(stage) \
+	tube::StageTimer TUBE_STATS_CONCAT(tubeStageTimer, __LINE__)(stage)
+// Add to a counter of BuildStats
+#define TUBE_STATS_COUNT(counter, count) tube::countStat(&tube::BuildStats::counter, count)
+
+#else
+
+#define TUBE_STATS_STAGE(stage) do {} while (0)
+#define TUBE_STATS_COUNT(counter, count) do {} while (0)
+
+#endif
+
+}
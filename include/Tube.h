@@ -1,25 +1,121 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <functional>
+#include <memory>
+#include <string>
 #include <vector>
+#include <Arena.h>
 #include <Path.h>
+#include <RingKernel.h>
+#include <VertexLayout.h>
 
 namespace tube {
 
 enum class TubeCaps {
+	// Triangles from a tip vertex in the middle of each end ring, for
+	// convex profiles
 	TRIANGE_FAN,
+	// Triangles between the ring vertices, for any simple profile. The
+	// profile is triangulated once and shared through its Shape
 	EAR_CUT
 };
 
+// Makes the pathes of the input with the given index and passes them to
+// sink one by one, in order. Sources are called from several threads at
+// once, each index once, so pathes can be built and dropped on the fly
+using PathSource = std::function<void(size_t index, const std::function<void(const Path&)>& sink)>;
+
+// Post-transform vertex cache efficiency of an index list, simulated with
+// a FIFO cache
+struct VertexCacheStats {
+	// Average cache miss ratio, vertices transformed per triangle. A long
+	// regular grid gets close to 0.5 at best, the worst is 3
+	float acmr = 0.0f;
+	// Average transform to vertex ratio, 1 when every vertex is
+	// transformed once
+	float atvr = 0.0f;
+};
+
 class Tube {
-	void extrude(std::vector<glm::vec3> verts, bool shapeClosed);
+	friend struct Builder;
+	friend class EditableTube;
+	friend class InstancedTube;
+	friend class LodChain;
+	friend class MappedTube;
+	friend class TubeStream;
+	friend bool saveTube(const Tube& tube, const std::string& fileName);
+
+	// Polyline swept along a path, curves are tessellated and closed
+	// pathes end with their first point
+	static void toSweepPoints(const Path& path, Tessellation tessellation, std::pmr::vector<Point>& out);
+	// Polylines of the pathes of several sources, in the order of the sources
+	struct SweepPolylines {
+		std::pmr::vector<std::pmr::vector<std::pmr::vector<Point>>> bySource;
+		std::pmr::vector<std::pmr::vector<char>> closedBySource;
+		std::pmr::vector<const std::pmr::vector<Point>*> polylines;
+		std::pmr::vector<char> closed;
+
+		explicit SweepPolylines(std::pmr::memory_resource* memory);
+	};
+	// Convert the pathes of every source on up to numThreads threads
+	static SweepPolylines toSweepPolylines(size_t numSources, const PathSource& source,
+		Tessellation tessellation, unsigned int numThreads, std::pmr::memory_resource* memory);
+	static size_t numSweepIndices(size_t numRings, size_t shapeNumVerts);
+	// Place the shape on the frame of a polyline point
+	static RingTransform ringTransform(const Point& point, const Frame& frame);
+
+	// Duplicate profile vertices at corners sharper than the crease angle,
+	// so that both sides of the corner get their own normal
+	static Shape splitCreases(const Shape& shape);
+	// Cap triangulation of the swept vertices, kept in the shape and made
+	// again when they differ from the ones it was made for
+	static std::shared_ptr<CapTriangulation> capTriangulation(Shape& shape, const std::vector<glm::vec3>& verts);
+	// 2D normal of every profile vertex in x, y and its dot product with
+	// the vertex in z. Closed profiles are smooth across the seam unless
+	// the seam is a crease
+	static ShapeSoA profileNormals(const Shape& shape);
+	// Change of the radius per unit of length at a polyline point
+	static float radiusSlope(const Point* points, size_t numPoints, bool closed, size_t i);
+	// Stretch the ring of a miter point across the turn of the polyline,
+	// so that it meets the segments on both sides
+	static void miterRing(const Point* points, size_t numPoints, bool closed, size_t i, RingTransform& transform);
+	// Normals of a ring, the radius slope tilts them along the tangent
+	static void ringNormals(const Point& point, const Frame& frame, float slope,
+		const ShapeSoA& profile, glm::vec3* out);
+
+	// Write rings, quads and texture coordinates of a polyline with its
+	// frames, and normals from the profile normals unless normals is null.
+	// Indices are offset by baseVertex. Rings are also packed into
+	// vertexData, a buffer of numVertices vertices in the given layout
+	static void sweep(const Point* points, const Frame* frames, size_t numPoints, bool closed,
+		const ShapeSoA& shape, const ShapeSoA& profile,
+		glm::vec3* vertices, glm::vec3* normals, glm::vec2* texCoords, int* indices, int baseVertex,
+		const VertexLayout& layout, unsigned char* vertexData, size_t numVertices);
+
+	// Sweep the shape along the pathes of every source into this tube
+	void build(size_t numSources, const PathSource& source, Shape& profile,
+		Tessellation tessellation, unsigned int numThreads, VertexLayout layout, TubeNormals normals,
+		Arena* arena);
+
 	void bridge(int a1, int a2, int b1, int b2);
 	void connectStartWithEnd(int shapeNumVertices);
 	void triangleFan(int offset, int shapeVerts, int tipIndex);
+	// Add the triangles of the profile on the ring at offset, facing away
+	// from the ring at neighbour
+	void capRing(int offset, int neighbour, const std::vector<int>& triangles);
 	glm::vec3 getCentroidOfShape(int offset, int shapeVerts);
+	// Rewrite the packed vertex buffer from the attribute vectors
+	void packVertices();
+	// optimizeVertexCache() without returning a copy
+	void reorderForVertexCache(size_t cacheSize);
 
 	int mShapeNumVerts = 0;
-	bool mIsFirst = true;
+	// Null for tubes not swept from a shape, their caps triangulate the
+	// end ring instead
+	std::shared_ptr<CapTriangulation> mCapTriangulation;
+	VertexLayout mLayout = VertexLayout::none();
+	std::vector<unsigned char> mVertexData;
 
 	Tube();
 
@@ -29,19 +125,85 @@ public:
 	std::vector<glm::vec2> texCoords;
 	std::vector<int> indices;
 
-	Tube(Path path, Shape& shape);
+	// With a non-empty layout the vertices are also packed into a GPU-ready
+	// buffer while the tube is swept, see vertexData(). Scratch memory of the
+	// build comes from the arena, or from a temporary one when it is null.
+	// Reusing an arena across builds avoids heap allocations besides the
+	// mesh itself
+	Tube(Path path, Shape& shape, Tessellation tessellation = Tessellation(),
+		VertexLayout layout = VertexLayout::none(), TubeNormals normals = TubeNormals::NONE,
+		Arena* arena = nullptr);
 	Tube(std::vector<Tube> tubes);
+	// Sweep the shape along every path into one mesh, using up to numThreads
+	// threads (zero uses all hardware threads). The result is the same as
+	// merging the tubes of every path built one by one.
+	Tube(std::vector<Path>& pathes, Shape& shape, Tessellation tessellation = Tessellation(),
+		unsigned int numThreads = 0, VertexLayout layout = VertexLayout::none(),
+		TubeNormals normals = TubeNormals::NONE, Arena* arena = nullptr);
+	// The same, freeing the pathes while the tube is built
+	Tube(std::vector<Path>&& pathes, Shape& shape, Tessellation tessellation = Tessellation(),
+		unsigned int numThreads = 0, VertexLayout layout = VertexLayout::none(),
+		TubeNormals normals = TubeNormals::NONE, Arena* arena = nullptr);
+	// Sweep the shape along the pathes of numSources inputs. The result is
+	// the same as sweeping all of them in order, but only the pathes of the
+	// inputs in flight exist at once
+	Tube(size_t numSources, const PathSource& source, Shape& shape, Tessellation tessellation = Tessellation(),
+		unsigned int numThreads = 0, VertexLayout layout = VertexLayout::none(),
+		TubeNormals normals = TubeNormals::NONE, Arena* arena = nullptr);
 
 	Tube copy();
 
-	// Fill caps in place and return this instance of class.
+	// Fill caps in place and return this instance of class. Tubes with
+	// normals get normals for the cap tips too.
 	// If you need to fill caps in copy only, consider using .copy() before .fillCaps()
 	Tube fillCaps(TubeCaps capsType = TubeCaps::TRIANGE_FAN);
 
-	// Calculate normals in place
+	// Calculate normals in place by averaging the normals of the faces
+	// around every vertex. TubeNormals::ANALYTIC gives smoother normals
+	// while sweeping, without this pass
 	// If you need to calculate normals in copy only, consider using .copy() before .fillCaps()
 	Tube calculateNormals();
 
+	// Pack vertices into the layout in place and return this instance of class.
+	// fillCaps() and calculateNormals() keep the packed buffer up to date
+	Tube pack(VertexLayout layout);
+
+	const VertexLayout& layout() const;
+
+	// Packed vertices, empty when the layout is empty
+	Span<const unsigned char> vertexData() const;
+
+	// Packed vertices starting at the first vertex of the attribute,
+	// step by layout().stride(attribute)
+	Span<const unsigned char> attributeData(VertexAttribute attribute) const;
+
+	Span<const int> indexData() const;
+
+	// Indices in the given format and topology. The quads between two rings
+	// become one strip, other triangles a strip each. Throws
+	// std::length_error when the format cannot address every vertex, see
+	// split()
+	IndexBuffer packIndices(IndexFormat format = IndexFormat::UINT32,
+		IndexTopology topology = IndexTopology::TRIANGLES) const;
+
+	// Split into tubes of at most maxVertices vertices, small enough for
+	// 16-bit indices by default. Rings on the border of two parts and cap
+	// tips are repeated. The quads between two rings stay together, so
+	// parts still make one strip per ring pair
+	std::vector<Tube> split(size_t maxVertices = 65535) const;
+
+	// Reorder triangles in place so that they reuse the vertices a GPU
+	// keeps in a post-transform cache of cacheSize vertices, then number
+	// vertices in the order the triangles first use them, and return this
+	// instance of class. Vertices no longer follow the rings, so call it
+	// after fillCaps() and split(), which throw std::logic_error on a
+	// reordered tube. packIndices() makes a strip per triangle afterwards,
+	// it suits triangle lists
+	Tube optimizeVertexCache(size_t cacheSize = 32);
+
+	// Cache efficiency of the indices with a FIFO cache of cacheSize vertices
+	VertexCacheStats vertexCacheStats(size_t cacheSize = 32) const;
+
 	// To positions, texture coordinates and normals
 	std::vector<float> toXYZUVNormal();
 
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <string>
+#include <Tube.h>
+
+namespace tube {
+
+// Files of other versions are not loaded
+const uint32_t TUBE_FILE_VERSION = 1;
+
+// Write a tube to a binary file: a header with the counts, the vertex
+// layout, the bounding box and the offset of every buffer, then the
+// vertices, normals, texture coordinates, indices and packed vertices,
+// each starting on a 16-byte boundary. Numbers are stored in the byte
+// order of the machine. Returns false when the file cannot be written or
+// the tube has no rings, like one reordered by optimizeVertexCache()
+bool saveTube(const Tube& tube, const std::string& fileName);
+
+// Tube file mapped read-only into memory. Loading reads the header only,
+// the spans point into the mapping and pages are read on first access.
+// Spans are valid while the object lives. Indices are not checked
+// against the number of vertices
+class MappedTube {
+	void* mData = nullptr;
+	size_t mSize = 0;
+
+	Span<const glm::vec3> mVertices;
+	Span<const glm::vec3> mNormals;
+	Span<const glm::vec2> mTexCoords;
+	Span<const int> mIndices;
+	Span<const unsigned char> mVertexData;
+	VertexLayout mLayout = VertexLayout::none();
+	int mShapeNumVerts = 0;
+	glm::vec3 mBoundsMin = glm::vec3(0.0f);
+	glm::vec3 mBoundsMax = glm::vec3(0.0f);
+
+	void unmap();
+	// Point the spans into the mapping, false when the header does not fit
+	// the file
+	bool readHeader();
+
+public:
+	// Nothing is mapped when the file cannot be read or is not a tube file
+	// of this version, see isOpen()
+	MappedTube(const std::string& fileName);
+	~MappedTube();
+
+	MappedTube(const MappedTube&) = delete;
+	MappedTube& operator=(const MappedTube&) = delete;
+	MappedTube(MappedTube&& other) noexcept;
+	MappedTube& operator=(MappedTube&& other) noexcept;
+
+	bool isOpen() const;
+
+	Span<const glm::vec3> vertices() const;
+	// Empty when the saved tube had no normals
+	Span<const glm::vec3> normals() const;
+	Span<const glm::vec2> texCoords() const;
+	Span<const int> indices() const;
+	// Packed vertices, empty when the layout is empty
+	Span<const unsigned char> vertexData() const;
+	const VertexLayout& layout() const;
+
+	// Corners of the axis aligned box around the vertices
+	glm::vec3 boundsMin() const;
+	glm::vec3 boundsMax() const;
+
+	// Copy into a tube that can be changed, capped or built on
+	Tube toTube() const;
+};
+
+}
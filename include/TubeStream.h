@@ -0,0 +1,106 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <functional>
+#include <vector>
+#include <Tube.h>
+
+namespace tube {
+
+// Piece of a streamed tube. Indices refer to the vertices of the chunk.
+// Every chunk but the first starts with a copy of the last ring of the
+// previous one, so chunks can be drawn or stored on their own
+struct TubeChunk {
+	// Number of the chunk, counting from zero
+	size_t index = 0;
+	// Ring of the whole tube that the chunk starts with
+	size_t firstRing = 0;
+	size_t numRings = 0;
+	bool isLast = false;
+
+	Span<const glm::vec3> vertices;
+	// Empty without TubeNormals::ANALYTIC
+	Span<const glm::vec3> normals;
+	Span<const glm::vec2> texCoords;
+	Span<const int> indices;
+	// Vertices packed in the layout of the stream, empty when it is empty
+	Span<const unsigned char> vertexData;
+};
+
+// Called with every full chunk and with the rest on finish(). The chunk
+// memory is reused for the next chunk after the callback returns
+using TubeChunkCallback = std::function<void(const TubeChunk& chunk)>;
+
+// Sweeps a shape along an open path whose points arrive one by one and
+// hands the mesh out in chunks of a fixed number of rings, so memory stays
+// the same however long the path gets. Rings, frames and normals are the
+// same as in a Tube of the whole path. The length of the path is not known
+// in advance, so texture coordinates along the path are the length from
+// the start times vScale instead of running from 0 to 1.
+// A ring is written once the polyline point after it is known.
+class TubeStream {
+	Shape mShape;
+	ShapeSoA mShapeSoA;
+	ShapeSoA mProfileNormals;
+	Tessellation mTessellation;
+	VertexLayout mLayout;
+	bool mHasNormals;
+	size_t mRingsPerChunk;
+	float mVScale;
+	TubeChunkCallback mCallback;
+	RingKernel mRingKernel;
+
+	// Curves of a push are tessellated here, reset after every push
+	Arena mScratch;
+
+	// Last pushed path point and the polyline points waiting for the
+	// point after them
+	Point mLastPathPoint;
+	Point mPrevious;
+	Point mCurrent;
+	size_t mNumPathPoints = 0;
+	size_t mNumPolyPoints = 0;
+	Frame mFrame;
+	glm::vec3 mTangent = glm::vec3(0.0f);
+	float mLength = 0.0f;
+	bool mIsFinished = false;
+
+	// Rings of the chunk being filled
+	std::vector<glm::vec3> mVertices;
+	std::vector<glm::vec3> mNormals;
+	std::vector<glm::vec2> mTexCoords;
+	std::vector<int> mIndices;
+	std::vector<unsigned char> mVertexData;
+	size_t mChunkRings = 0;
+	size_t mNumChunks = 0;
+	size_t mNumRings = 0;
+
+	void addPolyPoint(const Point& point);
+	// Write the ring of mCurrent, next is null at the end of the path
+	void writeRing(const Point* next);
+	void emitChunk(bool isLast);
+
+public:
+	// ringsPerChunk counts the new rings of a chunk, at least one
+	TubeStream(Shape shape, TubeChunkCallback callback, size_t ringsPerChunk = 1024,
+		Tessellation tessellation = Tessellation(), VertexLayout layout = VertexLayout::none(),
+		TubeNormals normals = TubeNormals::NONE, float vScale = 1.0f);
+
+	TubeStream(const TubeStream&) = delete;
+	TubeStream& operator=(const TubeStream&) = delete;
+
+	// Add the next point of the path. Handles make the segment from the
+	// previous point a curve
+	void push(const Point& point);
+	// Write the last ring and hand out the remaining chunk. Nothing can be
+	// pushed afterwards
+	void finish();
+
+	// Rings written so far
+	size_t numRings() const;
+	size_t numChunks() const;
+	// Length of the polyline up to the last written ring
+	float length() const;
+};
+
+}
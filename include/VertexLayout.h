@@ -0,0 +1,107 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tube {
+
+// Pointer and number of elements of contiguous memory owned by someone else
+template<typename T>
+struct Span {
+	T* data = nullptr;
+	size_t size = 0;
+
+	T* begin() const { return data; }
+	T* end() const { return data + size; }
+	T& operator[](size_t i) const { return data[i]; }
+	bool empty() const { return size == 0; }
+};
+
+enum class VertexAttribute {
+	POSITION,
+	TEX_COORD,
+	NORMAL
+};
+
+enum class AttributeFormat {
+	// Attribute is not stored
+	NONE,
+	FLOAT32,
+	FLOAT16,
+	// Normals only, -1..1 mapped to -32767..32767
+	SNORM16,
+	// Texture coordinates only, 0..1 mapped to 0..65535
+	UNORM16
+};
+
+// Vertex buffer format for GPU upload. Attributes are padded to four bytes:
+// three-component 16-bit attributes get a fourth zero component.
+struct VertexLayout {
+	AttributeFormat position = AttributeFormat::FLOAT32;
+	AttributeFormat texCoord = AttributeFormat::FLOAT32;
+	AttributeFormat normal = AttributeFormat::FLOAT32;
+	// All attributes of a vertex next to each other, or one block per
+	// attribute in the order position, texCoord, normal
+	bool interleaved = true;
+
+	// Layout without attributes, used when no packed buffer is wanted
+	static VertexLayout none();
+
+	bool isEmpty() const;
+	AttributeFormat format(VertexAttribute attribute) const;
+
+	// Bytes taken by the attribute of one vertex, zero if it is not stored
+	size_t attributeSize(VertexAttribute attribute) const;
+	// Bytes taken by all attributes of one vertex
+	size_t vertexSize() const;
+	// Byte offset of the attribute of the first vertex and distance to the
+	// next vertex in a buffer holding numVertices vertices
+	size_t offset(VertexAttribute attribute, size_t numVertices) const;
+	size_t stride(VertexAttribute attribute) const;
+	// Bytes taken by numVertices vertices
+	size_t size(size_t numVertices) const;
+
+	// Convert and write one attribute of the vertex at index
+	void writePosition(unsigned char* data, size_t numVertices, size_t index, glm::vec3 position) const;
+	void writeTexCoord(unsigned char* data, size_t numVertices, size_t index, glm::vec2 texCoord) const;
+	void writeNormal(unsigned char* data, size_t numVertices, size_t index, glm::vec3 normal) const;
+};
+
+enum class IndexFormat {
+	UINT32,
+	// For meshes of at most 65536 vertices, 65535 with strips
+	UINT16
+};
+
+enum class IndexTopology {
+	TRIANGLES,
+	// Strips separated by the restart index, every index bit set. Strips
+	// start with a repeated vertex so that every triangle keeps the
+	// winding of the triangle list
+	TRIANGLE_STRIP
+};
+
+// Index buffer for GPU upload
+struct IndexBuffer {
+	IndexFormat format = IndexFormat::UINT32;
+	IndexTopology topology = IndexTopology::TRIANGLES;
+	std::vector<unsigned char> data;
+
+	// Bytes taken by one index
+	size_t indexSize() const;
+	size_t numIndices() const;
+	// Index that ends a strip, see glPrimitiveRestartIndex
+	uint32_t restartIndex() const;
+
+	// Throws std::out_of_range for an index the format cannot hold
+	void push(uint32_t index);
+	uint32_t operator[](size_t i) const;
+};
+
+// IEEE 754 half precision conversion with round to nearest even
+unsigned short floatToHalf(float value);
+float halfToFloat(unsigned short half);
+
+}
@@ -0,0 +1,93 @@
+#include "Arena.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace tube;
+
+namespace {
+
+// Block headers keep the data after them aligned for any type
+const size_t headerSize = (sizeof(void*) * 2 + alignof(std::max_align_t) - 1) /
+	alignof(std::max_align_t) * alignof(std::max_align_t);
+
+size_t alignUp(size_t value, size_t alignment) {
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+}
+
+Arena::Arena(size_t initialSize, std::pmr::memory_resource* upstream)
+	: mUpstream(upstream), mNextBlockSize(std::max(initialSize, (size_t)1024))
+{
+}
+
+Arena::~Arena() {
+	releaseBlocks();
+}
+
+void Arena::addBlock(size_t minSize) {
+	// Blocks grow geometrically so a build needs only a few of them
+	size_t size = std::max(mNextBlockSize, minSize);
+	void* memory = mUpstream->allocate(headerSize + size, alignof(std::max_align_t));
+	Block* block = static_cast<Block*>(memory);
+	block->previous = mBlock;
+	block->size = size;
+	mBlock = block;
+	mUsed = 0;
+	mNextBlockSize = size * 2;
+	mNumBlockAllocations++;
+}
+
+void Arena::releaseBlocks() {
+	while (mBlock != nullptr) {
+		Block* previous = mBlock->previous;
+		mUpstream->deallocate(mBlock, headerSize + mBlock->size, alignof(std::max_align_t));
+		mBlock = previous;
+	}
+	mUsed = 0;
+}
+
+void* Arena::do_allocate(size_t bytes, size_t alignment) {
+	std::lock_guard<std::mutex> lock(mMutex);
+	assert(alignment <= alignof(std::max_align_t));
+	size_t offset = alignUp(mUsed, alignment);
+	if (mBlock == nullptr || offset + bytes > mBlock->size) {
+		addBlock(bytes);
+		offset = 0;
+	}
+	mUsed = offset + bytes;
+	mBytesAllocated += bytes;
+	return reinterpret_cast<unsigned char*>(mBlock) + headerSize + offset;
+}
+
+void Arena::do_deallocate(void*, size_t, size_t) {
+	// Memory comes back all at once in reset()
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+	return this == &other;
+}
+
+void Arena::reset() {
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (mBlock != nullptr && mBlock->previous != nullptr) {
+		// Replace the blocks with one that holds all of them
+		size_t total = 0;
+		for (Block* block = mBlock; block != nullptr; block = block->previous)
+			total += block->size;
+		releaseBlocks();
+		mNextBlockSize = total;
+		addBlock(total);
+	}
+	mUsed = 0;
+	mBytesAllocated = 0;
+}
+
+size_t Arena::bytesAllocated() const {
+	return mBytesAllocated;
+}
+
+size_t Arena::numBlockAllocations() const {
+	return mNumBlockAllocations;
+}
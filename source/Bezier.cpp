@@ -1,4 +1,11 @@
 #include "Bezier.h"
+#include "BezierBasis.h"
+#include "RingKernel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
 
 using namespace tube;
 
@@ -6,37 +13,285 @@ float tube::lerpf(float a, float b, float t) {
     return a + t * (b - a);
 }
 
-std::vector<glm::vec3> tube::quadraticBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, int segments) {
-    auto points = std::vector<glm::vec3>(segments);
-    float step = 1.0f / (segments - 1);
-    float t = 0.0f;
+// Sample count specializations with compile-time weight tables, other
+// counts use forward differencing
+#define TUBE_BEZIER_SEGMENTS(degree, segments, controlPoints, out) \
+    switch (segments) { \
+    case 8:  evaluateBezier<degree, 8>(controlPoints, out); break; \
+    case 16: evaluateBezier<degree, 16>(controlPoints, out); break; \
+    case 24: evaluateBezier<degree, 24>(controlPoints, out); break; \
+    case 32: evaluateBezier<degree, 32>(controlPoints, out); break; \
+    case 64: evaluateBezier<degree, 64>(controlPoints, out); break; \
+    default: forwardDifferences<degree>(controlPoints, segments, out); break; \
+    }
+
+namespace {
+
+// Step through the polynomial form of the curve by adding differences.
+// Differences are kept in double and relative to the first control point,
+// so the samples do not drift however many there are
+template<int Degree>
+void forwardDifferences(const glm::vec3* p, int segments, glm::vec3* out) {
+    double h = 1.0 / (double)(segments - 1);
+    // Value and differences of x, y and z
+    double f[3][Degree + 1];
+    for (int c = 0; c < 3; c++) {
+        double p0 = 0.0;
+        double p1 = (double)p[1][c] - (double)p[0][c];
+        double p2 = (double)p[2][c] - (double)p[0][c];
+        f[c][0] = 0.0;
+        if (Degree == 2) {
+            // B(t) = a t^2 + b t
+            double a = p0 - 2.0 * p1 + p2;
+            double b = 2.0 * (p1 - p0);
+            f[c][1] = a * h * h + b * h;
+            f[c][2] = 2.0 * a * h * h;
+        }
+        else {
+            // B(t) = a t^3 + b t^2 + c t
+            double p3 = (double)p[Degree][c] - (double)p[0][c];
+            double a = p3 - 3.0 * p2 + 3.0 * p1 - p0;
+            double b = 3.0 * (p2 - 2.0 * p1 + p0);
+            double d = 3.0 * (p1 - p0);
+            f[c][1] = a * h * h * h + b * h * h + d * h;
+            f[c][2] = 6.0 * a * h * h * h + 2.0 * b * h * h;
+            f[c][Degree] = 6.0 * a * h * h * h;
+        }
+    }
+
+    for (int i = 0; i < segments - 1; i++) {
+        out[i] = p[0] + glm::vec3((float)f[0][0], (float)f[1][0], (float)f[2][0]);
+        for (int c = 0; c < 3; c++) {
+            for (int k = 0; k < Degree; k++)
+                f[c][k] += f[c][k + 1];
+        }
+    }
+    out[segments - 1] = p[Degree];
+}
+
+// Weights of the control points after the first one, as the x, y and z of
+// a shape, so that ring kernels can evaluate curves
+ShapeSoA basisSoA(int degree, int segments) {
+    auto weights = std::vector<glm::vec3>((size_t)segments, glm::vec3(0.0f));
     for (int i = 0; i < segments; i++) {
-        auto q0 = glm::mix(p0, p1, t);
-        auto q1 = glm::mix(p1, p2, t);
-        auto r = glm::mix(q0, q1, t);
-        points[i] = r;
-        t += step;
+        double t = (double)i / (double)(segments - 1);
+        double s = 1.0 - t;
+        if (degree == 2)
+            weights[i] = glm::vec3((float)(2.0 * s * t), (float)(t * t), 0.0f);
+        else
+            weights[i] = glm::vec3((float)(3.0 * s * s * t), (float)(3.0 * s * t * t), (float)(t * t * t));
     }
+    return ShapeSoA(weights);
+}
+
+}
+
+std::vector<glm::vec3> tube::quadraticBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, int segments) {
+    auto points = std::vector<glm::vec3>(segments, p0);
+    quadraticBezier(p0, p1, p2, segments, points.data());
     return points;
 }
 
 std::vector<glm::vec3> tube::cubicBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, int segments) {
-    auto points = std::vector<glm::vec3>(segments);
-    float step = 1.0f / (segments - 1);
-    float t = 0.0f;
-    for (int i = 0; i < segments; i++) {
-        auto q0 = glm::mix(p0, p1, t);
-        auto q1 = glm::mix(p1, p2, t);
-        auto q2 = glm::mix(p2, p3, t);
-        auto r0 = glm::mix(q0, q1, t);
-        auto r1 = glm::mix(q1, q2, t);
-        auto b = glm::mix(r0, r1, t);
-        points[i] = b;
-        t += step;
+    auto points = std::vector<glm::vec3>(segments, p0);
+    cubicBezier(p0, p1, p2, p3, segments, points.data());
+    return points;
+}
+
+void tube::quadraticBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, int segments, glm::vec3* out) {
+    if (segments < 2) {
+        std::fill(out, out + std::max(segments, 0), p0);
+        return;
     }
+    glm::vec3 controlPoints[3] = { p0, p1, p2 };
+    TUBE_BEZIER_SEGMENTS(2, segments, controlPoints, out)
+}
+
+void tube::cubicBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, int segments, glm::vec3* out) {
+    if (segments < 2) {
+        std::fill(out, out + std::max(segments, 0), p0);
+        return;
+    }
+    glm::vec3 controlPoints[4] = { p0, p1, p2, p3 };
+    TUBE_BEZIER_SEGMENTS(3, segments, controlPoints, out)
+}
+
+void tube::quadraticBezierBatch(const glm::vec3* controlPoints, size_t numCurves, int segments, glm::vec3* out) {
+    assert(segments >= 2);
+    auto basis = basisSoA(2, segments);
+    auto kernel = bestRingKernel();
+    for (size_t c = 0; c < numCurves; c++) {
+        const glm::vec3* p = controlPoints + c * 3;
+        RingTransform transform;
+        transform.axisX = p[1] - p[0];
+        transform.axisY = p[2] - p[0];
+        transform.axisZ = glm::vec3(0.0f);
+        transform.origin = p[0];
+        glm::vec3* curve = out + c * (size_t)segments;
+        transformRing(kernel, transform, basis, curve);
+        curve[segments - 1] = p[2];
+    }
+}
+
+void tube::cubicBezierBatch(const glm::vec3* controlPoints, size_t numCurves, int segments, glm::vec3* out) {
+    assert(segments >= 2);
+    auto basis = basisSoA(3, segments);
+    auto kernel = bestRingKernel();
+    for (size_t c = 0; c < numCurves; c++) {
+        const glm::vec3* p = controlPoints + c * 4;
+        RingTransform transform;
+        transform.axisX = p[1] - p[0];
+        transform.axisY = p[2] - p[0];
+        transform.axisZ = p[3] - p[0];
+        transform.origin = p[0];
+        glm::vec3* curve = out + c * (size_t)segments;
+        transformRing(kernel, transform, basis, curve);
+        curve[segments - 1] = p[3];
+    }
+}
+
+namespace {
+
+// Subdivision depth limit, gives at most 2^16 pieces per curve
+const int maxAdaptiveDepth = 16;
+
+float angleBetween(glm::vec3 a, glm::vec3 b) {
+    float lengths = glm::length(a) * glm::length(b);
+    if (lengths <= 0.0f)
+        return 0.0f;
+    return acosf(glm::clamp(glm::dot(a, b) / lengths, -1.0f, 1.0f));
+}
+
+float maxAbs(glm::vec3 v) {
+    return fmaxf(fabsf(v.x), fmaxf(fabsf(v.y), fabsf(v.z)));
+}
+
+// Tolerance that float coordinates of this magnitude can actually meet.
+// Smaller tolerances would split far away curves down to the depth limit
+float reachableTolerance(float tolerance, float magnitude) {
+    return fmaxf(tolerance, magnitude * 8.0f * FLT_EPSILON);
+}
+
+template<typename Verts, typename Params>
+struct AdaptiveOutput {
+    Verts& verts;
+    Params* params;
+    float tolerance;
+    float angleTolerance;
+
+    void push(glm::vec3 v, float t) {
+        verts.push_back(v);
+        if (params)
+            params->push_back(t);
+    }
+};
+
+template<typename Output>
+void subdivideQuadratic(Output& out, glm::vec3 p0, glm::vec3 p1, glm::vec3 p2,
+                        float t0, float t1, int depth) {
+    // Largest distance between the curve and its chord is at t = 0.5
+    float deviation = glm::length(p0 - 2.0f * p1 + p2) * 0.25f;
+    bool flat = deviation <= out.tolerance;
+    if (flat && out.angleTolerance > 0.0f)
+        flat = angleBetween(p1 - p0, p2 - p1) <= out.angleTolerance;
+
+    if (flat || depth >= maxAdaptiveDepth) {
+        out.push(p2, t1);
+        return;
+    }
+
+    auto two = divideQuadraticBezier(p0, p1, p2, 0.5f);
+    float tMid = (t0 + t1) * 0.5f;
+    subdivideQuadratic(out, two.a0, two.a1, two.a2, t0, tMid, depth + 1);
+    subdivideQuadratic(out, two.b0, two.b1, two.b2, tMid, t1, depth + 1);
+}
+
+template<typename Output>
+void subdivideCubic(Output& out, glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3,
+                    float t0, float t1, int depth) {
+    // Flatness bound from the distance of the handles to the chord,
+    // max |B(t) - L(t)|^2 <= (max(u^2) + max(v^2) + ...) / 16
+    glm::vec3 u = 3.0f * p1 - 2.0f * p0 - p3;
+    glm::vec3 v = 3.0f * p2 - p0 - 2.0f * p3;
+    float flatness = fmaxf(u.x * u.x, v.x * v.x) +
+                     fmaxf(u.y * u.y, v.y * v.y) +
+                     fmaxf(u.z * u.z, v.z * v.z);
+    bool flat = flatness <= 16.0f * out.tolerance * out.tolerance;
+    if (flat && out.angleTolerance > 0.0f) {
+        glm::vec3 startDir = p1 != p0 ? p1 - p0 : p2 - p0;
+        glm::vec3 endDir = p3 != p2 ? p3 - p2 : p3 - p1;
+        flat = angleBetween(startDir, endDir) <= out.angleTolerance;
+    }
+
+    if (flat || depth >= maxAdaptiveDepth) {
+        out.push(p3, t1);
+        return;
+    }
+
+    auto two = divideCubicBezier(p0, p1, p2, p3, 0.5f);
+    float tMid = (t0 + t1) * 0.5f;
+    subdivideCubic(out, two.a0, two.a1, two.a2, two.a3, t0, tMid, depth + 1);
+    subdivideCubic(out, two.b0, two.b1, two.b2, two.b3, tMid, t1, depth + 1);
+}
+
+}
+
+namespace {
+
+template<typename Verts, typename Params>
+void appendAdaptiveQuadratic(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2,
+                             float tolerance, float angleTolerance, Verts& verts, Params* params) {
+    float magnitude = fmaxf(maxAbs(p0), fmaxf(maxAbs(p1), maxAbs(p2)));
+    tolerance = reachableTolerance(tolerance, magnitude);
+    AdaptiveOutput<Verts, Params> out = { verts, params, tolerance, angleTolerance };
+    out.push(p0, 0.0f);
+    subdivideQuadratic(out, p0, p1, p2, 0.0f, 1.0f, 0);
+}
+
+template<typename Verts, typename Params>
+void appendAdaptiveCubic(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3,
+                         float tolerance, float angleTolerance, Verts& verts, Params* params) {
+    float magnitude = fmaxf(fmaxf(maxAbs(p0), maxAbs(p1)), fmaxf(maxAbs(p2), maxAbs(p3)));
+    tolerance = reachableTolerance(tolerance, magnitude);
+    AdaptiveOutput<Verts, Params> out = { verts, params, tolerance, angleTolerance };
+    out.push(p0, 0.0f);
+    subdivideCubic(out, p0, p1, p2, p3, 0.0f, 1.0f, 0);
+}
+
+}
+
+std::vector<glm::vec3> tube::adaptiveQuadraticBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2,
+                                                     float tolerance, float angleTolerance,
+                                                     std::vector<float>* params) {
+    std::vector<glm::vec3> points;
+    if (params)
+        params->clear();
+    appendAdaptiveQuadratic(p0, p1, p2, tolerance, angleTolerance, points, params);
     return points;
 }
 
+std::vector<glm::vec3> tube::adaptiveCubicBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3,
+                                                 float tolerance, float angleTolerance,
+                                                 std::vector<float>* params) {
+    std::vector<glm::vec3> points;
+    if (params)
+        params->clear();
+    appendAdaptiveCubic(p0, p1, p2, p3, tolerance, angleTolerance, points, params);
+    return points;
+}
+
+void tube::adaptiveQuadraticBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2,
+                                   float tolerance, float angleTolerance,
+                                   std::pmr::vector<glm::vec3>& verts, std::pmr::vector<float>& params) {
+    appendAdaptiveQuadratic(p0, p1, p2, tolerance, angleTolerance, verts, &params);
+}
+
+void tube::adaptiveCubicBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3,
+                               float tolerance, float angleTolerance,
+                               std::pmr::vector<glm::vec3>& verts, std::pmr::vector<float>& params) {
+    appendAdaptiveCubic(p0, p1, p2, p3, tolerance, angleTolerance, verts, &params);
+}
+
 TwoQuadraticBeziers tube::divideQuadraticBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, float t) {
     auto q0 = glm::mix(p0, p1, t);
     auto q1 = glm::mix(p1, p2, t);
@@ -68,4 +323,25 @@ TwoCubicBeziers tube::divideCubicBezier(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2
     two.b2 = q2;
     two.b3 = p3;
     return two;
-}
\ No newline at end of file
+}
+
+glm::vec3 tube::cubicBezierPoint(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float t) {
+    float u = 1.0f - t;
+    return p0 * (u * u * u) + p1 * (3.0f * u * u * t) + p2 * (3.0f * u * t * t) + p3 * (t * t * t);
+}
+
+glm::vec3 tube::cubicBezierDerivative(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float t) {
+    float u = 1.0f - t;
+    return (p1 - p0) * (3.0f * u * u) + (p2 - p1) * (6.0f * u * t) + (p3 - p2) * (3.0f * t * t);
+}
+
+float tube::cubicBezierLength(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, float t0, float t1) {
+    static const float nodes[5] = { -0.9061798459f, -0.5384693101f, 0.0f, 0.5384693101f, 0.9061798459f };
+    static const float weights[5] = { 0.2369268851f, 0.4786286705f, 0.5688888889f, 0.4786286705f, 0.2369268851f };
+    float half = (t1 - t0) * 0.5f;
+    float mid = (t0 + t1) * 0.5f;
+    float sum = 0.0f;
+    for (int i = 0; i < 5; i++)
+        sum += weights[i] * glm::length(cubicBezierDerivative(p0, p1, p2, p3, mid + half * nodes[i]));
+    return sum * half;
+}
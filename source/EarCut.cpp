@@ -0,0 +1,503 @@
+// Ear clipping ported from earcut, https://github.com/mapbox/earcut,
+// under the ISC License:
+//
+// Copyright (c) 2016, Mapbox
+//
+// Permission to use, copy, modify, and/or distribute this software for any purpose
+// with or without fee is hereby granted, provided that the above copyright notice
+// and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH REGARD TO
+// THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS.
+// IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR
+// CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+// OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACT,
+// ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+#include "EarCut.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+
+using namespace tube;
+
+namespace {
+
+// Polygons with more points than this look up ears through the z-order hash
+const size_t HASH_THRESHOLD = 80;
+
+// Polygon vertex in a circular doubly linked list. Vertices are also
+// linked in z-order, so the points near an ear are found without walking
+// the whole polygon
+struct Node {
+	int i;
+	double x;
+	double y;
+	Node* prev = nullptr;
+	Node* next = nullptr;
+	uint32_t z = 0;
+	Node* prevZ = nullptr;
+	Node* nextZ = nullptr;
+
+	Node(int i, double x, double y): i(i), x(x), y(y) {}
+};
+
+// Twice the signed area of the triangle, positive when it turns
+// counter-clockwise
+double cross(const Node* p, const Node* q, const Node* r) {
+	return (q->x - p->x) * (r->y - p->y) - (q->y - p->y) * (r->x - p->x);
+}
+
+bool equals(const Node* a, const Node* b) {
+	return a->x == b->x && a->y == b->y;
+}
+
+// Point p in the counter-clockwise triangle abc or on its border
+bool pointInTriangle(const Node* a, const Node* b, const Node* c, const Node* p) {
+	return cross(a, b, p) >= 0.0 && cross(b, c, p) >= 0.0 && cross(c, a, p) >= 0.0;
+}
+
+double sign(double v) {
+	return (v > 0.0) - (v < 0.0);
+}
+
+// Point q on the segment pr, given the three are collinear
+bool onSegment(const Node* p, const Node* q, const Node* r) {
+	return q->x <= std::max(p->x, r->x) && q->x >= std::min(p->x, r->x) &&
+		q->y <= std::max(p->y, r->y) && q->y >= std::min(p->y, r->y);
+}
+
+bool intersects(const Node* p1, const Node* q1, const Node* p2, const Node* q2) {
+	double o1 = sign(cross(p1, q1, p2));
+	double o2 = sign(cross(p1, q1, q2));
+	double o3 = sign(cross(p2, q2, p1));
+	double o4 = sign(cross(p2, q2, q1));
+	if (o1 != o2 && o3 != o4)
+		return true;
+	return (o1 == 0.0 && onSegment(p1, p2, q1)) || (o2 == 0.0 && onSegment(p1, q2, q1)) ||
+		(o3 == 0.0 && onSegment(p2, p1, q2)) || (o4 == 0.0 && onSegment(p2, q1, q2));
+}
+
+// The diagonal ab starts into the inside of the polygon at a
+bool locallyInside(const Node* a, const Node* b) {
+	if (cross(a->prev, a, a->next) > 0.0)
+		return cross(a, b, a->next) <= 0.0 && cross(a, a->prev, b) <= 0.0;
+	return cross(a, b, a->prev) > 0.0 || cross(a, a->next, b) > 0.0;
+}
+
+// The middle of the diagonal ab is inside the polygon
+bool middleInside(const Node* a, const Node* b) {
+	double px = (a->x + b->x) / 2.0;
+	double py = (a->y + b->y) / 2.0;
+	bool inside = false;
+	const Node* p = a;
+	do {
+		if ((p->y > py) != (p->next->y > py) && p->next->y != p->y &&
+			px < (p->next->x - p->x) * (py - p->y) / (p->next->y - p->y) + p->x)
+			inside = !inside;
+		p = p->next;
+	} while (p != a);
+	return inside;
+}
+
+bool intersectsPolygon(const Node* a, const Node* b) {
+	const Node* p = a;
+	do {
+		if (p->i != a->i && p->next->i != a->i && p->i != b->i && p->next->i != b->i &&
+			intersects(p, p->next, a, b))
+			return true;
+		p = p->next;
+	} while (p != a);
+	return false;
+}
+
+// The polygon can be cut in two along ab
+bool isValidDiagonal(const Node* a, const Node* b) {
+	if (a->next->i == b->i || a->prev->i == b->i || intersectsPolygon(a, b))
+		return false;
+	if (locallyInside(a, b) && locallyInside(b, a) && middleInside(a, b) &&
+		(cross(a->prev, a, b->prev) != 0.0 || cross(a, b->prev, b) != 0.0))
+		return true;
+	return equals(a, b) && cross(a->prev, a, a->next) < 0.0 && cross(b->prev, b, b->next) < 0.0;
+}
+
+void removeNode(Node* p) {
+	p->next->prev = p->prev;
+	p->prev->next = p->next;
+	if (p->prevZ != nullptr)
+		p->prevZ->nextZ = p->nextZ;
+	if (p->nextZ != nullptr)
+		p->nextZ->prevZ = p->prevZ;
+}
+
+// Interleave the bits of the coordinates, scaled to 15 bits
+uint32_t zOrder(double x, double y) {
+	uint32_t ix = (uint32_t)x;
+	uint32_t iy = (uint32_t)y;
+	ix = (ix | (ix << 8)) & 0x00FF00FF;
+	ix = (ix | (ix << 4)) & 0x0F0F0F0F;
+	ix = (ix | (ix << 2)) & 0x33333333;
+	ix = (ix | (ix << 1)) & 0x55555555;
+	iy = (iy | (iy << 8)) & 0x00FF00FF;
+	iy = (iy | (iy << 4)) & 0x0F0F0F0F;
+	iy = (iy | (iy << 2)) & 0x33333333;
+	iy = (iy | (iy << 1)) & 0x55555555;
+	return ix | (iy << 1);
+}
+
+// Bottom-up merge sort of the z-order list, returns its new head
+Node* sortLinked(Node* list) {
+	size_t inSize = 1;
+	size_t numMerges;
+	do {
+		Node* p = list;
+		Node* tail = nullptr;
+		list = nullptr;
+		numMerges = 0;
+		while (p != nullptr) {
+			numMerges++;
+			Node* q = p;
+			size_t pSize = 0;
+			for (size_t k = 0; k < inSize && q != nullptr; k++) {
+				pSize++;
+				q = q->nextZ;
+			}
+			size_t qSize = inSize;
+			while (pSize > 0 || (qSize > 0 && q != nullptr)) {
+				Node* e;
+				if (pSize != 0 && (qSize == 0 || q == nullptr || p->z <= q->z)) {
+					e = p;
+					p = p->nextZ;
+					pSize--;
+				}
+				else {
+					e = q;
+					q = q->nextZ;
+					qSize--;
+				}
+				if (tail != nullptr)
+					tail->nextZ = e;
+				else
+					list = e;
+				e->prevZ = tail;
+				tail = e;
+			}
+			p = q;
+		}
+		tail->nextZ = nullptr;
+		inSize *= 2;
+	} while (numMerges > 1);
+	return list;
+}
+
+class EarCutter {
+	std::deque<Node> mNodes;
+	std::vector<int>& mTriangles;
+	double mMinX = 0.0;
+	double mMinY = 0.0;
+	// Scale of coordinates to the z-order grid, zero without the hash
+	double mInvSize = 0.0;
+
+	Node* insertNode(int i, double x, double y, Node* last) {
+		mNodes.emplace_back(i, x, y);
+		Node* p = &mNodes.back();
+		if (last == nullptr) {
+			p->prev = p;
+			p->next = p;
+		}
+		else {
+			p->next = last->next;
+			p->prev = last;
+			last->next->prev = p;
+			last->next = p;
+		}
+		return p;
+	}
+
+	void addTriangle(const Node* a, const Node* b, const Node* c) {
+		mTriangles.push_back(a->i);
+		mTriangles.push_back(b->i);
+		mTriangles.push_back(c->i);
+	}
+
+	// Remove repeated points and points on a straight line between their
+	// neighbours
+	Node* filterPoints(Node* start, Node* end = nullptr) {
+		if (end == nullptr)
+			end = start;
+		Node* p = start;
+		bool again;
+		do {
+			again = false;
+			if (equals(p, p->next) || cross(p->prev, p, p->next) == 0.0) {
+				removeNode(p);
+				p = end = p->prev;
+				if (p == p->next)
+					break;
+				again = true;
+			}
+			else {
+				p = p->next;
+			}
+		} while (again || p != end);
+		return end;
+	}
+
+	bool isEar(const Node* ear) const {
+		const Node* a = ear->prev;
+		const Node* c = ear->next;
+		if (cross(a, ear, c) <= 0.0)
+			return false;
+		// No reflex point may be inside the ear
+		for (const Node* p = c->next; p != a; p = p->next) {
+			if (!equals(p, a) && !equals(p, c) && pointInTriangle(a, ear, c, p) &&
+				cross(p->prev, p, p->next) <= 0.0)
+				return false;
+		}
+		return true;
+	}
+
+	// isEar() looking only at the points in the z-order range of the ear's
+	// bounding box
+	bool isEarHashed(const Node* ear) const {
+		const Node* a = ear->prev;
+		const Node* c = ear->next;
+		if (cross(a, ear, c) <= 0.0)
+			return false;
+
+		double minX = std::min({ a->x, ear->x, c->x });
+		double minY = std::min({ a->y, ear->y, c->y });
+		double maxX = std::max({ a->x, ear->x, c->x });
+		double maxY = std::max({ a->y, ear->y, c->y });
+		uint32_t minZ = zOrder((minX - mMinX) * mInvSize, (minY - mMinY) * mInvSize);
+		uint32_t maxZ = zOrder((maxX - mMinX) * mInvSize, (maxY - mMinY) * mInvSize);
+
+		auto blocks = [&](const Node* p) {
+			return p != a && p != c && !equals(p, a) && !equals(p, c) && pointInTriangle(a, ear, c, p) &&
+				cross(p->prev, p, p->next) <= 0.0;
+		};
+		const Node* p = ear->prevZ;
+		const Node* n = ear->nextZ;
+		// Walk both directions at once while both are in range
+		while (p != nullptr && p->z >= minZ && n != nullptr && n->z <= maxZ) {
+			if (blocks(p) || blocks(n))
+				return false;
+			p = p->prevZ;
+			n = n->nextZ;
+		}
+		for (; p != nullptr && p->z >= minZ; p = p->prevZ) {
+			if (blocks(p))
+				return false;
+		}
+		for (; n != nullptr && n->z <= maxZ; n = n->nextZ) {
+			if (blocks(n))
+				return false;
+		}
+		return true;
+	}
+
+	void indexCurve(Node* start) {
+		Node* p = start;
+		do {
+			if (p->z == 0)
+				p->z = zOrder((p->x - mMinX) * mInvSize, (p->y - mMinY) * mInvSize);
+			p->prevZ = p->prev;
+			p->nextZ = p->next;
+			p = p->next;
+		} while (p != start);
+		p->prevZ->nextZ = nullptr;
+		p->prevZ = nullptr;
+		sortLinked(p);
+	}
+
+	// Cut off the small loops where two neighbouring edges cross
+	Node* cureLocalIntersections(Node* start) {
+		Node* p = start;
+		do {
+			Node* a = p->prev;
+			Node* b = p->next->next;
+			if (!equals(a, b) && intersects(a, p, p->next, b) && locallyInside(a, b) && locallyInside(b, a)) {
+				addTriangle(a, p, b);
+				removeNode(p);
+				removeNode(p->next);
+				p = start = b;
+			}
+			p = p->next;
+		} while (p != start);
+		return filterPoints(p);
+	}
+
+	// Cut the polygon in two along a valid diagonal and triangulate both
+	void splitEarCut(Node* start) {
+		Node* a = start;
+		do {
+			Node* b = a->next->next;
+			while (b != a->prev) {
+				if (a->i != b->i && isValidDiagonal(a, b)) {
+					Node* c = splitPolygon(a, b);
+					a = filterPoints(a, a->next);
+					c = filterPoints(c, c->next);
+					earCutLinked(a, 0);
+					earCutLinked(c, 0);
+					return;
+				}
+				b = b->next;
+			}
+			a = a->next;
+		} while (a != start);
+	}
+
+	// Link a to b with a copy of both, so that the polygon becomes two.
+	// Returns the copy of b
+	Node* splitPolygon(Node* a, Node* b) {
+		mNodes.emplace_back(a->i, a->x, a->y);
+		Node* a2 = &mNodes.back();
+		mNodes.emplace_back(b->i, b->x, b->y);
+		Node* b2 = &mNodes.back();
+		Node* an = a->next;
+		Node* bp = b->prev;
+
+		a->next = b;
+		b->prev = a;
+		a2->next = an;
+		an->prev = a2;
+		b2->next = a2;
+		a2->prev = b2;
+		bp->next = b2;
+		b2->prev = bp;
+		return b2;
+	}
+
+public:
+	explicit EarCutter(std::vector<int>& triangles): mTriangles(triangles) {}
+
+	void run(const glm::vec2* points, size_t numPoints) {
+		double area = 0.0;
+		for (size_t k = 0, j = numPoints - 1; k < numPoints; j = k++)
+			area += ((double)points[j].x - points[k].x) * ((double)points[k].y + points[j].y);
+
+		// Link the points counter-clockwise
+		Node* last = nullptr;
+		if (area >= 0.0) {
+			for (size_t k = 0; k < numPoints; k++)
+				last = insertNode((int)k, points[k].x, points[k].y, last);
+		}
+		else {
+			for (size_t k = numPoints; k-- > 0;)
+				last = insertNode((int)k, points[k].x, points[k].y, last);
+		}
+		last = filterPoints(last);
+		if (last->next == last->prev)
+			return;
+
+		if (numPoints > HASH_THRESHOLD) {
+			mMinX = mMinY = INFINITY;
+			double maxX = -INFINITY;
+			double maxY = -INFINITY;
+			for (size_t k = 0; k < numPoints; k++) {
+				mMinX = std::min(mMinX, (double)points[k].x);
+				mMinY = std::min(mMinY, (double)points[k].y);
+				maxX = std::max(maxX, (double)points[k].x);
+				maxY = std::max(maxY, (double)points[k].y);
+			}
+			double size = std::max(maxX - mMinX, maxY - mMinY);
+			mInvSize = size > 0.0 ? 32767.0 / size : 0.0;
+		}
+		earCutLinked(last, 0);
+	}
+
+	// Clip ears until none are left. When no ear is found the polygon is
+	// cleaned up, then its local self-intersections are cut off, then it
+	// is split in two
+	void earCutLinked(Node* ear, int pass) {
+		if (ear == nullptr)
+			return;
+		if (pass == 0 && mInvSize > 0.0)
+			indexCurve(ear);
+
+		Node* stop = ear;
+		while (ear->prev != ear->next) {
+			Node* prev = ear->prev;
+			Node* next = ear->next;
+			if (mInvSize > 0.0 ? isEarHashed(ear) : isEar(ear)) {
+				addTriangle(prev, ear, next);
+				removeNode(ear);
+				// Skipping the next point gives less sliver triangles
+				ear = next->next;
+				stop = next->next;
+				continue;
+			}
+			ear = next;
+			if (ear == stop) {
+				if (pass == 0)
+					earCutLinked(filterPoints(ear), 1);
+				else if (pass == 1)
+					earCutLinked(cureLocalIntersections(filterPoints(ear)), 2);
+				else
+					splitEarCut(ear);
+				break;
+			}
+		}
+	}
+};
+
+}
+
+std::vector<int> tube::earCut(const glm::vec2* points, size_t numPoints) {
+	std::vector<int> triangles;
+	if (numPoints > 3) {
+		float longestEdge = 0.0f;
+		for (size_t k = 0; k + 1 < numPoints; k++)
+			longestEdge = fmaxf(longestEdge, glm::distance(points[k], points[k + 1]));
+		if (glm::distance(points[numPoints - 1], points[0]) <= longestEdge * 1e-4f)
+			numPoints--;
+	}
+	if (numPoints < 3)
+		return triangles;
+	triangles.reserve((numPoints - 2) * 3);
+	EarCutter(triangles).run(points, numPoints);
+	return triangles;
+}
+
+std::vector<int> tube::earCut(const glm::vec3* points, size_t numPoints) {
+	if (numPoints < 3)
+		return std::vector<int>();
+	// Newell's normal, its length is twice the area of the polygon
+	auto normal = glm::vec3(0.0f);
+	for (size_t k = 0, j = numPoints - 1; k < numPoints; j = k++) {
+		glm::vec3 a = points[j] - points[0];
+		glm::vec3 b = points[k] - points[0];
+		normal += glm::cross(a, b);
+	}
+	float len = glm::length(normal);
+	if (len == 0.0f)
+		return std::vector<int>();
+	normal /= len;
+
+	// Any two axes across the normal, turning counter-clockwise around it
+	glm::vec3 helper = fabsf(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::vec3 axisX = glm::normalize(glm::cross(helper, normal));
+	glm::vec3 axisY = glm::cross(normal, axisX);
+	auto projected = std::vector<glm::vec2>(numPoints);
+	for (size_t k = 0; k < numPoints; k++) {
+		glm::vec3 p = points[k] - points[0];
+		projected[k] = glm::vec2(glm::dot(p, axisX), glm::dot(p, axisY));
+	}
+	return earCut(projected.data(), numPoints);
+}
+
+CapTriangulation::CapTriangulation(std::vector<glm::vec3> verts): mVerts(std::move(verts)) {
+}
+
+const std::vector<glm::vec3>& CapTriangulation::verts() const {
+	return this->mVerts;
+}
+
+const std::vector<int>& CapTriangulation::indices() {
+	std::call_once(this->mOnce, [this]() {
+		this->mIndices = earCut(this->mVerts.data(), this->mVerts.size());
+	});
+	return this->mIndices;
+}
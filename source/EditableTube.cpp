@@ -0,0 +1,456 @@
+#include "EditableTube.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+using namespace tube;
+
+// Two triangles for every edge between a ring and the next one,
+// in the same order as Tube::sweep
+static void writeRingQuads(int* indices, size_t ring, size_t next, int shapeNumVerts) {
+	int firstPart = (int)ring * shapeNumVerts;
+	int secondPart = (int)next * shapeNumVerts;
+	for (int edge = 0; edge < shapeNumVerts - 1; edge++) {
+		int a1 = firstPart + edge;
+		int a2 = firstPart + edge + 1;
+		int b1 = secondPart + edge;
+		int b2 = secondPart + edge + 1;
+		indices[0] = b1;
+		indices[1] = a1;
+		indices[2] = a2;
+		indices[3] = a2;
+		indices[4] = b2;
+		indices[5] = b1;
+		indices += 6;
+	}
+}
+
+EditableTube::EditableTube(Path path, Shape shape, Tessellation tessellation, VertexLayout layout):
+	mPath(path),
+	mShape(Tube::splitCreases(shape)),
+	mShapeSoA(mShape.verts),
+	mProfileNormals(Tube::profileNormals(mShape)),
+	mTessellation(tessellation)
+{
+	assert(this->mPath.points.size() > 0);
+	this->mTube.mLayout = layout;
+	rebuild();
+}
+
+const Path& EditableTube::path() const {
+	return this->mPath;
+}
+
+const Tube& EditableTube::tube() const {
+	return this->mTube;
+}
+
+size_t EditableTube::numSegments() const {
+	size_t n = this->mPath.points.size();
+	if (n < 2)
+		return 0;
+	return this->mPath.closed ? n : n - 1;
+}
+
+size_t EditableTube::firstRingOfSegment(size_t segment) const {
+	return this->mBlockStarts[segment];
+}
+
+size_t EditableTube::segmentOfRing(size_t ring) const {
+	if (this->numSegments() == 0)
+		return 0;
+	auto it = std::upper_bound(this->mBlockStarts.begin(), this->mBlockStarts.end(), ring);
+	size_t segment = (size_t)(it - this->mBlockStarts.begin()) - 1;
+	return std::min(segment, this->numSegments() - 1);
+}
+
+void EditableTube::setPoint(size_t index, Point point) {
+	assert(index < this->mPath.points.size());
+	this->mPath.points[index] = point;
+	this->mPath.invalidate();
+
+	if (!this->mIsDirty) {
+		this->mDirtyFirst = index;
+		this->mDirtyLast = index;
+	}
+	this->mDirtyFirst = std::min(this->mDirtyFirst, index);
+	this->mDirtyLast = std::max(this->mDirtyLast, index);
+	this->mIsDirty = true;
+}
+
+void EditableTube::update() {
+	if (!this->mIsDirty)
+		return;
+	this->mIsDirty = false;
+
+	size_t numSegments = this->numSegments();
+	if (numSegments == 0) {
+		rebuild();
+		return;
+	}
+
+	// A point changes the curves on both sides of it
+	size_t firstSegment = this->mDirtyFirst > 0 ? this->mDirtyFirst - 1 : 0;
+	size_t lastSegment = std::min(this->mDirtyLast, numSegments - 1);
+	updateSegments(firstSegment, lastSegment);
+}
+
+void EditableTube::tessellateSegment(size_t segment, std::vector<Point>& out) const {
+	size_t n = this->mPath.points.size();
+	auto poly = Point::toPoly(this->mPath.points[segment], this->mPath.points[(segment + 1) % n],
+		this->mTessellation);
+	bool isLast = segment + 1 == this->numSegments();
+	out.insert(out.end(), poly.begin(), isLast ? poly.end() : poly.end() - 1);
+}
+
+bool EditableTube::previousRing(size_t ring, size_t& out) const {
+	size_t segment = segmentOfRing(ring);
+	if (ring > this->mBlockStarts[segment])
+		out = ring - 1;
+	else if (segment > 0)
+		out = this->mBlockStarts[segment - 1] + this->mRingCounts[segment - 1] - 1;
+	else
+		return false;
+	return true;
+}
+
+bool EditableTube::nextRing(size_t ring, size_t& out) const {
+	size_t segment = segmentOfRing(ring);
+	if (ring + 1 < this->mBlockStarts[segment] + this->mRingCounts[segment])
+		out = ring + 1;
+	else if (segment + 1 < this->numSegments())
+		out = this->mBlockStarts[segment + 1];
+	else
+		return false;
+	return true;
+}
+
+void EditableTube::writeSlack(size_t segment) {
+	Tube& tube = this->mTube;
+	size_t shapeNumVerts = this->mShape.verts.size();
+	size_t last = this->mBlockStarts[segment] + this->mRingCounts[segment] - 1;
+	size_t from = last * shapeNumVerts;
+	for (size_t ring = last + 1; ring < this->mBlockStarts[segment + 1]; ring++) {
+		this->mRings[ring] = this->mRings[last];
+		this->mFrames[ring] = this->mFrames[last];
+		this->mStepLengths[ring] = 0.0f;
+		size_t to = ring * shapeNumVerts;
+		std::copy(tube.vertices.begin() + from, tube.vertices.begin() + from + shapeNumVerts, tube.vertices.begin() + to);
+		std::copy(tube.normals.begin() + from, tube.normals.begin() + from + shapeNumVerts, tube.normals.begin() + to);
+		std::copy(tube.texCoords.begin() + from, tube.texCoords.begin() + from + shapeNumVerts, tube.texCoords.begin() + to);
+	}
+}
+
+void EditableTube::packRings(size_t firstRing, size_t endRing) {
+	Tube& tube = this->mTube;
+	if (tube.mLayout.isEmpty())
+		return;
+	size_t shapeNumVerts = this->mShape.verts.size();
+	size_t numVertices = tube.vertices.size();
+	for (size_t v = firstRing * shapeNumVerts; v < endRing * shapeNumVerts; v++) {
+		tube.mLayout.writePosition(tube.mVertexData.data(), numVertices, v, tube.vertices[v]);
+		tube.mLayout.writeTexCoord(tube.mVertexData.data(), numVertices, v, tube.texCoords[v]);
+		tube.mLayout.writeNormal(tube.mVertexData.data(), numVertices, v, tube.normals[v]);
+	}
+}
+
+void EditableTube::rebuild() {
+	this->mIsDirty = false;
+	size_t numSegments = this->numSegments();
+	size_t numBlocks = std::max(numSegments, (size_t)1);
+
+	// Tessellate segment by segment to know the rings of every segment
+
+	auto rings = std::vector<Point>();
+	auto counts = std::vector<size_t>(numBlocks);
+	if (numSegments == 0)
+		rings = this->mPath.points;
+	for (size_t segment = 0; segment < numSegments; segment++) {
+		size_t before = rings.size();
+		tessellateSegment(segment, rings);
+		counts[segment] = rings.size() - before;
+	}
+	if (numSegments == 0)
+		counts[0] = rings.size();
+	auto frames = std::vector<Frame>(rings.size());
+	rotationMinimizingFrames(rings.data(), rings.size(), this->mPath.closed, frames.data());
+
+	// Adaptive tessellation changes the number of rings of edited curves,
+	// so their blocks get some slack. Blocks keep the size they had, and
+	// curves that outgrew theirs get twice what they need
+
+	auto oldStarts = std::move(this->mBlockStarts);
+	bool isSameSegments = oldStarts.size() == numBlocks + 1;
+	this->mBlockStarts.assign(1, 0);
+	for (size_t segment = 0; segment < numBlocks; segment++) {
+		size_t count = counts[segment];
+		size_t capacity = count + (this->mTessellation.isAdaptive() ? count / 4 : 0);
+		if (isSameSegments) {
+			size_t oldCapacity = oldStarts[segment + 1] - oldStarts[segment];
+			capacity = std::max(capacity, count > oldCapacity ? 2 * count : oldCapacity);
+		}
+		this->mBlockStarts.push_back(this->mBlockStarts.back() + capacity);
+	}
+	this->mRingCounts = counts;
+
+	// Sweep the rings, then move every segment into its block
+
+	size_t numRings = rings.size();
+	size_t shapeNumVerts = this->mShape.verts.size();
+	auto vertices = std::vector<glm::vec3>(numRings * shapeNumVerts);
+	auto normals = std::vector<glm::vec3>(numRings * shapeNumVerts);
+	auto texCoords = std::vector<glm::vec2>(numRings * shapeNumVerts);
+	auto indices = std::vector<int>(Tube::numSweepIndices(numRings, shapeNumVerts));
+	Tube::sweep(rings.data(), frames.data(), numRings, this->mPath.closed,
+		this->mShapeSoA, this->mProfileNormals,
+		vertices.data(), normals.data(), texCoords.data(), indices.data(), 0,
+		VertexLayout::none(), nullptr, 0);
+
+	size_t numSlots = this->mBlockStarts.back();
+	size_t numVertices = numSlots * shapeNumVerts;
+	Tube& tube = this->mTube;
+	tube.vertices.resize(numVertices);
+	tube.texCoords.resize(numVertices);
+	tube.normals.resize(numVertices);
+	tube.mVertexData.resize(tube.mLayout.size(numVertices));
+	tube.mShapeNumVerts = (int)shapeNumVerts;
+	tube.mCapTriangulation = Tube::capTriangulation(this->mShape, this->mShape.verts);
+	this->mRings.resize(numSlots);
+	this->mFrames.resize(numSlots);
+	this->mStepLengths.assign(numSlots, 0.0f);
+
+	size_t ring = 0;
+	for (size_t segment = 0; segment < numBlocks; segment++) {
+		size_t start = this->mBlockStarts[segment];
+		size_t count = counts[segment];
+		std::copy(rings.begin() + ring, rings.begin() + ring + count, this->mRings.begin() + start);
+		std::copy(frames.begin() + ring, frames.begin() + ring + count, this->mFrames.begin() + start);
+		size_t from = ring * shapeNumVerts;
+		size_t to = start * shapeNumVerts;
+		size_t size = count * shapeNumVerts;
+		std::copy(vertices.begin() + from, vertices.begin() + from + size, tube.vertices.begin() + to);
+		std::copy(normals.begin() + from, normals.begin() + from + size, tube.normals.begin() + to);
+		std::copy(texCoords.begin() + from, texCoords.begin() + from + size, tube.texCoords.begin() + to);
+		writeSlack(segment);
+		ring += count;
+	}
+
+	// The sweep already made v follow the length of the path
+	for (size_t segment = 0; segment < numBlocks; segment++) {
+		size_t start = this->mBlockStarts[segment];
+		for (size_t slot = start; slot < start + counts[segment]; slot++) {
+			size_t previous;
+			if (previousRing(slot, previous))
+				this->mStepLengths[slot] = glm::distance(this->mRings[previous].pos, this->mRings[slot].pos);
+		}
+	}
+
+	writeIndices();
+	packRings(0, numSlots);
+}
+
+void EditableTube::writeIndices() {
+	// Quads between every ring and the next one, skipping the slack
+	Tube& tube = this->mTube;
+	size_t shapeNumVerts = this->mShape.verts.size();
+	size_t numRings = 0;
+	for (size_t count : this->mRingCounts)
+		numRings += count;
+	tube.indices.resize(Tube::numSweepIndices(numRings, shapeNumVerts));
+	size_t rowSize = Tube::numSweepIndices(2, shapeNumVerts);
+	int* indices = tube.indices.data();
+	for (size_t segment = 0; segment < this->mRingCounts.size(); segment++) {
+		size_t start = this->mBlockStarts[segment];
+		for (size_t ring = start; ring < start + this->mRingCounts[segment]; ring++) {
+			size_t next;
+			if (!nextRing(ring, next))
+				break;
+			writeRingQuads(indices, ring, next, (int)shapeNumVerts);
+			indices += rowSize;
+		}
+	}
+}
+
+void EditableTube::writeTexCoords() {
+	// v is the length along the path up to the ring over the length of
+	// the path, like in Tube::sweep. u does not change
+	Tube& tube = this->mTube;
+	size_t shapeNumVerts = this->mShape.verts.size();
+	size_t numVertices = tube.vertices.size();
+	size_t numBlocks = this->mRingCounts.size();
+	float pathLength = 0.0f;
+	for (size_t segment = 0; segment < numBlocks; segment++) {
+		size_t start = this->mBlockStarts[segment];
+		for (size_t ring = start; ring < start + this->mRingCounts[segment]; ring++)
+			pathLength += this->mStepLengths[ring];
+	}
+	if (this->mPath.closed && numBlocks > 0) {
+		size_t last = this->mBlockStarts[numBlocks - 1] + this->mRingCounts[numBlocks - 1] - 1;
+		pathLength += glm::distance(this->mRings[last].pos, this->mRings[0].pos);
+	}
+
+	// Packed v is converted once per ring and copied to its other vertices
+	const VertexLayout& layout = tube.mLayout;
+	bool isPacked = layout.format(VertexAttribute::TEX_COORD) != AttributeFormat::NONE;
+	unsigned char* packed = tube.mVertexData.data() + layout.offset(VertexAttribute::TEX_COORD, numVertices);
+	size_t stride = layout.stride(VertexAttribute::TEX_COORD);
+	size_t vSize = layout.attributeSize(VertexAttribute::TEX_COORD) / 2;
+	float curLength = 0.0f;
+	for (size_t segment = 0; segment < numBlocks; segment++) {
+		size_t start = this->mBlockStarts[segment];
+		for (size_t ring = start; ring < this->mBlockStarts[segment + 1]; ring++) {
+			// Slack takes the v of the last ring it copies
+			if (ring < start + this->mRingCounts[segment])
+				curLength += this->mStepLengths[ring];
+			float v = curLength / pathLength;
+			glm::vec2* texCoords = tube.texCoords.data() + ring * shapeNumVerts;
+			for (size_t p = 0; p < shapeNumVerts; p++)
+				texCoords[p].y = v;
+			if (isPacked) {
+				layout.writeTexCoord(tube.mVertexData.data(), numVertices, ring * shapeNumVerts, texCoords[0]);
+				unsigned char* first = packed + ring * shapeNumVerts * stride + vSize;
+				for (size_t p = 1; p < shapeNumVerts; p++)
+					memcpy(first + p * stride, first, vSize);
+			}
+		}
+	}
+}
+
+void EditableTube::updateSegments(size_t firstSegment, size_t lastSegment) {
+	size_t numSegments = this->numSegments();
+	bool closed = this->mPath.closed;
+
+	auto rings = std::vector<Point>();
+	auto counts = std::vector<size_t>();
+	for (size_t segment = firstSegment; segment <= lastSegment; segment++) {
+		size_t before = rings.size();
+		tessellateSegment(segment, rings);
+		counts.push_back(rings.size() - before);
+		if (counts.back() > this->mBlockStarts[segment + 1] - this->mBlockStarts[segment]) {
+			rebuild();
+			return;
+		}
+	}
+
+	// The changed rings with the two rings on both sides. The nearer ones
+	// get new frames and normals too, as their neighbours move. Frames
+	// are carried from the farther one before and twisted to meet the
+	// farther one after
+
+	size_t first = this->mBlockStarts[firstSegment];
+	size_t before1 = 0, before2 = 0, after1 = 0, after2 = 0;
+	bool hasBefore1 = previousRing(first, before1);
+	bool hasBefore2 = hasBefore1 && previousRing(before1, before2);
+	bool hasAfter1 = lastSegment + 1 < numSegments;
+	if (hasAfter1)
+		after1 = this->mBlockStarts[lastSegment + 1];
+	bool hasAfter2 = hasAfter1 && nextRing(after1, after2);
+
+	// Frames of closed pathes are tied to the ring where the path closes
+	if (closed && (!hasBefore2 || !hasAfter2)) {
+		rebuild();
+		return;
+	}
+
+	auto window = std::vector<Point>();
+	auto slots = std::vector<size_t>();
+	auto push = [&](const Point& point, size_t slot) {
+		window.push_back(point);
+		slots.push_back(slot);
+	};
+	if (hasBefore2)
+		push(this->mRings[before2], before2);
+	if (hasBefore1)
+		push(this->mRings[before1], before1);
+	size_t ring = 0;
+	for (size_t segment = firstSegment; segment <= lastSegment; segment++) {
+		for (size_t k = 0; k < counts[segment - firstSegment]; k++)
+			push(rings[ring++], this->mBlockStarts[segment] + k);
+	}
+	size_t changedLast = window.size() - 1;
+	if (hasAfter1)
+		push(this->mRings[after1], after1);
+	if (hasAfter2)
+		push(this->mRings[after2], after2);
+
+	Tube& tube = this->mTube;
+	size_t shapeNumVerts = this->mShape.verts.size();
+
+	// Carry the frame through the changed rings
+
+	size_t frameFirst = hasBefore2 ? 1 : 0;
+	size_t frameLast = hasAfter1 ? changedLast + 1 : changedLast;
+	auto frames = std::vector<Frame>(window.size());
+	if (hasBefore2)
+		frames[0] = this->mFrames[before2];
+	if (hasAfter2)
+		frames[frameLast + 1] = this->mFrames[after2];
+	glm::vec3 previous = hasBefore2 ? frames[0].tangent : glm::vec3(0.0f);
+	for (size_t j = frameFirst; j <= frameLast; j++) {
+		glm::vec3 tangent = pointTangent(window.data(), window.size(), false, j, previous);
+		frames[j] = j == 0
+			? initialFrame(tangent)
+			: transportFrame(frames[j - 1], window[j - 1].pos, window[j].pos, tangent);
+		previous = tangent;
+	}
+
+	if (hasAfter2) {
+		// Twist the changed frames to meet the first unchanged one
+		const Frame& next = frames[frameLast + 1];
+		Frame arrived = transportFrame(frames[frameLast],
+			window[frameLast].pos, window[frameLast + 1].pos, next.tangent);
+		float angle = twistBetween(arrived, next);
+
+		if (frameFirst == 0) {
+			// Nothing before the start to meet, turn the start with the rest
+			for (size_t j = frameFirst; j <= frameLast; j++)
+				frames[j] = twistFrame(frames[j], angle);
+		}
+		else {
+			// Spread the twist proportionally to the length
+			float total = 0.0f;
+			for (size_t j = frameFirst; j <= frameLast + 1; j++)
+				total += glm::distance(window[j - 1].pos, window[j].pos);
+			float len = 0.0f;
+			for (size_t j = frameFirst; j <= frameLast && total > 0.0f; j++) {
+				len += glm::distance(window[j - 1].pos, window[j].pos);
+				frames[j] = twistFrame(frames[j], angle * len / total);
+			}
+		}
+	}
+
+	// Rewrite the rings
+
+	auto ringKernel = bestRingKernel();
+	for (size_t j = frameFirst; j <= frameLast; j++) {
+		size_t slot = slots[j];
+		this->mRings[slot] = window[j];
+		this->mFrames[slot] = frames[j];
+		RingTransform transform = Tube::ringTransform(window[j], frames[j]);
+		if (window[j].isMiter)
+			Tube::miterRing(window.data(), window.size(), false, j, transform);
+		transformRing(ringKernel, transform, this->mShapeSoA, tube.vertices.data() + slot * shapeNumVerts);
+		float slope = Tube::radiusSlope(window.data(), window.size(), false, j);
+		Tube::ringNormals(window[j], frames[j], slope,
+			this->mProfileNormals, tube.normals.data() + slot * shapeNumVerts);
+		this->mStepLengths[slot] = j > 0 ? glm::distance(window[j - 1].pos, window[j].pos) : 0.0f;
+	}
+
+	// Copy the last rings over the slack of every block that changed,
+	// and pack them. Quads only change with the number of rings
+
+	bool isSameRings = true;
+	for (size_t segment = firstSegment; segment <= lastSegment; segment++) {
+		isSameRings = isSameRings && this->mRingCounts[segment] == counts[segment - firstSegment];
+		this->mRingCounts[segment] = counts[segment - firstSegment];
+	}
+	size_t blockFirst = hasBefore1 ? segmentOfRing(before1) : firstSegment;
+	size_t blockLast = hasAfter1 ? lastSegment + 1 : lastSegment;
+	for (size_t segment = blockFirst; segment <= blockLast; segment++)
+		writeSlack(segment);
+	if (!isSameRings)
+		writeIndices();
+	writeTexCoords();
+	packRings(slots[frameFirst], this->mBlockStarts[blockLast + 1]);
+}
@@ -0,0 +1,166 @@
+#include "Frames.h"
+#include "Path.h"
+
+#include <cmath>
+
+using namespace tube;
+
+namespace {
+
+glm::vec3 directionOrZero(glm::vec3 v) {
+	float len = glm::length(v);
+	return len > 0.0f ? v / len : glm::vec3(0.0f);
+}
+
+bool isZero(glm::vec3 v) {
+	return v.x == 0.0f && v.y == 0.0f && v.z == 0.0f;
+}
+
+}
+
+Frame tube::initialFrame(glm::vec3 tangent) {
+	// Same basis as glm::quatLookAt(tangent, up)
+	glm::vec3 up = glm::vec3(0, 0, 1);
+	glm::vec3 right = glm::cross(up, -tangent);
+	if (glm::length(right) < 1e-4f)
+		right = glm::cross(glm::vec3(0, 1, 0), -tangent);
+
+	Frame frame;
+	frame.tangent = tangent;
+	frame.normal = glm::normalize(right);
+	frame.binormal = glm::cross(frame.normal, tangent);
+	return frame;
+}
+
+Frame tube::transportFrame(const Frame& frame, glm::vec3 from, glm::vec3 to, glm::vec3 nextTangent) {
+	// Reflect the frame in the plane between the points, then in the plane
+	// between the reflected and the next tangent
+	glm::vec3 v1 = to - from;
+	float c1 = glm::dot(v1, v1);
+
+	glm::vec3 normal = frame.normal;
+	glm::vec3 tangent = frame.tangent;
+	if (c1 > 0.0f) {
+		normal -= (2.0f / c1) * glm::dot(v1, normal) * v1;
+		tangent -= (2.0f / c1) * glm::dot(v1, tangent) * v1;
+	}
+
+	glm::vec3 v2 = nextTangent - tangent;
+	float c2 = glm::dot(v2, v2);
+	if (c2 > 0.0f)
+		normal -= (2.0f / c2) * glm::dot(v2, normal) * v2;
+
+	Frame next;
+	next.tangent = nextTangent;
+	next.normal = glm::normalize(normal - glm::dot(normal, nextTangent) * nextTangent);
+	next.binormal = glm::cross(next.normal, nextTangent);
+	return next;
+}
+
+Frame tube::twistFrame(const Frame& frame, float angle) {
+	float c = cosf(angle);
+	float s = sinf(angle);
+	Frame twisted;
+	twisted.tangent = frame.tangent;
+	twisted.normal = frame.normal * c - frame.binormal * s;
+	twisted.binormal = frame.binormal * c + frame.normal * s;
+	return twisted;
+}
+
+float tube::twistBetween(const Frame& a, const Frame& b) {
+	return atan2f(glm::dot(glm::cross(a.normal, b.normal), b.tangent), glm::dot(a.normal, b.normal));
+}
+
+glm::vec3 tube::pointTangent(const std::vector<Point>& points, bool closed, size_t i, glm::vec3 previous) {
+	return pointTangent(points.data(), points.size(), closed, i, previous);
+}
+
+glm::vec3 tube::pointTangent(const Point* points, size_t n, bool closed, size_t i, glm::vec3 previous) {
+
+	// Closed polylines may repeat the first point at the end
+	bool repeatsStart = closed && points[0].pos == points[n - 1].pos;
+	size_t beforeStart = repeatsStart ? n - 2 : n - 1;
+	size_t afterEnd = repeatsStart ? 1 : 0;
+
+	bool isStart = i == 0;
+	bool isEnd = i == n - 1;
+
+	glm::vec3 pos = points[i].pos;
+	glm::vec3 backPos = !isStart ? points[i - 1].pos : (closed ? points[beforeStart].pos : pos);
+	glm::vec3 nextPos = !isEnd ? points[i + 1].pos : (closed ? points[afterEnd].pos : pos);
+
+	glm::vec3 forwardDir = directionOrZero(nextPos - pos);
+	glm::vec3 backwardDir = directionOrZero(pos - backPos);
+
+	glm::vec3 meanDir = directionOrZero(forwardDir + backwardDir);
+	if (isZero(meanDir))
+		meanDir = !isZero(forwardDir) ? forwardDir : backwardDir;
+	if (isZero(meanDir))
+		meanDir = isZero(previous) ? glm::vec3(0, 1, 0) : previous;
+	return meanDir;
+}
+
+std::vector<glm::vec3> tube::pointTangents(const std::vector<Point>& points, bool closed) {
+	size_t n = points.size();
+	auto tangents = std::vector<glm::vec3>(n);
+	if (n < 2)
+		return tangents;
+
+	glm::vec3 previous = directionOrZero(points[1].pos - points[0].pos);
+	for (size_t i = 0; i < n; i++) {
+		tangents[i] = pointTangent(points, closed, i, previous);
+		previous = tangents[i];
+	}
+	return tangents;
+}
+
+std::vector<Frame> tube::rotationMinimizingFrames(const std::vector<Point>& points, bool closed) {
+	auto frames = std::vector<Frame>(points.size());
+	rotationMinimizingFrames(points.data(), points.size(), closed, frames.data());
+	return frames;
+}
+
+void tube::rotationMinimizingFrames(const Point* points, size_t n, bool closed, Frame* frames) {
+	if (n == 0)
+		return;
+	if (n == 1) {
+		frames[0] = initialFrame(glm::vec3(0.0f));
+		return;
+	}
+
+	// Tangents are computed on the way, only the first one is kept for
+	// closing the path
+	glm::vec3 firstTangent = pointTangent(points, n, closed, 0, directionOrZero(points[1].pos - points[0].pos));
+	glm::vec3 previous = firstTangent;
+	frames[0] = initialFrame(firstTangent);
+	for (size_t i = 1; i < n; i++) {
+		glm::vec3 tangent = pointTangent(points, n, closed, i, previous);
+		frames[i] = transportFrame(frames[i - 1], points[i - 1].pos, points[i].pos, tangent);
+		previous = tangent;
+	}
+
+	if (!closed || n < 3)
+		return;
+
+	// Frame that arrives back at the start after going around the path
+	bool repeatsStart = points[0].pos == points[n - 1].pos;
+	Frame arrived = repeatsStart
+		? frames[n - 1]
+		: transportFrame(frames[n - 1], points[n - 1].pos, points[0].pos, firstTangent);
+	float angle = twistBetween(arrived, frames[0]);
+
+	// Spread the twist proportionally to the length along the path
+	float total = 0.0f;
+	for (size_t i = 1; i < n; i++)
+		total += glm::distance(points[i - 1].pos, points[i].pos);
+	if (!repeatsStart)
+		total += glm::distance(points[n - 1].pos, points[0].pos);
+	if (total <= 0.0f)
+		return;
+
+	float length = 0.0f;
+	for (size_t i = 1; i < n; i++) {
+		length += glm::distance(points[i - 1].pos, points[i].pos);
+		frames[i] = twistFrame(frames[i], angle * length / total);
+	}
+}
@@ -0,0 +1,205 @@
+#include "InstancedTube.h"
+#include "Parallel.h"
+#include "Stats.h"
+
+#include <cmath>
+
+using namespace tube;
+
+static_assert(sizeof(RingInstance) == 48, "Rings are three vec4 of a GPU buffer");
+
+namespace {
+
+// Rotation taking x, y and z to the normal, binormal and -tangent of a
+// frame, like the shape is placed on it
+glm::vec4 frameRotation(const Frame& frame) {
+	const glm::vec3& n = frame.normal;
+	const glm::vec3& b = frame.binormal;
+	glm::vec3 t = -frame.tangent;
+	float trace = n.x + b.y + t.z;
+	glm::vec4 q;
+	if (trace > 0.0f) {
+		float s = sqrtf(trace + 1.0f) * 2.0f;
+		q = glm::vec4((b.z - t.y) / s, (t.x - n.z) / s, (n.y - b.x) / s, 0.25f * s);
+	}
+	else if (n.x > b.y && n.x > t.z) {
+		float s = sqrtf(1.0f + n.x - b.y - t.z) * 2.0f;
+		q = glm::vec4(0.25f * s, (b.x + n.y) / s, (t.x + n.z) / s, (b.z - t.y) / s);
+	}
+	else if (b.y > t.z) {
+		float s = sqrtf(1.0f + b.y - n.x - t.z) * 2.0f;
+		q = glm::vec4((b.x + n.y) / s, 0.25f * s, (t.y + b.z) / s, (t.x - n.z) / s);
+	}
+	else {
+		float s = sqrtf(1.0f + t.z - n.x - b.y) * 2.0f;
+		q = glm::vec4((t.x + n.z) / s, (t.y + b.z) / s, 0.25f * s, (n.y - b.x) / s);
+	}
+	float len = sqrtf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+	return glm::vec4(q.x / len, q.y / len, q.z / len, q.w / len);
+}
+
+glm::vec3 rotate(glm::vec4 q, glm::vec3 v) {
+	glm::vec3 axis = glm::vec3(q.x, q.y, q.z);
+	glm::vec3 t = glm::cross(axis, v) * 2.0f;
+	return v + t * q.w + glm::cross(axis, t);
+}
+
+}
+
+glm::vec2 InstancedTube::miterStretch(const Point* points, size_t numPoints, bool closed, size_t i,
+	const Frame& frame)
+{
+	RingTransform transform;
+	transform.axisX = frame.normal;
+	transform.axisY = frame.binormal;
+	transform.axisZ = glm::vec3(0.0f);
+	transform.origin = glm::vec3(0.0f);
+	Tube::miterRing(points, numPoints, closed, i, transform);
+	// In frame coordinates the stretch is 1 + m m^T for m = sqrt(stretch - 1)
+	// times the direction across the turn
+	float xx = fmaxf(glm::dot(transform.axisX, frame.normal) - 1.0f, 0.0f);
+	float yy = fmaxf(glm::dot(transform.axisY, frame.binormal) - 1.0f, 0.0f);
+	float xy = glm::dot(transform.axisY, frame.normal);
+	return glm::vec2(sqrtf(xx), xy < 0.0f ? -sqrtf(yy) : sqrtf(yy));
+}
+
+InstancedTube::InstancedTube(const std::vector<Path>& pathes, const Shape& shape, Tessellation tessellation,
+	unsigned int numThreads, TubeNormals normals, Arena* arena)
+{
+	auto source = [&pathes](size_t i, const std::function<void(const Path&)>& sink) {
+		sink(pathes[i]);
+	};
+	build(pathes.size(), source, shape, tessellation, numThreads, normals, arena);
+}
+
+InstancedTube::InstancedTube(size_t numSources, const PathSource& source, const Shape& shape,
+	Tessellation tessellation, unsigned int numThreads, TubeNormals normals, Arena* arena)
+{
+	build(numSources, source, shape, tessellation, numThreads, normals, arena);
+}
+
+void InstancedTube::build(size_t numSources, const PathSource& source, const Shape& shape,
+	Tessellation tessellation, unsigned int numThreads, TubeNormals normals, Arena* arena)
+{
+	bool hasNormals = normals == TubeNormals::ANALYTIC;
+	Shape split = hasNormals ? Tube::splitCreases(shape) : shape;
+	this->profile = split.verts;
+	if (hasNormals) {
+		auto profileSoA = Tube::profileNormals(split);
+		this->profileNormals.resize(profileSoA.size());
+		for (size_t p = 0; p < profileSoA.size(); p++)
+			this->profileNormals[p] = glm::vec2(profileSoA.x[p], profileSoA.y[p]);
+	}
+
+	// Quads between two rings, in the order of a swept Tube
+	int numVerts = (int)this->profile.size();
+	this->pairIndices.reserve(Tube::numSweepIndices(2, (size_t)numVerts));
+	for (int edge = 0; edge + 1 < numVerts; edge++) {
+		int a1 = edge;
+		int a2 = edge + 1;
+		int b1 = numVerts + edge;
+		int b2 = numVerts + edge + 1;
+		this->pairIndices.insert(this->pairIndices.end(), { b1, a1, a2, a2, b2, b1 });
+	}
+	if (numSources == 0)
+		return;
+
+	Arena localArena;
+	std::pmr::memory_resource* memory = arena != nullptr ? arena : &localArena;
+	auto sweepPolylines = Tube::toSweepPolylines(numSources, source, tessellation, numThreads, memory);
+	const auto& polylines = sweepPolylines.polylines;
+	size_t numPathes = polylines.size();
+
+	auto ringStarts = std::pmr::vector<size_t>(numPathes + 1, 0, memory);
+	auto pairStarts = std::pmr::vector<size_t>(numPathes + 1, 0, memory);
+	for (size_t i = 0; i < numPathes; i++) {
+		size_t numRings = polylines[i]->size();
+		ringStarts[i + 1] = ringStarts[i] + numRings;
+		pairStarts[i + 1] = pairStarts[i] + (numRings > 1 && numVerts > 1 ? numRings - 1 : 0);
+	}
+	this->rings.resize(ringStarts.back());
+	this->ringPairs.resize(pairStarts.back());
+
+	parallelFor(numPathes, numThreads, [&](size_t i) {
+		const Point* points = polylines[i]->data();
+		size_t numPoints = polylines[i]->size();
+		bool closed = sweepPolylines.closed[i];
+		auto frames = std::pmr::vector<Frame>(numPoints, memory);
+		{
+			TUBE_STATS_STAGE(BuildStage::FRAMES);
+			rotationMinimizingFrames(points, numPoints, closed, frames.data());
+		}
+
+		TUBE_STATS_STAGE(BuildStage::SWEEP);
+		TUBE_STATS_COUNT(numRings, numPoints);
+		TUBE_STATS_COUNT(numTriangles, Tube::numSweepIndices(numPoints, (size_t)numVerts) / 3);
+
+		// Texture coordinates along the path like Tube::sweep()
+		float pathLength = 0.0f;
+		for (size_t k = 1; k < numPoints; k++)
+			pathLength += glm::distance(points[k - 1].pos, points[k].pos);
+		if (closed && numPoints > 1)
+			pathLength += glm::distance(points[numPoints - 1].pos, points[0].pos);
+		float curLength = 0.0f;
+
+		RingInstance* out = this->rings.data() + ringStarts[i];
+		for (size_t k = 0; k < numPoints; k++) {
+			const Point& point = points[k];
+			RingInstance& ring = out[k];
+			ring.rotation = frameRotation(frames[k]);
+			ring.position = point.pos;
+			ring.radius = point.radius;
+			ring.tilt = point.tilt;
+			ring.v = curLength / pathLength;
+			if (point.isMiter)
+				ring.miter = miterStretch(points, numPoints, closed, k, frames[k]);
+			if (k + 1 < numPoints)
+				curLength += glm::distance(point.pos, points[k + 1].pos);
+		}
+		for (size_t k = pairStarts[i]; k < pairStarts[i + 1]; k++)
+			this->ringPairs[k] = (unsigned int)(ringStarts[i] + k - pairStarts[i]);
+	});
+}
+
+Tube InstancedTube::toTube() const {
+	Tube tube;
+	size_t numVerts = this->profile.size();
+	size_t numVertices = this->rings.size() * numVerts;
+	bool hasNormals = !this->profileNormals.empty();
+	tube.mShapeNumVerts = (int)numVerts;
+	tube.vertices.resize(numVertices);
+	tube.texCoords.resize(numVertices);
+	tube.normals.resize(hasNormals ? numVertices : 0);
+
+	float profileEnd = (float)numVerts - 1.0f;
+	for (size_t r = 0; r < this->rings.size(); r++) {
+		const RingInstance& ring = this->rings[r];
+		glm::vec3 normal = rotate(ring.rotation, glm::vec3(1.0f, 0.0f, 0.0f));
+		glm::vec3 binormal = rotate(ring.rotation, glm::vec3(0.0f, 1.0f, 0.0f));
+		glm::vec3 back = rotate(ring.rotation, glm::vec3(0.0f, 0.0f, 1.0f));
+		float tiltCos = cosf(ring.tilt);
+		float tiltSin = sinf(ring.tilt);
+		for (size_t p = 0; p < numVerts; p++) {
+			glm::vec3 vert = this->profile[p];
+			glm::vec2 q = glm::vec2(vert.x * tiltCos - vert.y * tiltSin, vert.x * tiltSin + vert.y * tiltCos) * ring.radius;
+			q += ring.miter * glm::dot(q, ring.miter);
+			size_t v = r * numVerts + p;
+			tube.vertices[v] = ring.position + normal * q.x + binormal * q.y + back * (ring.radius * vert.z);
+			tube.texCoords[v] = glm::vec2((float)p / profileEnd, ring.v);
+			if (hasNormals) {
+				glm::vec2 n = this->profileNormals[p];
+				n = glm::vec2(n.x * tiltCos - n.y * tiltSin, n.x * tiltSin + n.y * tiltCos);
+				tube.normals[v] = normal * n.x + binormal * n.y;
+			}
+		}
+	}
+
+	tube.indices.resize(this->ringPairs.size() * this->pairIndices.size());
+	int* indices = tube.indices.data();
+	for (unsigned int first : this->ringPairs) {
+		int base = (int)(first * numVerts);
+		for (int index : this->pairIndices)
+			*indices++ = base + index;
+	}
+	return tube;
+}
@@ -0,0 +1,333 @@
+#include "LodChain.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+using namespace tube;
+
+float LodLevel::screenSpaceError(float distance, float viewportHeight, float fovY) const {
+	if (distance <= 0.0f)
+		return INFINITY;
+	return this->geometricError * viewportHeight / (2.0f * distance * tanf(fovY * 0.5f));
+}
+
+namespace {
+
+// What of a polyline point moves the surface. Ranking streams over the
+// samples many times, so they are kept small
+struct Sample {
+	glm::vec3 pos;
+	float radius;
+	float tilt;
+};
+
+// Segment between two kept samples of a line, to measure how far the
+// samples left out in between are from it. Radius and tilt move the
+// surface by up to the size of the profile
+struct Chord {
+	glm::vec3 start;
+	glm::vec3 direction;
+	float invLengthSq;
+	float startRadius;
+	float radiusChange;
+	float startTilt;
+	float tiltChange;
+	float profileExtent;
+
+	Chord(const Sample& a, const Sample& b, float profileExtent):
+		start(a.pos),
+		direction(b.pos - a.pos),
+		startRadius(a.radius),
+		radiusChange(b.radius - a.radius),
+		startTilt(a.tilt),
+		tiltChange(b.tilt - a.tilt),
+		profileExtent(profileExtent)
+	{
+		float lengthSq = glm::dot(this->direction, this->direction);
+		this->invLengthSq = lengthSq > 0.0f ? 1.0f / lengthSq : 0.0f;
+	}
+
+	// The deviation of p when it is more than bound, bound otherwise.
+	// Skips the square root for samples that are closer
+	float deviationAbove(const Sample& p, float bound) const {
+		float t = glm::clamp(glm::dot(p.pos - this->start, this->direction) * this->invLengthSq, 0.0f, 1.0f);
+		float radius = this->startRadius + this->radiusChange * t;
+		float tilt = this->startTilt + this->tiltChange * t;
+		float surface = (fabsf(p.radius - radius) + fabsf(p.tilt - tilt) * fabsf(p.radius)) * this->profileExtent;
+		glm::vec3 offset = p.pos - (this->start + this->direction * t);
+		float distanceSq = glm::dot(offset, offset);
+		float needed = bound - surface;
+		if (needed > 0.0f && distanceSq <= needed * needed)
+			return bound;
+		return sqrtf(distanceSq) + surface;
+	}
+};
+
+// Span of a line between two points, split at the point that deviates most
+struct Interval {
+	size_t a;
+	size_t b;
+	float limit;
+};
+
+}
+
+// Split the spans of the queue and the spans made by every split, breadth
+// first. Spans hold positions in a line of points given by line(position).
+// Each split point gets its importance and the next split number
+template<typename Line>
+static void splitSpans(const Sample* points, const Line& line, float profileExtent,
+	std::vector<Interval>& queue, std::vector<float>& importance,
+	std::vector<size_t>& pointOfSplit, size_t& numSplits)
+{
+	for (size_t head = 0; head < queue.size(); head++) {
+		Interval interval = queue[head];
+		Chord chord(points[line(interval.a)], points[line(interval.b)], profileExtent);
+		size_t best = interval.a + 1;
+		float bestDeviation = -1.0f;
+		for (size_t i = interval.a + 1; i < interval.b; i++) {
+			float d = chord.deviationAbove(points[line(i)], bestDeviation);
+			if (d > bestDeviation) {
+				best = i;
+				bestDeviation = d;
+			}
+		}
+		float splitImportance = std::min(bestDeviation, interval.limit);
+		importance[line(best)] = splitImportance;
+		pointOfSplit[numSplits++] = line(best);
+		if (best - interval.a > 1)
+			queue.push_back({ interval.a, best, splitImportance });
+		if (interval.b - best > 1)
+			queue.push_back({ best, interval.b, splitImportance });
+	}
+	queue.clear();
+}
+
+// Key of every point of a line that orders points from the most to the least
+// important for Douglas-Peucker simplification. A point is as important as the deviation
+// it removes when it splits its span, but never more than the point that
+// split the span before, so the k points with the lowest keys are the points
+// Douglas-Peucker keeps for some tolerance. The first and the last point
+// come first. Spans are split breadth first and ties order the earlier split
+// first, so points of equal importance are left out evenly along the line.
+// Splitting long lines takes many passes over them, so every blockSize-th
+// point is ranked first as a line of its own, then the blocks between them
+// are split below the importance of their ends
+static std::vector<uint64_t> importanceKeys(const Sample* points, size_t n, float profileExtent) {
+	const size_t blockSize = 64;
+
+	std::vector<float> importance(n, INFINITY);
+	std::vector<size_t> pointOfSplit(n, 0);
+	size_t numSplits = 0;
+	if (n == 0)
+		return {};
+	pointOfSplit[numSplits++] = 0;
+	if (n > 1)
+		pointOfSplit[numSplits++] = n - 1;
+
+	std::vector<size_t> ends;
+	for (size_t i = 0; i + 1 < n; i += blockSize)
+		ends.push_back(i);
+	ends.push_back(n - 1);
+
+	std::vector<Interval> queue;
+	if (ends.size() > 2)
+		queue.push_back({ 0, ends.size() - 1, INFINITY });
+	splitSpans(points, [&](size_t k) { return ends[k]; }, profileExtent, queue, importance, pointOfSplit, numSplits);
+
+	for (size_t k = 0; k + 1 < ends.size(); k++) {
+		if (ends[k + 1] - ends[k] > 1)
+			queue.push_back({ ends[k], ends[k + 1], std::min(importance[ends[k]], importance[ends[k + 1]]) });
+	}
+	splitSpans(points, [](size_t i) { return i; }, profileExtent, queue, importance, pointOfSplit, numSplits);
+
+	// Keys hold the importance above the split number, so that one integer
+	// comparison orders by both
+	std::vector<size_t> splitOfPoint(n);
+	for (size_t k = 0; k < n; k++)
+		splitOfPoint[pointOfSplit[k]] = k;
+	std::vector<uint64_t> keys(n);
+	for (size_t i = 0; i < n; i++) {
+		uint32_t bits;
+		memcpy(&bits, &importance[i], sizeof(bits));
+		keys[i] = ((uint64_t)(0xFFFFFFFFu - bits) << 32) | (uint64_t)splitOfPoint[i];
+	}
+	return keys;
+}
+
+// The count most important points, in order along the line
+static std::vector<size_t> keepPoints(const std::vector<uint64_t>& keys, size_t count) {
+	size_t n = keys.size();
+	count = std::min(count, n);
+	uint64_t last = UINT64_MAX;
+	if (count < n) {
+		std::vector<uint64_t> sorted = keys;
+		std::nth_element(sorted.begin(), sorted.begin() + (count - 1), sorted.end());
+		last = sorted[count - 1];
+	}
+	std::vector<size_t> kept;
+	kept.reserve(count);
+	for (size_t i = 0; i < n; i++) {
+		if (keys[i] <= last)
+			kept.push_back(i);
+	}
+	return kept;
+}
+
+// Largest deviation of the points left out between kept neighbours
+static float maxDeviation(const Sample* points, const std::vector<size_t>& kept, float profileExtent) {
+	float error = 0.0f;
+	for (size_t k = 0; k + 1 < kept.size(); k++) {
+		Chord chord(points[kept[k]], points[kept[k + 1]], profileExtent);
+		for (size_t i = kept[k] + 1; i < kept[k + 1]; i++)
+			error = std::max(error, chord.deviationAbove(points[i], error));
+	}
+	return error;
+}
+
+LodChain::LodChain(const Path& path, const Shape& shape, size_t numLevels,
+	Tessellation tessellation, VertexLayout layout, TubeNormals normals, unsigned int numThreads)
+{
+	assert(numLevels > 0);
+
+	// Polyline, frames and lengths along the path shared by every level
+
+	Arena arena;
+	auto points = std::pmr::vector<Point>(&arena);
+	Tube::toSweepPoints(path, tessellation, points);
+	size_t numPoints = points.size();
+	auto frames = std::pmr::vector<Frame>(numPoints, &arena);
+	rotationMinimizingFrames(points.data(), numPoints, path.closed, frames.data());
+
+	float pathLength = 0.0f;
+	for (size_t i = 1; i < numPoints; i++)
+		pathLength += glm::distance(points[i - 1].pos, points[i].pos);
+	auto ringV = std::pmr::vector<float>(numPoints, &arena);
+	float curLength = 0.0f;
+	for (size_t i = 0; i < numPoints; i++) {
+		ringV[i] = curLength / pathLength;
+		if (i + 1 < numPoints)
+			curLength += glm::length(points[i].pos - points[i + 1].pos);
+	}
+
+	// Radius and tilt move the surface by up to the size of the profile
+
+	float profileExtent = 0.0f;
+	for (const auto& vert : shape.verts)
+		profileExtent = std::max(profileExtent, glm::length(glm::vec2(vert.x, vert.y)));
+	float maxRadius = 0.0f;
+	for (const auto& point : points)
+		maxRadius = std::max(maxRadius, fabsf(point.radius));
+
+	// The profile is measured as a line without radius and tilt
+
+	auto samples = std::pmr::vector<Sample>(&arena);
+	samples.reserve(numPoints);
+	for (const auto& point : points)
+		samples.push_back({ point.pos, point.radius, point.tilt });
+	std::vector<Sample> profileSamples;
+	for (const auto& vert : shape.verts)
+		profileSamples.push_back({ vert, 0.0f, 0.0f });
+
+	auto ringKeys = importanceKeys(samples.data(), numPoints, profileExtent);
+	auto profileKeys = importanceKeys(profileSamples.data(), profileSamples.size(), 0.0f);
+
+	// Halve rings and profile vertices down to the smallest tube that
+	// still has a volume
+
+	size_t minRings = std::min(numPoints, (size_t)(path.closed ? 4 : 2));
+	size_t minShapeVerts = std::min(shape.verts.size(), (size_t)(shape.closed ? 4 : 2));
+	std::vector<size_t> levelRings;
+	std::vector<size_t> levelShapeVerts;
+	size_t numRings = numPoints;
+	size_t shapeNumVerts = shape.verts.size();
+	for (size_t level = 0; level < numLevels; level++) {
+		if (level > 0) {
+			size_t nextRings = std::max(minRings, (numRings + 1) / 2);
+			size_t nextShapeVerts = std::max(minShapeVerts, (shapeNumVerts + 1) / 2);
+			if (nextRings == numRings && nextShapeVerts == shapeNumVerts)
+				break;
+			numRings = nextRings;
+			shapeNumVerts = nextShapeVerts;
+		}
+		levelRings.push_back(numRings);
+		levelShapeVerts.push_back(shapeNumVerts);
+	}
+
+	// Levels are independent, each sweeps its subset of the shared rings
+
+	size_t count = levelRings.size();
+	std::vector<Tube> tubes(count, Tube());
+	std::vector<float> errors(count, 0.0f);
+	bool hasNormals = normals == TubeNormals::ANALYTIC;
+	parallelFor(count, numThreads, [&](size_t level) {
+		auto rings = keepPoints(ringKeys, levelRings[level]);
+		auto profile = keepPoints(profileKeys, levelShapeVerts[level]);
+		errors[level] = maxDeviation(samples.data(), rings, profileExtent) +
+			maxDeviation(profileSamples.data(), profile, 0.0f) * maxRadius;
+
+		Shape levelShape = shape;
+		levelShape.verts.clear();
+		for (size_t i : profile)
+			levelShape.verts.push_back(shape.verts[i]);
+		if (hasNormals)
+			levelShape = Tube::splitCreases(levelShape);
+		auto shapeSoA = ShapeSoA(levelShape.verts);
+		auto profileSoA = hasNormals ? Tube::profileNormals(levelShape) : ShapeSoA(std::vector<glm::vec3>());
+
+		// Levels with every ring sweep the shared rings as they are
+		std::vector<Point> levelPoints;
+		std::vector<Frame> levelFrames;
+		if (rings.size() < numPoints) {
+			levelPoints.reserve(rings.size());
+			levelFrames.reserve(rings.size());
+			for (size_t i : rings) {
+				levelPoints.push_back(points[i]);
+				levelFrames.push_back(frames[i]);
+			}
+		}
+		const Point* ringPoints = rings.size() < numPoints ? levelPoints.data() : points.data();
+		const Frame* ringFrames = rings.size() < numPoints ? levelFrames.data() : frames.data();
+
+		Tube& tube = tubes[level];
+		size_t levelNumVerts = levelShape.verts.size();
+		size_t numVertices = rings.size() * levelNumVerts;
+		tube.vertices.resize(numVertices);
+		tube.texCoords.resize(numVertices);
+		tube.normals.resize(hasNormals ? numVertices : 0);
+		tube.indices.resize(Tube::numSweepIndices(rings.size(), levelNumVerts));
+		Tube::sweep(ringPoints, ringFrames, rings.size(), path.closed,
+			shapeSoA, profileSoA, tube.vertices.data(), hasNormals ? tube.normals.data() : nullptr,
+			tube.texCoords.data(), tube.indices.data(), 0, layout, nullptr, numVertices);
+
+		// Lengths along the full path, so textures do not slide between levels
+		for (size_t r = 0; r < rings.size(); r++) {
+			for (size_t p = 0; p < levelNumVerts; p++)
+				tube.texCoords[r * levelNumVerts + p].y = ringV[rings[r]];
+		}
+
+		tube.mShapeNumVerts = (int)levelNumVerts;
+		tube.mLayout = layout;
+		tube.packVertices();
+	});
+
+	for (size_t level = 0; level < count; level++) {
+		// Analytic normals split the creases of the profile, so rings may
+		// have more vertices than the reduced profile
+		size_t ringNumVerts = (size_t)tubes[level].mShapeNumVerts;
+		this->levels.push_back(LodLevel{ std::move(tubes[level]), levelRings[level], ringNumVerts, errors[level] });
+	}
+}
+
+size_t LodChain::select(float distance, float viewportHeight, float fovY, float maxPixelError) const {
+	size_t best = 0;
+	for (size_t level = 1; level < this->levels.size(); level++) {
+		if (this->levels[level].screenSpaceError(distance, viewportHeight, fovY) <= maxPixelError)
+			best = level;
+	}
+	return best;
+}
@@ -0,0 +1,180 @@
+#include "Parallel.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace tube;
+
+namespace {
+
+// Set while the thread runs items of a job, nested calls then run serially
+thread_local bool tInJob = false;
+
+class InJob {
+	bool mPrevious;
+
+public:
+	InJob() : mPrevious(tInJob) { tInJob = true; }
+	~InJob() { tInJob = mPrevious; }
+};
+
+class ThreadPool {
+	std::vector<std::thread> mWorkers;
+
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::condition_variable mDone;
+	bool mStop = false;
+
+	// Current job, guarded by mMutex
+	const std::function<void(size_t)>* mFn = nullptr;
+	size_t mCount = 0;
+	unsigned int mGeneration = 0;
+	unsigned int mFreeSlots = 0;
+	unsigned int mActive = 0;
+	// First exception of an item of the job, guarded by mMutex
+	std::exception_ptr mError;
+
+	std::atomic<size_t> mNext{ 0 };
+
+	// Only one job uses the workers at a time, other threads that start
+	// one meanwhile run it alone
+	std::mutex mJobMutex;
+
+	void runItems(const std::function<void(size_t)>& fn, size_t count) {
+		InJob inJob;
+		for (size_t i = mNext.fetch_add(1); i < count; i = mNext.fetch_add(1)) {
+			try {
+				fn(i);
+			}
+			catch (...) {
+				// Keep the first exception for the calling thread and stop
+				// handing out the remaining items
+				std::lock_guard<std::mutex> lock(mMutex);
+				if (mError == nullptr)
+					mError = std::current_exception();
+				mNext = count;
+			}
+		}
+	}
+
+	void work() {
+		unsigned int seenGeneration = 0;
+		while (true) {
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [&] {
+				return mStop || (mGeneration != seenGeneration && mFreeSlots > 0);
+			});
+			if (mStop)
+				return;
+			seenGeneration = mGeneration;
+			mFreeSlots--;
+			mActive++;
+			auto fn = mFn;
+			size_t count = mCount;
+			lock.unlock();
+
+			runItems(*fn, count);
+
+			lock.lock();
+			if (--mActive == 0)
+				mDone.notify_all();
+		}
+	}
+
+public:
+	ThreadPool(unsigned int numWorkers) {
+		for (unsigned int i = 0; i < numWorkers; i++)
+			mWorkers.emplace_back([this] { work(); });
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mStop = true;
+		}
+		mWake.notify_all();
+		for (auto& worker : mWorkers)
+			worker.join();
+	}
+
+	void run(size_t count, unsigned int numThreads, const std::function<void(size_t)>& fn) {
+		size_t numHelpers = std::min({ (size_t)numThreads - 1, mWorkers.size(), count - 1 });
+		std::unique_lock<std::mutex> job(mJobMutex, std::defer_lock);
+		if (numHelpers == 0 || tInJob || !job.try_lock()) {
+			for (size_t i = 0; i < count; i++)
+				fn(i);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mFn = &fn;
+			mCount = count;
+			mNext = 0;
+			mFreeSlots = (unsigned int)numHelpers;
+			mGeneration++;
+		}
+		mWake.notify_all();
+
+		// Items catch their exceptions, so the workers are always waited
+		// for before fn goes away
+		runItems(fn, count);
+
+		std::exception_ptr error;
+		{
+			// Workers that did not start yet are not needed anymore
+			std::unique_lock<std::mutex> lock(mMutex);
+			mFreeSlots = 0;
+			mDone.wait(lock, [&] { return mActive == 0; });
+			mFn = nullptr;
+			error = std::exchange(mError, nullptr);
+		}
+		job.unlock();
+		if (error != nullptr)
+			std::rethrow_exception(error);
+	}
+};
+
+ThreadPool& pool() {
+	static ThreadPool threadPool(hardwareThreads() - 1);
+	return threadPool;
+}
+
+}
+
+unsigned int tube::hardwareThreads() {
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void tube::parallelFor(size_t count, unsigned int numThreads, const std::function<void(size_t)>& fn) {
+	if (count == 0)
+		return;
+	if (numThreads == 0)
+		numThreads = hardwareThreads();
+	if (numThreads == 1 || count == 1) {
+		for (size_t i = 0; i < count; i++)
+			fn(i);
+		return;
+	}
+#ifdef TUBE_STATS
+	// Helpers record into the recording of the calling thread
+	StatsRecording* recording = StatsRecording::current();
+	if (recording != nullptr) {
+		std::function<void(size_t)> recorded = [&](size_t i) {
+			StatsBinding binding(recording);
+			fn(i);
+		};
+		pool().run(count, numThreads, recorded);
+		return;
+	}
+#endif
+	pool().run(count, numThreads, fn);
+}
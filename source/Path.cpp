@@ -1,9 +1,36 @@
 #include "Path.h"
 #include "Bezier.h"
 #include "Tube.h"
+#include "InstancedTube.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
 
 using namespace tube;
 
+Tessellation::Tessellation()
+{
+}
+
+Tessellation::Tessellation(int segmentsPerCurve)
+    : segmentsPerCurve(segmentsPerCurve)
+{
+}
+
+Tessellation Tessellation::adaptive(float tolerance, float angleTolerance) {
+    Tessellation tessellation;
+    tessellation.tolerance = tolerance;
+    tessellation.angleTolerance = angleTolerance;
+    return tessellation;
+}
+
+bool Tessellation::isAdaptive() const {
+    return this->tolerance > 0.0f;
+}
+
 Point::Point()
     : pos(glm::vec3(0.0f))
 {
@@ -94,6 +121,8 @@ ThreePoints tube::Point::divide(Point start, Point end, float t)
         mid.tilt = lerpf(start.tilt, end.tilt, t);
         points = { start, mid, end };
     }
+    points.A.isMiter = start.isMiter;
+    points.C.isMiter = end.isMiter;
     return points;
 }
 
@@ -108,8 +137,29 @@ float tube::Point::length(Point start, Point end) {
     return len;
 }
 
-std::vector<glm::vec3> Point::toVectors(Point start, Point end, int segments) {
+// Vertices of the curve between two points and, if params is not null,
+// the curve parameter of each vertex
+static std::vector<glm::vec3> curveVectors(const Point& start, const Point& end,
+                                           const Tessellation& tessellation,
+                                           std::vector<float>* params) {
     std::vector<glm::vec3> verts;
+    bool isCurve = start.hasRightHandle || end.hasLeftHandle;
+
+    if (isCurve && tessellation.isAdaptive()) {
+        float tolerance = tessellation.tolerance;
+        float angleTolerance = tessellation.angleTolerance;
+        if (start.hasRightHandle && end.hasLeftHandle)
+            return adaptiveCubicBezier(start.pos, start.rightHandlePos, end.leftHandlePos, end.pos,
+                                       tolerance, angleTolerance, params);
+        else if (start.hasRightHandle)
+            return adaptiveQuadraticBezier(start.pos, start.rightHandlePos, end.pos,
+                                           tolerance, angleTolerance, params);
+        else
+            return adaptiveQuadraticBezier(start.pos, end.leftHandlePos, end.pos,
+                                           tolerance, angleTolerance, params);
+    }
+
+    int segments = tessellation.segmentsPerCurve;
     if (start.hasRightHandle && end.hasLeftHandle) {
         verts = cubicBezier(start.pos, start.rightHandlePos, end.leftHandlePos, end.pos, segments);
     }
@@ -122,45 +172,122 @@ std::vector<glm::vec3> Point::toVectors(Point start, Point end, int segments) {
     else {
         verts = { start.pos, end.pos };
     }
+
+    if (params) {
+        // Uniform sampling, the parameter grows linearly with the index
+        params->resize(verts.size());
+        float last = (float)verts.size() - 1.0f;
+        for (size_t i = 0; i < verts.size(); i++)
+            (*params)[i] = (float)i / last;
+    }
     return verts;
 }
 
-std::vector<Point> Point::toPoly(Point start, Point end, int segments) {
-    auto verts = Point::toVectors(start, end, segments);
+std::vector<glm::vec3> Point::toVectors(Point start, Point end, Tessellation tessellation) {
+    return curveVectors(start, end, tessellation, nullptr);
+}
 
-    float length = 0.0f;
-    std::vector<float> lengths(verts.size() - 1);
-    for (int i = 0; i < verts.size() - 1; i++) {
-        auto len = glm::length(verts[0] - verts[1]);
-        lengths[i] = len;
-        length += len;
-    }
+std::vector<Point> Point::toPoly(Point start, Point end, Tessellation tessellation) {
+    std::vector<float> params;
+    auto verts = curveVectors(start, end, tessellation, &params);
 
     std::vector<Point> points(verts.size());
-    
-    // Position of a vertex on a curve from 0 to 1
-    float t = 0.0f;
 
-    for (int i = 0; i < verts.size(); i++) {
-        float radius = lerpf(start.radius, end.radius, t);
-        float tilt = lerpf(start.tilt, end.tilt, t);
+    for (size_t i = 0; i < verts.size(); i++) {
+        // Position of a vertex on a curve from 0 to 1
+        float t = params[i];
 
         auto point = Point(verts[i]);
         point.hasRightHandle = false;
         point.hasLeftHandle = false;
-        point.radius = radius;
-        point.tilt = tilt;
+        point.radius = lerpf(start.radius, end.radius, t);
+        point.tilt = lerpf(start.tilt, end.tilt, t);
+        point.isMiter = (i == 0 && start.isMiter) || (i + 1 == verts.size() && end.isMiter);
         points[i] = point;
-
-        bool isEnd = i == verts.size() - 1;
-        if(!isEnd)
-            t += lengths[i] / length;
     }
 
 	return points;
 }
 
-bool tube::Path::hasNonPoly() {
+// Samples of the curve between two points at uniform parameters. Straight
+// segments are sampled at their ends, whatever the number of samples
+static int numCurveSamples(const Point& start, const Point& end, int segments) {
+    return start.hasRightHandle || end.hasLeftHandle ? segments : 2;
+}
+
+static void sampleCurve(const Point& start, const Point& end, int segments, glm::vec3* out) {
+    if (start.hasRightHandle && end.hasLeftHandle)
+        cubicBezier(start.pos, start.rightHandlePos, end.leftHandlePos, end.pos, segments, out);
+    else if (start.hasRightHandle)
+        quadraticBezier(start.pos, start.rightHandlePos, end.pos, segments, out);
+    else if (end.hasLeftHandle)
+        quadraticBezier(start.pos, end.leftHandlePos, end.pos, segments, out);
+    else {
+        out[0] = start.pos;
+        out[1] = end.pos;
+    }
+}
+
+// The same as curveVectors, appending to vectors that may live in an arena
+static void appendCurveVectors(const Point& start, const Point& end, const Tessellation& tessellation,
+                               std::pmr::vector<glm::vec3>& verts, std::pmr::vector<float>& params) {
+    bool isCurve = start.hasRightHandle || end.hasLeftHandle;
+
+    if (isCurve && tessellation.isAdaptive()) {
+        float tolerance = tessellation.tolerance;
+        float angleTolerance = tessellation.angleTolerance;
+        if (start.hasRightHandle && end.hasLeftHandle)
+            adaptiveCubicBezier(start.pos, start.rightHandlePos, end.leftHandlePos, end.pos,
+                                tolerance, angleTolerance, verts, params);
+        else if (start.hasRightHandle)
+            adaptiveQuadraticBezier(start.pos, start.rightHandlePos, end.pos,
+                                    tolerance, angleTolerance, verts, params);
+        else
+            adaptiveQuadraticBezier(start.pos, end.leftHandlePos, end.pos,
+                                    tolerance, angleTolerance, verts, params);
+        return;
+    }
+
+    size_t first = verts.size();
+    int segments = numCurveSamples(start, end, tessellation.segmentsPerCurve);
+    verts.resize(first + segments);
+    sampleCurve(start, end, segments, verts.data() + first);
+
+    float last = (float)segments - 1.0f;
+    for (int i = 0; i < segments; i++)
+        params.push_back((float)i / last);
+}
+
+// Append the polyline of the curve to out, without its first point unless
+// withStart is set. verts and params are scratch buffers
+template<typename Points>
+static void appendPoly(const Point& start, const Point& end, const Tessellation& tessellation,
+                       Points& out, bool withStart,
+                       std::pmr::vector<glm::vec3>& verts, std::pmr::vector<float>& params) {
+    verts.clear();
+    params.clear();
+    appendCurveVectors(start, end, tessellation, verts, params);
+
+    for (size_t i = withStart ? 0 : 1; i < verts.size(); i++) {
+        float t = params[i];
+        auto point = Point(verts[i]);
+        point.radius = lerpf(start.radius, end.radius, t);
+        point.tilt = lerpf(start.tilt, end.tilt, t);
+        point.isMiter = (i == 0 && start.isMiter) || (i + 1 == verts.size() && end.isMiter);
+        out.push_back(point);
+    }
+}
+
+void Point::toPoly(const Point& start, const Point& end, Tessellation tessellation,
+                   std::pmr::vector<Point>& out, bool withStart) {
+    // Scratch buffers come from the same memory as out
+    auto* memory = out.get_allocator().resource();
+    std::pmr::vector<glm::vec3> verts(memory);
+    std::pmr::vector<float> params(memory);
+    appendPoly(start, end, tessellation, out, withStart, verts, params);
+}
+
+bool tube::Path::hasNonPoly() const {
     for (const auto& point : points) {
         if (point.hasLeftHandle || point.hasRightHandle)
             return true;
@@ -216,20 +343,123 @@ TwoPathes tube::Path::divide(float t)
 }
 
 std::vector<Path> Path::dash(float dashLength, float gapLength, float offset) {
+    return this->dash(std::vector<float>({ dashLength, gapLength }), offset);
+}
+
+std::vector<Path> Path::dash(const std::vector<float>& pattern, float offset) {
     std::vector<Path> pathes;
-    Path currentPath = *this;
-    while(true) {
-        float len = currentPath.length();
-        TwoPathes twoPathes = currentPath.divide(dashLength / len);
-        if(twoPathes.first.points.size() < 2)
-            break;
-        pathes.push_back(twoPathes.first);
-        float secondPathLen = twoPathes.second.length();
-        currentPath = twoPathes.second.divide(gapLength / secondPathLen).second;
-    }
+    this->dash(pattern, offset, pathes);
     return pathes;
 }
 
+// Append the part of the curve between t0 and t1 to the dash. The first
+// point of the part continues the last point of the dash if there is one.
+static void appendCurvePart(Path& dash, const Point& start, const Point& end, float t0, float t1) {
+    Point a, b;
+    if (t1 < 1.0f) {
+        auto head = Point::divide(start, end, t1);
+        if (t0 > 0.0f) {
+            auto part = Point::divide(head.A, head.B, t0 / t1);
+            a = part.B;
+            b = part.C;
+        }
+        else {
+            a = head.A;
+            b = head.B;
+        }
+    }
+    else if (t0 > 0.0f) {
+        auto tail = Point::divide(start, end, t0);
+        a = tail.B;
+        b = tail.C;
+    }
+    else {
+        a = start;
+        b = end;
+    }
+
+    if (dash.points.empty()) {
+        a.hasLeftHandle = false;
+        dash.points.push_back(a);
+    }
+    else {
+        dash.points.back().hasRightHandle = a.hasRightHandle;
+        dash.points.back().rightHandlePos = a.rightHandlePos;
+    }
+    b.hasRightHandle = false;
+    dash.points.push_back(b);
+}
+
+void Path::dash(const std::vector<float>& pattern, float offset, std::vector<Path>& out) {
+    TUBE_STATS_STAGE(BuildStage::DASH);
+    if (this->points.size() < 2)
+        return;
+
+    // Odd patterns repeat twice so that dashes and gaps alternate
+    std::vector<float> lengths = pattern;
+    if (lengths.size() % 2 == 1)
+        lengths.insert(lengths.end(), pattern.begin(), pattern.end());
+
+    float patternLength = 0.0f;
+    for (auto& len : lengths) {
+        len = std::max(len, 0.0f);
+        patternLength += len;
+    }
+    if (patternLength <= 0.0f) {
+        out.push_back(this->copy());
+        out.back().closed = false;
+        return;
+    }
+
+    // Find the pattern element under the offset
+    float phase = fmodf(offset, patternLength);
+    if (phase < 0.0f)
+        phase += patternLength;
+    size_t element = 0;
+    while (phase >= lengths[element] && element + 1 < lengths.size()) {
+        phase -= lengths[element];
+        element++;
+    }
+    float remaining = std::max(lengths[element] - phase, 0.0f);
+    bool isDash = element % 2 == 0;
+
+    // Walk the path once, cutting segments where dashes and gaps change
+    const auto& table = this->arcLengths();
+    Path current;
+    for (size_t segment = 0; segment < table.numSegments(); segment++) {
+        const Point& start = this->points[segment];
+        const Point& end = this->points[(segment + 1) % this->points.size()];
+        float segmentLength = table.segmentLength(segment);
+
+        float pos = 0.0f;
+        float t0 = 0.0f;
+        while (pos < segmentLength) {
+            float step = std::min(remaining, segmentLength - pos);
+            float next = pos + step;
+            float t1 = next < segmentLength ? table.tAtLength(segment, next) : 1.0f;
+
+            if (isDash && step > 0.0f)
+                appendCurvePart(current, start, end, t0, t1);
+
+            pos = next;
+            t0 = t1;
+            remaining -= step;
+
+            if (remaining <= 0.0f) {
+                if (current.points.size() >= 2)
+                    out.push_back(std::move(current));
+                current = Path();
+                element = (element + 1) % lengths.size();
+                remaining = lengths[element];
+                isDash = !isDash;
+            }
+        }
+    }
+
+    if (current.points.size() >= 2)
+        out.push_back(std::move(current));
+}
+
 Path tube::Path::copy() {
     Path path;
     path.closed = this->closed;
@@ -237,38 +467,183 @@ Path tube::Path::copy() {
     return path;
 }
 
-Path tube::Path::close() {
+void tube::Path::closeInPlace() {
     assert(this->points.size() > 0);
-    auto path = this->copy();
     auto end = tube::Point();
-    end.pos = path.points[0].pos;
-    end.radius = path.points[0].radius;
-    end.tilt = path.points[0].tilt;
-    end.leftHandlePos = path.points[0].leftHandlePos;
-    end.hasLeftHandle = path.points[0].hasLeftHandle;
-    path.points.push_back(end);
+    end.pos = this->points[0].pos;
+    end.radius = this->points[0].radius;
+    end.tilt = this->points[0].tilt;
+    end.leftHandlePos = this->points[0].leftHandlePos;
+    end.hasLeftHandle = this->points[0].hasLeftHandle;
+    this->points.push_back(end);
+    this->invalidate();
+}
+
+Path tube::Path::close() & {
+    auto path = this->copy();
+    path.closeInPlace();
+    return path;
+}
+
+Path tube::Path::close() && {
+    auto path = std::move(*this);
+    path.closeInPlace();
     return path;
 }
 
+// Control points of the segment from start to end as a cubic curve with
+// the same parameterization. Quadratic curves are raised to cubics, false
+// is returned for straight segments
+static bool segmentCubic(const Point& start, const Point& end, glm::vec3* out) {
+    out[0] = start.pos;
+    out[3] = end.pos;
+    if (start.hasRightHandle && end.hasLeftHandle) {
+        out[1] = start.rightHandlePos;
+        out[2] = end.leftHandlePos;
+        return true;
+    }
+    if (start.hasRightHandle || end.hasLeftHandle) {
+        glm::vec3 handle = start.hasRightHandle ? start.rightHandlePos : end.leftHandlePos;
+        out[1] = start.pos + (handle - start.pos) * (2.0f / 3.0f);
+        out[2] = end.pos + (handle - end.pos) * (2.0f / 3.0f);
+        return true;
+    }
+    return false;
+}
+
+// Unit tangent at parameter t of the segment from start to end
+static glm::vec3 segmentTangent(const Point& start, const Point& end, float t) {
+    glm::vec3 c[4];
+    glm::vec3 d = segmentCubic(start, end, c) ? cubicBezierDerivative(c[0], c[1], c[2], c[3], t) : end.pos - start.pos;
+    float len = glm::length(d);
+    return len > 0.0f ? d / len : d;
+}
+
+// Knots of the per curve arc length table evenlyDistributed() inverts
+static const int RESAMPLE_KNOTS = 8;
+
 Path tube::Path::evenlyDistributed(float len) {
-    assert(!this->hasNonPoly());
+    return this->evenlyDistributed(len, nullptr);
+}
+
+Path tube::Path::evenlyDistributed(float len, std::vector<glm::vec3>& tangents) {
+    return this->evenlyDistributed(len, &tangents);
+}
+
+Path tube::Path::evenlyDistributed(float len, std::vector<glm::vec3>* tangents) {
+    TUBE_STATS_STAGE(BuildStage::RESAMPLE);
     assert(this->points.size() >= 2);
+    assert(len > 0.0f);
     Path path;
     path.closed = this->closed;
-
-    path.points.push_back(tube::Point(this->points[0].pos));
-    path.points[0].radius = this->points[0].radius;
-    path.points[0].tilt = this->points[0].tilt;
-
-    float fullLength = this->length();
-    auto lengths = this->getPolyLengths();
-    for (float currentLen = len; currentLen < fullLength; currentLen += len) {
-        path.points.push_back(this->getPointAtT(this->getTAtLength(currentLen, lengths)));
+    if (tangents != nullptr)
+        tangents->clear();
+
+    // A curve is never longer than its control polygon, which bounds the
+    // number of samples so the points are allocated once
+    size_t numSegments = this->points.size() - (this->closed ? 0 : 1);
+    float maxLength = 0.0f;
+    for (size_t i = 0; i < numSegments; i++) {
+        glm::vec3 c[4];
+        if (segmentCubic(this->points[i], this->points[(i + 1) % this->points.size()], c))
+            maxLength += glm::distance(c[0], c[1]) + glm::distance(c[1], c[2]) + glm::distance(c[2], c[3]);
+        else
+            maxLength += glm::distance(c[0], c[3]);
+    }
+    path.points.reserve((size_t)(maxLength / len) + 2);
+    if (tangents != nullptr)
+        tangents->reserve(path.points.capacity());
+
+    const auto& first = this->points[0];
+    path.points.push_back(tube::Point(first.pos));
+    path.points[0].radius = first.radius;
+    path.points[0].tilt = first.tilt;
+    if (tangents != nullptr)
+        tangents->push_back(segmentTangent(first, this->points[1], 0.0f));
+
+    // Walk the segments once. Straight ones are inverted exactly, curves
+    // through a table of their arc length at uniform parameters, refined
+    // by Newton steps on the exact length
+    float segmentStart = 0.0f;
+    // Lengths are multiples of len rather than a running sum, which would
+    // drift over long pathes
+    size_t numSamples = 1;
+    float currentLen = len;
+    float knotLengths[RESAMPLE_KNOTS + 1];
+    for (size_t i = 0; i < numSegments; i++) {
+        const auto& start = this->points[i];
+        const auto& end = this->points[(i + 1) % this->points.size()];
+        glm::vec3 c[4];
+        bool isCurve = segmentCubic(start, end, c);
+
+        float segmentLen;
+        if (isCurve) {
+            knotLengths[0] = 0.0f;
+            for (int k = 0; k < RESAMPLE_KNOTS; k++) {
+                float t0 = (float)k / RESAMPLE_KNOTS;
+                float t1 = (float)(k + 1) / RESAMPLE_KNOTS;
+                knotLengths[k + 1] = knotLengths[k] + cubicBezierLength(c[0], c[1], c[2], c[3], t0, t1);
+            }
+            segmentLen = knotLengths[RESAMPLE_KNOTS];
+        }
+        else
+            segmentLen = glm::distance(start.pos, end.pos);
+
+        int knot = 0;
+        for (; currentLen < segmentStart + segmentLen; currentLen = len * (float)++numSamples) {
+            float s = currentLen - segmentStart;
+            float t;
+            glm::vec3 pos;
+            if (isCurve) {
+                while (knot + 1 < RESAMPLE_KNOTS && knotLengths[knot + 1] <= s)
+                    knot++;
+                float lo = (float)knot / RESAMPLE_KNOTS;
+                float hi = (float)(knot + 1) / RESAMPLE_KNOTS;
+                float a = knotLengths[knot];
+                float b = knotLengths[knot + 1];
+                t = b > a ? lo + (s - a) / (b - a) * (hi - lo) : lo;
+                // Bisect instead where a step would leave the knot interval
+                for (int step = 0; step < 8; step++) {
+                    float part = cubicBezierLength(c[0], c[1], c[2], c[3], lo, t);
+                    float error = a + part - s;
+                    if (fabsf(error) <= fmaxf(segmentLen, currentLen) * 1e-6f)
+                        break;
+                    if (error > 0.0f)
+                        hi = t;
+                    else {
+                        a += part;
+                        lo = t;
+                    }
+                    float speed = glm::length(cubicBezierDerivative(c[0], c[1], c[2], c[3], t));
+                    float next = speed > 0.0f ? t - error / speed : lo;
+                    t = next > lo && next < hi ? next : (lo + hi) * 0.5f;
+                }
+                pos = cubicBezierPoint(c[0], c[1], c[2], c[3], t);
+            }
+            else {
+                t = s / segmentLen;
+                pos = glm::mix(start.pos, end.pos, t);
+            }
+
+            auto point = tube::Point(pos);
+            point.radius = lerpf(start.radius, end.radius, t);
+            point.tilt = lerpf(start.tilt, end.tilt, t);
+            path.points.push_back(point);
+            if (tangents != nullptr)
+                tangents->push_back(segmentTangent(start, end, t));
+        }
+        segmentStart += segmentLen;
     }
 
-    path.points.push_back(tube::Point(this->points.back().pos));
-    path.points.back().radius = this->points.back().radius;
-    path.points.back().tilt = this->points.back().tilt;
+    // Closed pathes end where they start
+    if (!this->closed) {
+        const auto& last = this->points.back();
+        path.points.push_back(tube::Point(last.pos));
+        path.points.back().radius = last.radius;
+        path.points.back().tilt = last.tilt;
+        if (tangents != nullptr)
+            tangents->push_back(segmentTangent(this->points[this->points.size() - 2], last, 1.0f));
+    }
 
     return path;
 }
@@ -291,15 +666,34 @@ float tube::Path::getTAtLength(float len, std::vector<float>& lengths) {
     return t;
 }
 
+float tube::Path::getTAtLength(float len) {
+    const auto& table = this->arcLengths();
+    if (table.numSegments() == 0)
+        return 0.0f;
+    float localT = 0.0f;
+    size_t segment = table.locate(len, localT);
+    return ((float)segment + localT) / (float)table.numSegments();
+}
+
 Point tube::Path::getPointAtT(float t) {
-    int numArcs = (int)this->points.size() - 1;
+    int numArcs = (int)this->points.size() - (this->closed ? 0 : 1);
     float remapedT = t * (float)numArcs;
     int arc = (int)floorf(remapedT);
     if (arc == numArcs)
         arc--;
     float localT = remapedT - arc;
     auto& start = this->points[(size_t)arc];
-    auto& end = this->points[(size_t)arc + 1LL];
+    auto& end = this->points[((size_t)arc + 1LL) % this->points.size()];
+    return Point::divide(start, end, localT).B;
+}
+
+Point tube::Path::getPointAtLength(float len) {
+    const auto& table = this->arcLengths();
+    assert(table.numSegments() > 0);
+    float localT = 0.0f;
+    size_t segment = table.locate(len, localT);
+    auto& start = this->points[segment];
+    auto& end = this->points[(segment + 1) % this->points.size()];
     return Point::divide(start, end, localT).B;
 }
 
@@ -315,95 +709,268 @@ std::vector<float> tube::Path::getPolyLengths()
     return lengths;
 }
 
+uint64_t tube::Path::fingerprint() const {
+    // FNV-1a over the bits of everything the tables depend on, only
+    // compared in debug builds since it costs a pass over the points
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash](uint32_t word) {
+        hash = (hash ^ word) * 1099511628211ULL;
+    };
+    auto mixVec = [&mix](glm::vec3 v) {
+        uint32_t words[3];
+        memcpy(words, &v, sizeof(words));
+        mix(words[0]);
+        mix(words[1]);
+        mix(words[2]);
+    };
+    mix(this->closed ? 1u : 0u);
+    for (const auto& point : this->points) {
+        mixVec(point.pos);
+        mix((point.hasLeftHandle ? 1u : 0u) | (point.hasRightHandle ? 2u : 0u));
+        if (point.hasLeftHandle)
+            mixVec(point.leftHandlePos);
+        if (point.hasRightHandle)
+            mixVec(point.rightHandlePos);
+    }
+    return hash;
+}
+
+const ArcLengthTable& tube::Path::arcLengths() {
+    if (!mArcLengths || mArcLengthsSize != this->points.size() || mArcLengthsClosed != this->closed) {
+        mArcLengths = std::make_shared<const ArcLengthTable>(
+            ArcLengthTable::build(this->points, this->closed));
+        mArcLengthsSize = this->points.size();
+        mArcLengthsClosed = this->closed;
+#ifndef NDEBUG
+        mArcLengthsFingerprint = this->fingerprint();
+#endif
+    }
+    // Points edited in place without invalidate() would read stale lengths
+    assert(mArcLengthsFingerprint == this->fingerprint());
+    return *mArcLengths;
+}
+
+const std::vector<Frame>& tube::Path::frames() {
+    if (!mFrames || mFramesSize != this->points.size() || mFramesClosed != this->closed) {
+        mFrames = std::make_shared<const std::vector<Frame>>(
+            rotationMinimizingFrames(this->points, this->closed));
+        mFramesSize = this->points.size();
+        mFramesClosed = this->closed;
+#ifndef NDEBUG
+        mFramesFingerprint = this->fingerprint();
+#endif
+    }
+    assert(mFramesFingerprint == this->fingerprint());
+    return *mFrames;
+}
+
+void tube::Path::invalidate() {
+    mArcLengths.reset();
+    mFrames.reset();
+}
+
+ArcLengthTable ArcLengthTable::build(const std::vector<Point>& points, bool closed, int samplesPerCurve) {
+    ArcLengthTable table;
+    table.numPoints = points.size();
+    table.closed = closed;
+
+    size_t numSegments = 0;
+    if (points.size() >= 2)
+        numSegments = closed ? points.size() : points.size() - 1;
+
+    table.segmentStarts.reserve(numSegments + 1);
+    table.sampleStarts.reserve(numSegments + 1);
+    table.sampleLengths.reserve(numSegments * 2);
+
+    float pathLength = 0.0f;
+    auto verts = std::vector<glm::vec3>();
+    for (size_t i = 0; i < numSegments; i++) {
+        const Point& start = points[i];
+        const Point& end = points[(i + 1) % points.size()];
+        verts.resize(numCurveSamples(start, end, samplesPerCurve));
+        sampleCurve(start, end, (int)verts.size(), verts.data());
+
+        table.segmentStarts.push_back(pathLength);
+        table.sampleStarts.push_back(table.sampleLengths.size());
+
+        float len = 0.0f;
+        table.sampleLengths.push_back(0.0f);
+        for (size_t k = 1; k < verts.size(); k++) {
+            len += glm::distance(verts[k - 1], verts[k]);
+            table.sampleLengths.push_back(len);
+        }
+        pathLength += len;
+    }
+    table.segmentStarts.push_back(pathLength);
+    table.sampleStarts.push_back(table.sampleLengths.size());
+    return table;
+}
+
+size_t ArcLengthTable::numSegments() const {
+    return this->segmentStarts.size() - 1;
+}
+
+float ArcLengthTable::length() const {
+    return this->segmentStarts.back();
+}
+
+float ArcLengthTable::segmentLength(size_t segment) const {
+    return this->segmentStarts[segment + 1] - this->segmentStarts[segment];
+}
+
+float ArcLengthTable::lengthAtT(size_t segment, float t) const {
+    size_t first = this->sampleStarts[segment];
+    size_t numSamples = this->sampleStarts[segment + 1] - first;
+    float scaledT = glm::clamp(t, 0.0f, 1.0f) * (float)(numSamples - 1);
+    size_t k = std::min((size_t)scaledT, numSamples - 2);
+    float a = this->sampleLengths[first + k];
+    float b = this->sampleLengths[first + k + 1];
+    return lerpf(a, b, scaledT - (float)k);
+}
+
+float ArcLengthTable::tAtLength(size_t segment, float len) const {
+    // Sample interval of the segment containing len
+    auto first = this->sampleLengths.begin() + (ptrdiff_t)this->sampleStarts[segment];
+    auto last = this->sampleLengths.begin() + (ptrdiff_t)this->sampleStarts[segment + 1];
+    size_t numSamples = (size_t)(last - first);
+    auto sampleIt = std::upper_bound(first + 1, last - 1, len);
+    size_t k = (size_t)(sampleIt - first) - 1;
+
+    float a = first[(ptrdiff_t)k];
+    float b = first[(ptrdiff_t)k + 1];
+    float fraction = b > a ? (len - a) / (b - a) : 0.0f;
+    fraction = glm::clamp(fraction, 0.0f, 1.0f);
+    return ((float)k + fraction) / (float)(numSamples - 1);
+}
+
+size_t ArcLengthTable::locate(float len, float& t) const {
+    // Last segment starting at or before len
+    auto segmentIt = std::upper_bound(this->segmentStarts.begin() + 1, this->segmentStarts.end() - 1, len);
+    size_t segment = (size_t)(segmentIt - this->segmentStarts.begin()) - 1;
+    t = this->tAtLength(segment, len - this->segmentStarts[segment]);
+    return segment;
+}
+
 float bevel_t(float len, float r = 0.05f) {
     return (len - r) / len;
 }
 
-Path tube::Path::bevelOrRoundJoin(float radius, bool isRound) {
-    Path path = this->copy();
-    const float r = radius / 2;
+void tube::Path::joinInPlace(JoinType type, float radius) {
+    TUBE_STATS_STAGE(BuildStage::JOINS);
+    auto& points = this->points;
+    size_t n = points.size();
+    if (n < 3)
+        return;
+
+    if (type == JoinType::MITER_RING) {
+        // Points stay where they are, the sweep stretches their rings
+        for (size_t i = 1; i + 1 < n; i++)
+            points[i].isMiter = true;
+        return;
+    }
 
-    for (size_t i = 0; i + 2 < path.points.size(); i += 2) {
-        float tA =        bevel_t(Point::length(path.points[i + 0], path.points[i + 1]), r);
-        float tB = 1.0f - bevel_t(Point::length(path.points[i + 1], path.points[i + 2]), r);
+    const float r = radius / 2;
+    // Corners are cut on the segments of the path before the join
+    const auto& lengths = this->arcLengths();
+
+    // Every corner is written once to a new buffer. The first point of the
+    // segment before a corner, already cut by the corner before, and the
+    // corner itself wait until the corner is joined
+    std::vector<Point> joined;
+    joined.reserve(n + (n - 2) * (type == JoinType::MITER ? 2 : 1));
+    Point start = points[0];
+    Point corner = points[1];
+    float cutT = 0.0f;
+
+    for (size_t i = 1; i + 1 < n; i++) {
+        float upperLength = lengths.segmentLength(i - 1) - lengths.lengthAtT(i - 1, cutT);
+        float tA =        bevel_t(upperLength, r);
+        float tB = 1.0f - bevel_t(lengths.segmentLength(i), r);
+        cutT = tB;
+
+        auto upperArm = Point::divide(start, corner, tA);
+        auto lowerArm = Point::divide(corner, points[i + 1], tB);
+        lowerArm.B.hasLeftHandle = false;
 
-        auto upperArm = Point::divide(path.points[i + 0], path.points[i + 1], tA);
-        if (isRound) {
+        if (type == JoinType::ROUND) {
             upperArm.B.hasRightHandle = true;
             upperArm.B.rightHandlePos = upperArm.C.pos;
         }
         else
             upperArm.B.hasRightHandle = false;
+        joined.push_back(upperArm.A);
+        joined.push_back(upperArm.B);
+
+        if (type == JoinType::MITER) {
+            auto tip = upperArm.C;
+            tip.hasRightHandle = false;
+            tip.hasLeftHandle = false;
+            auto tipDir = -glm::normalize(
+                (
+                    glm::normalize(upperArm.A.pos - upperArm.B.pos) +
+                    glm::normalize(lowerArm.C.pos - lowerArm.B.pos)
+                ) / 2.0f
+            );
+            tip.pos += tipDir * r;
+            joined.push_back(tip);
+        }
 
-        auto lowerArm = Point::divide(path.points[i + 1], path.points[i + 2], tB);
-        lowerArm.B.hasLeftHandle = false;
+        start = lowerArm.B;
+        corner = lowerArm.C;
+    }
+    joined.push_back(start);
+    joined.push_back(corner);
 
-        auto newPoints = std::vector<Point>({
-            upperArm.A, upperArm.B,
-            lowerArm.B, lowerArm.C
-        });
+    points = std::move(joined);
+    this->invalidate();
+}
 
-        path.points.erase(path.points.begin() + i, path.points.begin() + i + 3);
-        path.points.insert(path.points.begin() + i, newPoints.begin(), newPoints.end());
-    }
+Path tube::Path::bevelJoin(float radius) & {
+    // Copies share the arc lengths of the original
+    Path path = *this;
+    path.joinInPlace(JoinType::BEVEL, radius);
     return path;
 }
 
-Path tube::Path::bevelJoin(float radius) {
-    return bevelOrRoundJoin(radius, false);
+Path tube::Path::bevelJoin(float radius) && {
+    auto path = std::move(*this);
+    path.joinInPlace(JoinType::BEVEL, radius);
+    return path;
 }
 
-Path tube::Path::roundJoin(float radius) {
-    return bevelOrRoundJoin(radius, true);
+Path tube::Path::roundJoin(float radius) & {
+    Path path = *this;
+    path.joinInPlace(JoinType::ROUND, radius);
+    return path;
 }
 
-#include <iostream>
-
-Path tube::Path::miterJoin(float radius) {
-    Path path = this->copy();
-    const float r = radius / 2;
+Path tube::Path::roundJoin(float radius) && {
+    auto path = std::move(*this);
+    path.joinInPlace(JoinType::ROUND, radius);
+    return path;
+}
 
-    for (size_t i = 0; i + 2 < path.points.size(); i += 3) {
-        float tA = bevel_t(Point::length(path.points[i + 0], path.points[i + 1]), r);
-        float tB = 1.0f - bevel_t(Point::length(path.points[i + 1], path.points[i + 2]), r);
+Path tube::Path::miterJoin(float radius) & {
+    Path path = *this;
+    path.joinInPlace(JoinType::MITER, radius);
+    return path;
+}
 
-        auto upperArm = Point::divide(path.points[i + 0], path.points[i + 1], tA);
-        upperArm.B.hasRightHandle = false;
+Path tube::Path::miterJoin(float radius) && {
+    auto path = std::move(*this);
+    path.joinInPlace(JoinType::MITER, radius);
+    return path;
+}
 
-        auto lowerArm = Point::divide(path.points[i + 1], path.points[i + 2], tB);
-        lowerArm.B.hasLeftHandle = false;
+Path tube::Path::miterRingJoin() & {
+    Path path = *this;
+    path.joinInPlace(JoinType::MITER_RING, 0.0f);
+    return path;
+}
 
-        auto tip = upperArm.C;
-        tip.hasRightHandle = false;
-        tip.hasLeftHandle = false;
-        // tip.pos = (upperArm.B.pos + lowerArm.B.pos) / 2.0f;
-
-        auto codirection = glm::dot(
-            glm::normalize(upperArm.B.pos - upperArm.A.pos),
-            glm::normalize(lowerArm.C.pos - lowerArm.B.pos)
-        );
-
-        auto tipDir = -glm::normalize(
-            (
-                glm::normalize(upperArm.A.pos - upperArm.B.pos) +
-                glm::normalize(lowerArm.C.pos - lowerArm.B.pos)
-            ) / 2.0f
-        );
-        tip.pos += tipDir * r;// * (2 - codirection);
-
-        std::cout << "CoDir: " << codirection << std::endl;
-        std::cout << "Half-Radius: " << r << std::endl;
-        std::cout << "Magic number: " << 1.4f << std::endl;
-
-        auto newPoints = std::vector<Point>({
-            upperArm.A, upperArm.B,
-            tip,
-            lowerArm.B, lowerArm.C
-        });
-
-        path.points.erase(path.points.begin() + i, path.points.begin() + i + 3);
-        path.points.insert(path.points.begin() + i, newPoints.begin(), newPoints.end());
-    }
+Path tube::Path::miterRingJoin() && {
+    auto path = std::move(*this);
+    path.joinInPlace(JoinType::MITER_RING, 0.0f);
     return path;
 }
 
@@ -412,7 +979,8 @@ float straightToRound(float t) {
     return sqrt(1 - t * t);
 }
 
-Path tube::Path::withRoundedCaps(float radius, int segments) {
+void tube::Path::roundedCapsInPlace(float radius, int segments) {
+    TUBE_STATS_STAGE(BuildStage::CAPS);
     // First curve divided at the beginning
     auto startDivided = Point::divide(this->points[0], this->points[1], 0.1f);
 
@@ -446,15 +1014,32 @@ Path tube::Path::withRoundedCaps(float radius, int segments) {
         end[i].tilt = endTilt;
     }
 
-    Path path = this->copy();
-    path.points[0].hasLeftHandle = false;
-    path.points.back().hasRightHandle = false;
-    path.points.insert(path.points.begin(), start.begin(), start.end());
-    path.points.insert(path.points.end(), end.begin(), end.end());
+    // Grow the points once and shift them behind the start cap
+    auto& points = this->points;
+    points[0].hasLeftHandle = false;
+    points.back().hasRightHandle = false;
+    size_t numPoints = points.size();
+    points.resize(numPoints + start.size() + end.size());
+    std::move_backward(points.begin(), points.begin() + numPoints, points.begin() + numPoints + start.size());
+    std::copy(start.begin(), start.end(), points.begin());
+    std::copy(end.begin(), end.end(), points.end() - end.size());
+    this->invalidate();
+}
+
+Path tube::Path::withRoundedCaps(float radius, int segments) & {
+    auto path = this->copy();
+    path.roundedCapsInPlace(radius, segments);
+    return path;
+}
+
+Path tube::Path::withRoundedCaps(float radius, int segments) && {
+    auto path = std::move(*this);
+    path.roundedCapsInPlace(radius, segments);
     return path;
 }
 
-Path tube::Path::withSquareCaps(float radius) {
+void tube::Path::squareCapsInPlace(float radius) {
+    TUBE_STATS_STAGE(BuildStage::CAPS);
     // First curve divided at the beginning
     auto startDivided = Point::divide(this->points[0], this->points[1], 0.1f);
 
@@ -480,54 +1065,72 @@ Path tube::Path::withSquareCaps(float radius) {
     end.radius = endRadius;
     end.tilt = endTilt;
 
-    Path path = this->copy();
-    path.points[0].hasLeftHandle = false;
-    path.points.back().hasRightHandle = false;
-    path.points.insert(path.points.begin(), start);
-    path.points.insert(path.points.end(), end);
+    auto& points = this->points;
+    points[0].hasLeftHandle = false;
+    points.back().hasRightHandle = false;
+    size_t numPoints = points.size();
+    points.resize(numPoints + 2);
+    std::move_backward(points.begin(), points.begin() + numPoints, points.begin() + numPoints + 1);
+    points.front() = start;
+    points.back() = end;
+    this->invalidate();
+}
+
+Path tube::Path::withSquareCaps(float radius) & {
+    auto path = this->copy();
+    path.squareCapsInPlace(radius);
+    return path;
+}
+
+Path tube::Path::withSquareCaps(float radius) && {
+    auto path = std::move(*this);
+    path.squareCapsInPlace(radius);
     return path;
 }
 
-Path tube::Path::toPoly(int segmentsPerCurve) {
+Path tube::Path::toPoly(Tessellation tessellation) {
+    TUBE_STATS_STAGE(BuildStage::TO_POLY);
     auto polypath = Path();
     polypath.closed = this->closed;
+    if (this->points.empty())
+        return polypath;
+
+    // Uniform tessellation knows its size up front, so the points are
+    // allocated once however long the path is
+    if (!tessellation.isAdaptive()) {
+        size_t numSegments = this->points.size() - (this->closed ? 0 : 1);
+        size_t numPoints = 1;
+        for (size_t i = 0; i < numSegments; i++) {
+            const auto& start = this->points[i];
+            const auto& end = this->points[(i + 1) % this->points.size()];
+            numPoints += numCurveSamples(start, end, tessellation.segmentsPerCurve) - 1;
+        }
+        polypath.points.reserve(numPoints);
+    }
 
-    for (size_t i = 0; i < this->points.size() - 1; i++) {
-        bool isStart = i == 0;
-
-        auto polycurve = Point::toPoly(this->points[i], this->points[i + 1LL], segmentsPerCurve);
+    // Curves share their end points, only the first one keeps its start.
+    // The scratch buffers are reused by every curve
+    std::pmr::vector<glm::vec3> verts;
+    std::pmr::vector<float> params;
+    for (size_t i = 0; i < this->points.size() - 1; i++)
+        appendPoly(this->points[i], this->points[i + 1LL], tessellation, polypath.points, i == 0, verts, params);
 
-        if (isStart)
-            // Add all points of the curve to the path. There are no duplicates
-            polypath.points.insert(polypath.points.end(),
-                polycurve.begin(), polycurve.end());
-        else
-            // Add points without duplicates. The first point of this curve
-            // is duplicate of the last point of the previous curve
-            polypath.points.insert(polypath.points.end(),
-                polycurve.begin() + 1, polycurve.end());
-    }
-    
     if (polypath.closed) {
         // Connect last point with first
-        auto polycurve = Point::toPoly(this->points[this->points.size() - 1], this->points[0], segmentsPerCurve);
-
-        // Add points without first because they are duplicate
-        // polypath.points.clear();
-        polypath.points.insert(polypath.points.end(),
-            polycurve.begin() + 1, polycurve.end());
+        appendPoly(this->points[this->points.size() - 1], this->points[0], tessellation, polypath.points, false,
+                   verts, params);
     }
     return polypath;
 }
 
 // The same as toPoly
-Shape tube::Path::toShape(int segmentsPerCurve) {
+Shape tube::Path::toShape(Tessellation tessellation) {
     auto shape = Shape();
     shape.closed = this->closed;
 
     for (size_t i = 0; i < this->points.size() - 1; i++) {
         bool isStart = i == 0;
-        auto curve = Point::toVectors(this->points[i], this->points[i + 1LL], segmentsPerCurve);
+        auto curve = Point::toVectors(this->points[i], this->points[i + 1LL], tessellation);
         if (isStart)
             shape.verts.insert(shape.verts.end(),
                 curve.begin(), curve.end());
@@ -537,7 +1140,7 @@ Shape tube::Path::toShape(int segmentsPerCurve) {
     }
 
     if (shape.closed) {
-        auto curve = Point::toVectors(this->points[this->points.size() - 1], this->points[0], segmentsPerCurve);
+        auto curve = Point::toVectors(this->points[this->points.size() - 1], this->points[0], tessellation);
         shape.verts.insert(shape.verts.end(),
             curve.begin() + 1, curve.end());
     }
@@ -547,124 +1150,260 @@ Shape tube::Path::toShape(int segmentsPerCurve) {
 float tube::Path::length() {
     if (this->points.size() < 2)
         return 0;
-
-    glm::vec3 previousPos = this->points[0].pos;
-    float len = 0;
-    if(this->hasNonPoly()) {
-        auto path = this->toPoly();
-        for (int i = 1; i < path.points.size(); i++) {
-            len += glm::length(path.points[i].pos - previousPos);
-            previousPos = path.points[i].pos;
-        }
-    }
-    else {
-        for (int i = 1; i < this->points.size(); i++) {
-            len += glm::length(this->points[i].pos - previousPos);
-            previousPos = this->points[i].pos;
-        }
-    }
-    return len;
+    return this->arcLengths().length();
 }
 
 Builder::Builder(std::vector<Path> pathes, Shape shape)
-    : pathes(pathes), shape(shape)
+    : shape(std::move(shape)), mPathes(std::move(pathes))
 {
 }
 
 
 Builder::Builder(std::vector<Path> pathes)
-    : pathes(pathes)
+    : mPathes(std::move(pathes))
 {
 }
 
 Builder::Builder(Path path)
-    : pathes({ path })
 {
+    this->mPathes.push_back(std::move(path));
 }
 
 Builder::Builder(Shape shape)
-    : shape(shape)
+    : shape(std::move(shape))
 {
 }
 
-Builder Builder::withShape(Shape s) {
-    return Builder(this->pathes, s);
+Builder Builder::withShape(Shape s) & {
+    return this->copy().withShape(std::move(s));
 }
 
-Builder tube::Builder::bevelJoin(float radius) {
-    auto builder = Builder(this->shape);
-    builder.pathes.resize(this->pathes.size());
-    for (int i = 0; i < this->pathes.size(); i++)
-        builder.pathes[i] = this->pathes[i].bevelJoin(radius);
-    return builder;
+Builder Builder::withShape(Shape s) && {
+    this->shape = std::move(s);
+    return std::move(*this);
 }
 
-Builder tube::Builder::roundJoin(float radius) {
-    auto builder = Builder(this->shape);
-    builder.pathes.resize(this->pathes.size());
-    for (int i = 0; i < this->pathes.size(); i++)
-        builder.pathes[i] = this->pathes[i].roundJoin(radius);
-    return builder;
+Builder Builder::withTessellation(Tessellation t) & {
+    return this->copy().withTessellation(t);
 }
 
-Builder tube::Builder::miterJoin(float radius)
-{
-    auto builder = Builder(this->shape);
-    builder.pathes.resize(this->pathes.size());
-    for (int i = 0; i < this->pathes.size(); i++)
-        builder.pathes[i] = this->pathes[i].miterJoin(radius);
-    return builder;
+Builder Builder::withTessellation(Tessellation t) && {
+    this->tessellation = t;
+    return std::move(*this);
 }
 
+Builder Builder::withThreads(unsigned int numThreads) & {
+    return this->copy().withThreads(numThreads);
+}
 
-Builder tube::Builder::withRoundedCaps(float radius, int segments) {
-    auto builder = Builder(this->shape);
-    builder.pathes.resize(this->pathes.size());
-    for (int i = 0; i < this->pathes.size(); i++)
-        builder.pathes[i] = this->pathes[i].withRoundedCaps(radius, segments);
-    return builder;
+Builder Builder::withThreads(unsigned int numThreads) && {
+    this->threads = numThreads;
+    return std::move(*this);
 }
 
-Builder tube::Builder::withSquareCaps(float radius) {
-    auto builder = Builder(this->shape);
-    builder.pathes.resize(this->pathes.size());
-    for (int i = 0; i < this->pathes.size(); i++)
-        builder.pathes[i] = this->pathes[i].withSquareCaps(radius);
-    return builder;
+Builder Builder::withLayout(VertexLayout l) & {
+    return this->copy().withLayout(l);
 }
 
-Builder tube::Builder::evenlyDistributed(float len) {
-    auto builder = Builder(this->shape);
-    builder.pathes.resize(this->pathes.size());
-    for (int i = 0; i < this->pathes.size(); i++)
-        builder.pathes[i] = this->pathes[i].evenlyDistributed(len);
-    return builder;
+Builder Builder::withLayout(VertexLayout l) && {
+    this->layout = l;
+    return std::move(*this);
 }
 
-Builder tube::Builder::toPoly() {
-    auto builder = Builder(this->shape);
-    builder.pathes.resize(this->pathes.size());
-    for (int i = 0; i < this->pathes.size(); i++)
-        builder.pathes[i] = this->pathes[i].toPoly();
-    return builder;
+Builder Builder::withNormals(TubeNormals n) & {
+    return this->copy().withNormals(n);
+}
+
+Builder Builder::withNormals(TubeNormals n) && {
+    this->normals = n;
+    return std::move(*this);
+}
+
+Builder Builder::withArena(Arena* a) & {
+    return this->copy().withArena(a);
+}
+
+Builder Builder::withArena(Arena* a) && {
+    this->arena = a;
+    return std::move(*this);
 }
 
-Builder Builder::dash(float dashLength, float gapLength, float offset) {
-    auto builder = Builder(this->shape);
-    for (int i = 0; i < this->pathes.size(); i++) {
-        std::vector<Path> dashPathes = this->pathes[i].dash(dashLength, gapLength, offset);
-        builder.pathes.insert(builder.pathes.end(), dashPathes.begin(), dashPathes.end());
+Builder Builder::withVertexCacheOptimization(size_t cacheSize) & {
+    return this->copy().withVertexCacheOptimization(cacheSize);
+}
+
+Builder Builder::withVertexCacheOptimization(size_t cacheSize) && {
+    this->vertexCacheSize = cacheSize;
+    return std::move(*this);
+}
+
+Builder Builder::withStats(BuildStats* s) & {
+    return this->copy().withStats(s);
+}
+
+Builder Builder::withStats(BuildStats* s) && {
+    this->stats = s;
+    return std::move(*this);
+}
+
+Builder Builder::then(BuilderStage stage) & {
+    return this->copy().then(std::move(stage));
+}
+
+Builder Builder::then(BuilderStage stage) && {
+    this->mStages.push_back(std::move(stage));
+    return std::move(*this);
+}
+
+// Steps that replace every path with the result of a Path operation
+#define TUBE_BUILDER_STEP(name, params, args) \
+    Builder Builder::name params & { \
+        return this->copy().name args; \
+    } \
+    Builder Builder::name params && { \
+        return std::move(*this).then([=](std::vector<Path>& pathes) { \
+            for (auto& path : pathes) \
+                path = std::move(path).name args; \
+        }); \
     }
-    return builder;
+
+TUBE_BUILDER_STEP(bevelJoin, (float radius), (radius))
+TUBE_BUILDER_STEP(roundJoin, (float radius), (radius))
+TUBE_BUILDER_STEP(miterJoin, (float radius), (radius))
+TUBE_BUILDER_STEP(miterRingJoin, (), ())
+TUBE_BUILDER_STEP(withRoundedCaps, (float radius, int segments), (radius, segments))
+TUBE_BUILDER_STEP(withSquareCaps, (float radius), (radius))
+TUBE_BUILDER_STEP(evenlyDistributed, (float len), (len))
+
+Builder Builder::toPoly() & {
+    return this->copy().toPoly();
+}
+
+Builder Builder::toPoly() && {
+    // Tessellate with the settings of the time of the call
+    Tessellation t = this->tessellation;
+    return std::move(*this).then([t](std::vector<Path>& pathes) {
+        for (auto& path : pathes)
+            path = path.toPoly(t);
+    });
+}
+
+Builder Builder::dash(float dashLength, float gapLength, float offset) & {
+    return this->copy().dash(dashLength, gapLength, offset);
+}
+
+Builder Builder::dash(float dashLength, float gapLength, float offset) && {
+    return std::move(*this).dash(std::vector<float>({ dashLength, gapLength }), offset);
+}
+
+Builder Builder::dash(const std::vector<float>& pattern, float offset) & {
+    return this->copy().dash(pattern, offset);
+}
+
+Builder Builder::dash(const std::vector<float>& pattern, float offset) && {
+    return std::move(*this).then([pattern, offset](std::vector<Path>& pathes) {
+        auto dashes = std::vector<Path>();
+        for (auto& path : pathes)
+            path.dash(pattern, offset, dashes);
+        pathes = std::move(dashes);
+    });
 }
 
 Builder tube::Builder::copy() {
-    return Builder(this->pathes, this->shape);
+    auto builder = Builder(this->mPathes, this->shape);
+    builder.tessellation = this->tessellation;
+    builder.threads = this->threads;
+    builder.layout = this->layout;
+    builder.normals = this->normals;
+    builder.arena = this->arena;
+    builder.vertexCacheSize = this->vertexCacheSize;
+    builder.stats = this->stats;
+    builder.mStages = this->mStages;
+    return builder;
+}
+
+std::vector<Path> tube::Builder::runStages(Path path) const {
+    auto pathes = std::vector<Path>();
+    pathes.push_back(std::move(path));
+    for (const auto& stage : this->mStages)
+        stage(pathes);
+    return pathes;
+}
+
+Tube tube::Builder::finish(Tube tube) const {
+    if (this->vertexCacheSize > 0)
+        tube.reorderForVertexCache(this->vertexCacheSize);
+    return tube;
+}
+
+Tube tube::Builder::apply() & {
+    StatsRecording recording(this->stats);
+    if (this->mStages.empty())
+        return finish(Tube(this->mPathes, this->shape, this->tessellation, this->threads, this->layout,
+                           this->normals, this->arena));
+
+    auto source = [this](size_t i, const std::function<void(const Path&)>& sink) {
+        for (const auto& path : this->runStages(this->mPathes[i]))
+            sink(path);
+    };
+    return finish(Tube(this->mPathes.size(), source, this->shape, this->tessellation, this->threads, this->layout,
+                       this->normals, this->arena));
+}
+
+Tube tube::Builder::apply() && {
+    StatsRecording recording(this->stats);
+    if (this->mStages.empty())
+        return finish(Tube(std::move(this->mPathes), this->shape, this->tessellation, this->threads, this->layout,
+                           this->normals, this->arena));
+
+    auto source = [this](size_t i, const std::function<void(const Path&)>& sink) {
+        for (const auto& path : this->runStages(std::move(this->mPathes[i])))
+            sink(path);
+        this->mPathes[i] = Path();
+    };
+    return finish(Tube(this->mPathes.size(), source, this->shape, this->tessellation, this->threads, this->layout,
+                       this->normals, this->arena));
+}
+
+InstancedTube tube::Builder::applyInstanced() & {
+    StatsRecording recording(this->stats);
+    auto source = [this](size_t i, const std::function<void(const Path&)>& sink) {
+        if (this->mStages.empty()) {
+            sink(this->mPathes[i]);
+            return;
+        }
+        for (const auto& path : this->runStages(this->mPathes[i]))
+            sink(path);
+    };
+    return InstancedTube(this->mPathes.size(), source, this->shape, this->tessellation, this->threads,
+                         this->normals, this->arena);
 }
 
-Tube tube::Builder::apply() {
-    std::vector<Tube> tubes;
-    for (auto path : this->pathes)
-        tubes.push_back(Tube(path, this->shape));
-    return Tube(tubes);
+InstancedTube tube::Builder::applyInstanced() && {
+    StatsRecording recording(this->stats);
+    auto source = [this](size_t i, const std::function<void(const Path&)>& sink) {
+        for (const auto& path : this->runStages(std::move(this->mPathes[i])))
+            sink(path);
+        this->mPathes[i] = Path();
+    };
+    return InstancedTube(this->mPathes.size(), source, this->shape, this->tessellation, this->threads,
+                         this->normals, this->arena);
+}
+
+const std::vector<Path>& tube::Builder::pathes() const {
+    return this->mPathes;
+}
+
+std::vector<Path> tube::Builder::result() & {
+    return this->copy().result();
+}
+
+std::vector<Path> tube::Builder::result() && {
+    auto result = std::vector<Path>();
+    for (auto& path : this->mPathes) {
+        auto pathes = this->runStages(std::move(path));
+        result.insert(result.end(), std::make_move_iterator(pathes.begin()), std::make_move_iterator(pathes.end()));
+    }
+    this->mPathes.clear();
+    return result;
 }
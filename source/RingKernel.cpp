@@ -0,0 +1,188 @@
+#include "RingKernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TUBE_RING_KERNEL_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TUBE_TARGET(isa) __attribute__((target(isa)))
+#else
+#define TUBE_TARGET(isa)
+#endif
+
+using namespace tube;
+
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "Rings are written as packed floats");
+
+ShapeSoA::ShapeSoA(const std::vector<glm::vec3>& verts)
+	: x(verts.size()), y(verts.size()), z(verts.size())
+{
+	for (size_t i = 0; i < verts.size(); i++) {
+		x[i] = verts[i].x;
+		y[i] = verts[i].y;
+		z[i] = verts[i].z;
+	}
+}
+
+size_t ShapeSoA::size() const {
+	return x.size();
+}
+
+namespace {
+
+void transformScalar(const RingTransform& t, const float* x, const float* y, const float* z,
+	size_t begin, size_t end, glm::vec3* out)
+{
+	for (size_t i = begin; i < end; i++)
+		out[i] = t.origin + t.axisX * x[i] + t.axisY * y[i] + t.axisZ * z[i];
+}
+
+#ifdef TUBE_RING_KERNEL_X86
+
+// Interleave x, y and z of four vertices into twelve packed floats. A
+// macro rather than a function so it compiles with the ISA of the kernel
+// using it and AVX code never calls into legacy SSE code.
+#define TUBE_STORE_XYZ(out, x, y, z) do { \
+		__m128 xy01 = _mm_unpacklo_ps(x, y);                             /* x0 y0 x1 y1 */ \
+		__m128 xy23 = _mm_unpackhi_ps(x, y);                             /* x2 y2 x3 y3 */ \
+		__m128 z0x1 = _mm_shuffle_ps(z, xy01, _MM_SHUFFLE(2, 2, 0, 0));  /* z0 z0 x1 x1 */ \
+		__m128 y1z1 = _mm_shuffle_ps(xy01, z, _MM_SHUFFLE(1, 1, 3, 3));  /* y1 y1 z1 z1 */ \
+		__m128 z2x3 = _mm_shuffle_ps(z, xy23, _MM_SHUFFLE(2, 2, 2, 2));  /* z2 z2 x3 x3 */ \
+		__m128 y3z3 = _mm_shuffle_ps(xy23, z, _MM_SHUFFLE(3, 3, 3, 3));  /* y3 y3 z3 z3 */ \
+		_mm_storeu_ps((out),     _mm_shuffle_ps(xy01, z0x1, _MM_SHUFFLE(2, 0, 1, 0)));  /* x0 y0 z0 x1 */ \
+		_mm_storeu_ps((out) + 4, _mm_shuffle_ps(y1z1, xy23, _MM_SHUFFLE(1, 0, 2, 0)));  /* y1 z1 x2 y2 */ \
+		_mm_storeu_ps((out) + 8, _mm_shuffle_ps(z2x3, y3z3, _MM_SHUFFLE(2, 0, 2, 0)));  /* z2 x3 y3 z3 */ \
+	} while (0)
+
+TUBE_TARGET("sse2")
+void transformSSE(const RingTransform& t, const ShapeSoA& shape, glm::vec3* out) {
+	const float* x = shape.x.data();
+	const float* y = shape.y.data();
+	const float* z = shape.z.data();
+	size_t count = shape.size();
+
+	__m128 ox = _mm_set1_ps(t.origin.x), oy = _mm_set1_ps(t.origin.y), oz = _mm_set1_ps(t.origin.z);
+	__m128 xx = _mm_set1_ps(t.axisX.x), xy = _mm_set1_ps(t.axisX.y), xz = _mm_set1_ps(t.axisX.z);
+	__m128 yx = _mm_set1_ps(t.axisY.x), yy = _mm_set1_ps(t.axisY.y), yz = _mm_set1_ps(t.axisY.z);
+	__m128 zx = _mm_set1_ps(t.axisZ.x), zy = _mm_set1_ps(t.axisZ.y), zz = _mm_set1_ps(t.axisZ.z);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 vx = _mm_loadu_ps(x + i);
+		__m128 vy = _mm_loadu_ps(y + i);
+		__m128 vz = _mm_loadu_ps(z + i);
+		// Same evaluation order as the scalar kernel
+		__m128 rx = _mm_add_ps(_mm_add_ps(_mm_add_ps(ox, _mm_mul_ps(xx, vx)), _mm_mul_ps(yx, vy)), _mm_mul_ps(zx, vz));
+		__m128 ry = _mm_add_ps(_mm_add_ps(_mm_add_ps(oy, _mm_mul_ps(xy, vx)), _mm_mul_ps(yy, vy)), _mm_mul_ps(zy, vz));
+		__m128 rz = _mm_add_ps(_mm_add_ps(_mm_add_ps(oz, _mm_mul_ps(xz, vx)), _mm_mul_ps(yz, vy)), _mm_mul_ps(zz, vz));
+		TUBE_STORE_XYZ(&out[i].x, rx, ry, rz);
+	}
+	transformScalar(t, x, y, z, i, count, out);
+}
+
+TUBE_TARGET("avx")
+void transformAVX(const RingTransform& t, const ShapeSoA& shape, glm::vec3* out) {
+	const float* x = shape.x.data();
+	const float* y = shape.y.data();
+	const float* z = shape.z.data();
+	size_t count = shape.size();
+
+	__m256 ox = _mm256_set1_ps(t.origin.x), oy = _mm256_set1_ps(t.origin.y), oz = _mm256_set1_ps(t.origin.z);
+	__m256 xx = _mm256_set1_ps(t.axisX.x), xy = _mm256_set1_ps(t.axisX.y), xz = _mm256_set1_ps(t.axisX.z);
+	__m256 yx = _mm256_set1_ps(t.axisY.x), yy = _mm256_set1_ps(t.axisY.y), yz = _mm256_set1_ps(t.axisY.z);
+	__m256 zx = _mm256_set1_ps(t.axisZ.x), zy = _mm256_set1_ps(t.axisZ.y), zz = _mm256_set1_ps(t.axisZ.z);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 vx = _mm256_loadu_ps(x + i);
+		__m256 vy = _mm256_loadu_ps(y + i);
+		__m256 vz = _mm256_loadu_ps(z + i);
+		__m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(ox, _mm256_mul_ps(xx, vx)), _mm256_mul_ps(yx, vy)), _mm256_mul_ps(zx, vz));
+		__m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(oy, _mm256_mul_ps(xy, vx)), _mm256_mul_ps(yy, vy)), _mm256_mul_ps(zy, vz));
+		__m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(oz, _mm256_mul_ps(xz, vx)), _mm256_mul_ps(yz, vy)), _mm256_mul_ps(zz, vz));
+		__m128 lowX = _mm256_castps256_ps128(rx);
+		__m128 lowY = _mm256_castps256_ps128(ry);
+		__m128 lowZ = _mm256_castps256_ps128(rz);
+		__m128 highX = _mm256_extractf128_ps(rx, 1);
+		__m128 highY = _mm256_extractf128_ps(ry, 1);
+		__m128 highZ = _mm256_extractf128_ps(rz, 1);
+		TUBE_STORE_XYZ(&out[i].x, lowX, lowY, lowZ);
+		TUBE_STORE_XYZ(&out[i + 4].x, highX, highY, highZ);
+	}
+	_mm256_zeroupper();
+	transformScalar(t, x, y, z, i, count, out);
+}
+
+bool cpuHasAVX() {
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 1);
+	bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+	return osSavesYmm && (info[2] & (1 << 28));
+#else
+	return __builtin_cpu_supports("avx");
+#endif
+}
+
+bool cpuHasSSE2() {
+#if defined(__x86_64__) || defined(_M_X64)
+	return true;
+#elif defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[3] & (1 << 26)) != 0;
+#else
+	return __builtin_cpu_supports("sse2");
+#endif
+}
+
+#endif
+
+}
+
+bool tube::isRingKernelSupported(RingKernel kernel) {
+	switch (kernel) {
+#ifdef TUBE_RING_KERNEL_X86
+	case RingKernel::AVX:
+		return cpuHasAVX();
+	case RingKernel::SSE:
+		return cpuHasSSE2();
+#endif
+	case RingKernel::SCALAR:
+		return true;
+	default:
+		return false;
+	}
+}
+
+RingKernel tube::bestRingKernel() {
+	static const RingKernel best =
+		isRingKernelSupported(RingKernel::AVX) ? RingKernel::AVX :
+		isRingKernelSupported(RingKernel::SSE) ? RingKernel::SSE :
+		RingKernel::SCALAR;
+	return best;
+}
+
+void tube::transformRing(const RingTransform& transform, const ShapeSoA& shape, glm::vec3* out) {
+	transformRing(bestRingKernel(), transform, shape, out);
+}
+
+void tube::transformRing(RingKernel kernel, const RingTransform& transform, const ShapeSoA& shape, glm::vec3* out) {
+	switch (kernel) {
+#ifdef TUBE_RING_KERNEL_X86
+	case RingKernel::AVX:
+		transformAVX(transform, shape, out);
+		return;
+	case RingKernel::SSE:
+		transformSSE(transform, shape, out);
+		return;
+#endif
+	default:
+		transformScalar(transform, shape.x.data(), shape.y.data(), shape.z.data(), 0, shape.size(), out);
+		return;
+	}
+}
@@ -0,0 +1,317 @@
+#include "Stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+using namespace tube;
+
+namespace {
+
+const char* STAGE_NAMES[NUM_BUILD_STAGES] = {
+	"to_poly", "joins", "caps", "dash", "resample", "frames", "sweep", "fill_caps", "normals", "merge",
+	"vertex_cache"
+};
+
+}
+
+const char* tube::buildStageName(BuildStage stage) {
+	return STAGE_NAMES[(size_t)stage];
+}
+
+const StageStats& BuildStats::stage(BuildStage stage) const {
+	return this->stages[(size_t)stage];
+}
+
+std::string BuildStats::toChromeTrace() const {
+	std::string json = "{\"traceEvents\":[";
+	char line[256];
+	bool first = true;
+	for (const auto& event : this->events) {
+		std::snprintf(line, sizeof(line),
+			"%s\n{\"name\":\"%s\",\"cat\":\"tube\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+			first ? "" : ",", buildStageName(event.stage), event.thread, event.start, event.duration);
+		json += line;
+		first = false;
+	}
+	// Counters at the end of the recording
+	std::snprintf(line, sizeof(line),
+		"%s\n{\"name\":\"build\",\"cat\":\"tube\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":%.3f,\"args\":{"
+		"\"points\":%zu,\"rings\":%zu,\"triangles\":%zu,\"allocations\":%zu,\"peak_bytes\":%zu}}",
+		first ? "" : ",", this->seconds * 1e6, this->numPoints, this->numRings, this->numTriangles,
+		this->numAllocations, this->peakBytes);
+	json += line;
+	json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+	return json;
+}
+
+#ifdef TUBE_STATS
+
+// Every allocation of the process goes through the replacements below.
+// Sizes are kept in front of every block so freeing can count them
+namespace {
+
+std::atomic<size_t> numHeapAllocations{ 0 };
+std::atomic<size_t> heapBytes{ 0 };
+
+// Every active recording keeps its own high-water mark of heapBytes in a
+// slot, so nested and concurrent recordings do not reset each other.
+// Allocations only walk the slots of the mask, none without recordings
+const int NUM_PEAK_SLOTS = 64;
+std::atomic<uint64_t> activePeakSlots{ 0 };
+std::atomic<size_t> peakSlots[NUM_PEAK_SLOTS];
+
+int claimPeakSlot(size_t bytes) {
+	uint64_t active = activePeakSlots.load(std::memory_order_relaxed);
+	while (active != ~(uint64_t)0) {
+		int slot = 0;
+		while (active & ((uint64_t)1 << slot))
+			slot++;
+		peakSlots[slot].store(bytes, std::memory_order_relaxed);
+		if (activePeakSlots.compare_exchange_weak(active, active | ((uint64_t)1 << slot), std::memory_order_acq_rel))
+			return slot;
+	}
+	// Too many recordings at once, this one only sees its end
+	return -1;
+}
+
+void raisePeaks(size_t bytes) {
+	uint64_t active = activePeakSlots.load(std::memory_order_acquire);
+	for (int slot = 0; active != 0; slot++, active >>= 1) {
+		if ((active & 1) == 0)
+			continue;
+		size_t peak = peakSlots[slot].load(std::memory_order_relaxed);
+		while (bytes > peak && !peakSlots[slot].compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {
+		}
+	}
+}
+
+// Space in front of a block holding its size, keeps the block aligned
+const size_t HEADER_SIZE = alignof(std::max_align_t);
+
+thread_local StatsRecording* currentRecording = nullptr;
+std::atomic<unsigned int> numThreads{ 0 };
+thread_local unsigned int threadNumber = numThreads.fetch_add(1);
+
+void countAllocation(size_t size) {
+	numHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	size_t bytes = heapBytes.fetch_add(size, std::memory_order_relaxed) + size;
+	raisePeaks(bytes);
+}
+
+// MSVC has no std::aligned_alloc, its aligned blocks need their own free
+void* allocateBlock(size_t total, size_t alignment) {
+	if (alignment <= alignof(std::max_align_t))
+		return std::malloc(total);
+#ifdef _WIN32
+	return _aligned_malloc(total, alignment);
+#else
+	return std::aligned_alloc(alignment, total);
+#endif
+}
+
+void freeBlock(void* block, size_t alignment) {
+#ifdef _WIN32
+	if (alignment > alignof(std::max_align_t)) {
+		_aligned_free(block);
+		return;
+	}
+#else
+	(void)alignment;
+#endif
+	std::free(block);
+}
+
+void* allocate(size_t size, size_t alignment) {
+	size_t header = std::max(HEADER_SIZE, alignment);
+	size_t total = (header + std::max(size, (size_t)1) + alignment - 1) / alignment * alignment;
+	void* block = allocateBlock(total, alignment);
+	if (block == nullptr)
+		return nullptr;
+	unsigned char* p = static_cast<unsigned char*>(block) + header;
+	reinterpret_cast<size_t*>(p)[-1] = size;
+	countAllocation(size);
+	return p;
+}
+
+void release(void* p, size_t alignment) {
+	if (p == nullptr)
+		return;
+	size_t size = reinterpret_cast<size_t*>(p)[-1];
+	heapBytes.fetch_sub(size, std::memory_order_relaxed);
+	freeBlock(static_cast<unsigned char*>(p) - std::max(HEADER_SIZE, alignment), alignment);
+}
+
+void* allocateOrThrow(size_t size, size_t alignment) {
+	void* p = allocate(size, alignment);
+	if (p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+}
+
+void* operator new(size_t size) {
+	return allocateOrThrow(size, alignof(std::max_align_t));
+}
+
+void* operator new[](size_t size) {
+	return allocateOrThrow(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+	return allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+	return allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+	return allocateOrThrow(size, std::max((size_t)alignment, alignof(std::max_align_t)));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+	return allocateOrThrow(size, std::max((size_t)alignment, alignof(std::max_align_t)));
+}
+
+void operator delete(void* p) noexcept {
+	release(p, alignof(std::max_align_t));
+}
+
+void operator delete[](void* p) noexcept {
+	release(p, alignof(std::max_align_t));
+}
+
+void operator delete(void* p, size_t) noexcept {
+	release(p, alignof(std::max_align_t));
+}
+
+void operator delete[](void* p, size_t) noexcept {
+	release(p, alignof(std::max_align_t));
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+	release(p, alignof(std::max_align_t));
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+	release(p, alignof(std::max_align_t));
+}
+
+void operator delete(void* p, std::align_val_t alignment) noexcept {
+	release(p, std::max((size_t)alignment, alignof(std::max_align_t)));
+}
+
+void operator delete[](void* p, std::align_val_t alignment) noexcept {
+	release(p, std::max((size_t)alignment, alignof(std::max_align_t)));
+}
+
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept {
+	release(p, std::max((size_t)alignment, alignof(std::max_align_t)));
+}
+
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept {
+	release(p, std::max((size_t)alignment, alignof(std::max_align_t)));
+}
+
+size_t tube::heapAllocationCount() {
+	return numHeapAllocations.load(std::memory_order_relaxed);
+}
+
+StatsRecording::StatsRecording(BuildStats* stats): mStats(stats) {
+	if (this->mStats == nullptr)
+		return;
+	*this->mStats = BuildStats();
+	this->mStats->events.reserve(256);
+	this->mPrevious = currentRecording;
+	currentRecording = this;
+	this->mStartAllocations = heapAllocationCount();
+	this->mStartBytes = heapBytes.load(std::memory_order_relaxed);
+	this->mPeakSlot = claimPeakSlot(this->mStartBytes);
+	this->mStart = std::chrono::steady_clock::now();
+}
+
+StatsRecording::~StatsRecording() {
+	if (this->mStats == nullptr)
+		return;
+	auto end = std::chrono::steady_clock::now();
+	currentRecording = this->mPrevious;
+	this->mStats->seconds = std::chrono::duration<double>(end - this->mStart).count();
+	this->mStats->numAllocations = heapAllocationCount() - this->mStartAllocations;
+	size_t peak = heapBytes.load(std::memory_order_relaxed);
+	if (this->mPeakSlot >= 0) {
+		peak = std::max(peak, peakSlots[this->mPeakSlot].load(std::memory_order_relaxed));
+		activePeakSlots.fetch_and(~((uint64_t)1 << this->mPeakSlot), std::memory_order_release);
+	}
+	this->mStats->peakBytes = peak > this->mStartBytes ? peak - this->mStartBytes : 0;
+}
+
+StatsRecording* StatsRecording::current() {
+	return currentRecording;
+}
+
+StageTimer::StageTimer(BuildStage stage)
+	: mRecording(currentRecording), mStage(stage)
+{
+	if (this->mRecording != nullptr)
+		this->mStart = std::chrono::steady_clock::now();
+}
+
+StageTimer::~StageTimer() {
+	if (this->mRecording == nullptr)
+		return;
+	auto end = std::chrono::steady_clock::now();
+	StageEvent event;
+	event.stage = this->mStage;
+	event.thread = threadNumber;
+	event.start = std::chrono::duration<double, std::micro>(this->mStart - this->mRecording->mStart).count();
+	event.duration = std::chrono::duration<double, std::micro>(end - this->mStart).count();
+
+	std::lock_guard<std::mutex> lock(this->mRecording->mMutex);
+	BuildStats* stats = this->mRecording->mStats;
+	auto& stage = stats->stages[(size_t)this->mStage];
+	stage.seconds += event.duration * 1e-6;
+	stage.calls++;
+	stats->events.push_back(event);
+}
+
+StatsBinding::StatsBinding(StatsRecording* recording): mPrevious(currentRecording) {
+	currentRecording = recording;
+}
+
+StatsBinding::~StatsBinding() {
+	currentRecording = this->mPrevious;
+}
+
+void tube::countStat(size_t BuildStats::* counter, size_t count) {
+	StatsRecording* recording = currentRecording;
+	if (recording == nullptr)
+		return;
+	std::lock_guard<std::mutex> lock(recording->mMutex);
+	recording->mStats->*counter += count;
+}
+
+#else
+
+StatsRecording::StatsRecording(BuildStats* stats): mStats(stats) {
+	if (this->mStats != nullptr)
+		*this->mStats = BuildStats();
+}
+
+StatsRecording::~StatsRecording() {
+}
+
+StatsRecording* StatsRecording::current() {
+	return nullptr;
+}
+
+#endif
@@ -1,47 +1,22 @@
 #include "Tube.h"
+#include "EarCut.h"
+#include "Parallel.h"
+#include "Stats.h"
 
-#include <glm/gtc/matrix_transform.hpp>
-#include <glm/gtc/quaternion.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
 
 using namespace tube;
 
-void Tube::extrude(std::vector<glm::vec3> verts, bool shapeClosed) {
-	this->vertices.insert(this->vertices.end(), verts.begin(), verts.end());
-
-	if (mIsFirst) {
-		mIsFirst = false;
-		return;
-	}
-
-	int firstPart  = (int)this->vertices.size() - (int)verts.size() * 2;
-	int secondPart = (int)this->vertices.size() - (int)verts.size();
-
-	for (int edge = 0; edge < (int)verts.size() - 1; edge++) {
-		bridge(
-			firstPart + edge,
-			firstPart + edge + 1,
-			secondPart + edge,
-			secondPart + edge + 1
-		);
-	}
-	/*
-	if (shapeClosed) {
-		int lastVertex = (int)verts.size() - 1;
-		bridge(
-			firstPart + lastVertex,
-			firstPart,
-			secondPart + lastVertex,
-			secondPart
-		);
-	}
-	*/
-}
-
 void Tube::bridge(int a1, int a2, int b1, int b2) {
-	auto tris = std::vector<int>({
-		b1, a1, a2, a2, b2, b1
-	});
-	this->indices.insert(this->indices.begin(), tris.begin(), tris.end());
+	this->indices.push_back(b1);
+	this->indices.push_back(a1);
+	this->indices.push_back(a2);
+	this->indices.push_back(a2);
+	this->indices.push_back(b2);
+	this->indices.push_back(b1);
 }
 
 void Tube::connectStartWithEnd(int shapeNumVertices) {
@@ -60,8 +35,11 @@ void Tube::connectStartWithEnd(int shapeNumVertices) {
 
 void Tube::triangleFan(int offset, int shapeVerts, int tipIndex) {
 	size_t amount = (size_t)shapeVerts * 3;
+	TUBE_STATS_COUNT(numTriangles, (size_t)shapeVerts);
 
-	auto tris = std::vector<int>(amount);
+	size_t start = this->indices.size();
+	this->indices.resize(start + amount);
+	int* tris = this->indices.data() + start;
 
 	int k = 0;
 	for (size_t i = 0; i < amount - 3; i += 3) {
@@ -83,7 +61,34 @@ void Tube::triangleFan(int offset, int shapeVerts, int tipIndex) {
 			k++;
 		}
 	}
-	this->indices.insert(this->indices.end(), tris.begin(), tris.end());
+}
+
+void Tube::capRing(int offset, int neighbour, const std::vector<int>& triangles) {
+	TUBE_STATS_COUNT(numTriangles, triangles.size() / 3);
+	const glm::vec3* ring = this->vertices.data() + offset;
+	// Rings may be mirrored, so compare the side the triangles face with
+	// the direction away from the neighbouring ring
+	auto facing = glm::vec3(0.0f);
+	for (size_t i = 0; i < triangles.size(); i += 3) {
+		glm::vec3 a = ring[triangles[i]];
+		facing += glm::cross(ring[triangles[i + 1]] - a, ring[triangles[i + 2]] - a);
+	}
+	glm::vec3 away = getCentroidOfShape(offset, mShapeNumVerts) - getCentroidOfShape(neighbour, mShapeNumVerts);
+	bool flip = glm::dot(facing, away) < 0.0f;
+
+	size_t start = this->indices.size();
+	this->indices.resize(start + triangles.size());
+	int* tris = this->indices.data() + start;
+	for (size_t i = 0; i < triangles.size(); i += 3) {
+		tris[i] = offset + triangles[i];
+		tris[i + 1] = offset + triangles[flip ? i + 2 : i + 1];
+		tris[i + 2] = offset + triangles[flip ? i + 1 : i + 2];
+	}
+}
+
+static glm::vec3 safeNormalize(glm::vec3 v) {
+	float len = glm::length(v);
+	return len > 0.0f ? v / len : glm::vec3(0.0f);
 }
 
 glm::vec3 Tube::getCentroidOfShape(int offset, int shapeVerts) {
@@ -93,80 +98,443 @@ glm::vec3 Tube::getCentroidOfShape(int offset, int shapeVerts) {
 	return sum / (float)shapeVerts;
 }
 
-// #include <iostream>
+void Tube::toSweepPoints(const Path& path, Tessellation tessellation, std::pmr::vector<Point>& out) {
+	const auto& points = path.points;
+	size_t n = points.size();
+	if (n == 0)
+		return;
 
-Tube::Tube(Path path, Shape& shape) {
-	if (path.hasNonPoly())
-		path = path.toPoly();
-	else if(path.closed)
-		path = path.close();
+	TUBE_STATS_STAGE(BuildStage::TO_POLY);
+	TUBE_STATS_COUNT(numPoints, n);
+	if (!path.hasNonPoly()) {
+		out.reserve(n + (path.closed ? 1 : 0));
+		out.assign(points.begin(), points.end());
+		if (path.closed) {
+			// End where the path starts, like Path::close()
+			auto end = Point(points[0].pos);
+			end.radius = points[0].radius;
+			end.tilt = points[0].tilt;
+			out.push_back(end);
+		}
+		return;
+	}
 
-	// Need for generating texture coordinates
+	// Curves share their end points, so only the first one keeps its start
+	for (size_t i = 0; i + 1 < n; i++)
+		Point::toPoly(points[i], points[i + 1], tessellation, out, i == 0);
+	if (path.closed)
+		Point::toPoly(points[n - 1], points[0], tessellation, out, false);
+}
 
-	float pathLength = path.length();
-	float curLength = 0.0f;
+Tube::SweepPolylines::SweepPolylines(std::pmr::memory_resource* memory)
+	: bySource(memory), closedBySource(memory), polylines(memory), closed(memory)
+{
+}
 
-	for (size_t i = 0; i < path.points.size(); i++) {
-		bool isStart = i == 0;
-		bool isEnd = i == path.points.size() - 1;
+Tube::SweepPolylines Tube::toSweepPolylines(size_t numSources, const PathSource& source,
+	Tessellation tessellation, unsigned int numThreads, std::pmr::memory_resource* memory)
+{
+	SweepPolylines out(memory);
+	out.bySource.resize(numSources);
+	out.closedBySource.resize(numSources);
+	// The sink captures a single pointer, which std::function stores without
+	// a heap allocation per source
+	struct Target {
+		std::pmr::vector<std::pmr::vector<Point>>* polylines;
+		std::pmr::vector<char>* closed;
+		const Tessellation* tessellation;
+	};
+	parallelFor(numSources, numThreads, [&](size_t i) {
+		Target target = { &out.bySource[i], &out.closedBySource[i], &tessellation };
+		source(i, [&target](const Path& path) {
+			target.polylines->emplace_back();
+			toSweepPoints(path, *target.tessellation, target.polylines->back());
+			target.closed->push_back(path.closed);
+		});
+	});
 
-		Point curPoint = path.points[i];
-		Point backPoint = !isStart ? path.points[i - 1LL] : curPoint;
-		Point nextPoint = !isEnd   ? path.points[i + 1LL] : curPoint;
-		
-		if (isStart && path.closed)
-			backPoint = path.points[path.points.size() - 2];
+	for (size_t i = 0; i < numSources; i++) {
+		for (size_t k = 0; k < out.bySource[i].size(); k++) {
+			out.polylines.push_back(&out.bySource[i][k]);
+			out.closed.push_back(out.closedBySource[i][k]);
+		}
+	}
+	return out;
+}
 
-		else if (isEnd && path.closed)
-			nextPoint = path.points[1];
-		
-		glm::vec3 forwardDir  = glm::normalize(nextPoint.pos - curPoint.pos);
-		glm::vec3 backwardDir = glm::normalize(backPoint.pos - curPoint.pos) * -1.0f;
+size_t Tube::numSweepIndices(size_t numRings, size_t shapeNumVerts) {
+	if (numRings < 2 || shapeNumVerts < 2)
+		return 0;
+	return (numRings - 1) * (shapeNumVerts - 1) * 6;
+}
 
-		glm::vec3 meanDir;
+RingTransform Tube::ringTransform(const Point& point, const Frame& frame) {
+	// Tilt turns the shape around the tangent before it is placed
+	// on the ring frame and scaled by the radius
+	float tiltCos = cosf(point.tilt);
+	float tiltSin = sinf(point.tilt);
+	RingTransform transform;
+	transform.axisX = (frame.normal * tiltCos + frame.binormal * tiltSin) * point.radius;
+	transform.axisY = (frame.binormal * tiltCos - frame.normal * tiltSin) * point.radius;
+	transform.axisZ = -frame.tangent * point.radius;
+	transform.origin = point.pos;
+	return transform;
+}
 
-		if      (isStart && !path.closed) meanDir = forwardDir;
-		else if (isEnd && !path.closed)   meanDir = backwardDir;
-		else                              meanDir = glm::normalize((forwardDir + backwardDir) / 2.0f);
+// Unit normal of a profile edge, zero for edges of zero length.
+// It points to the side the faces of the tube face
+static glm::vec2 edgeNormal(glm::vec3 from, glm::vec3 to) {
+	glm::vec2 normal = glm::vec2(from.y - to.y, to.x - from.x);
+	float len = glm::length(normal);
+	return len > 0.0f ? normal / len : glm::vec2(0.0f);
+}
 
-		glm::mat4 identity = glm::mat4(1.0f);
-		glm::vec3 up = glm::vec3(0, 0, 1);
-		glm::mat4 shapeMat = glm::translate(identity, curPoint.pos) *
-			// glm::rotate(identity, glm::radians(90.0f), glm::vec3(1, 0, 0)) *
-			// glm::lookAt(glm::vec3(0.0f), meanDir, up) *
-			// glm::rotate(identity, curPoint.tilt, up) *
-			glm::scale(identity, glm::vec3(curPoint.radius));
+static bool isCrease(glm::vec2 a, glm::vec2 b, float creaseAngle) {
+	if (a == glm::vec2(0.0f) || b == glm::vec2(0.0f))
+		return false;
+	return acosf(glm::clamp(glm::dot(a, b), -1.0f, 1.0f)) > creaseAngle;
+}
 
-		glm::quat shapeTilt = glm::quat(glm::vec3(0, 0, curPoint.tilt));
-		glm::quat shapeLookAt = glm::quatLookAt(meanDir, up);
+Shape Tube::splitCreases(const Shape& shape) {
+	size_t numVerts = shape.verts.size();
+	if (numVerts < 3)
+		return shape;
 
-		auto transformedShape = std::vector<glm::vec3>(shape.verts.size());
-		for (int p = 0; p < shape.verts.size(); p++)
-			transformedShape[p] = shapeMat * (shapeLookAt * shapeTilt * glm::vec4(shape.verts[p], 1.0f));
+	Shape split = shape;
+	split.verts.clear();
+	split.verts.push_back(shape.verts[0]);
+	for (size_t p = 1; p + 1 < numVerts; p++) {
+		glm::vec2 before = edgeNormal(shape.verts[p - 1], shape.verts[p]);
+		glm::vec2 after = edgeNormal(shape.verts[p], shape.verts[p + 1]);
+		split.verts.push_back(shape.verts[p]);
+		if (isCrease(before, after, shape.creaseAngle))
+			split.verts.push_back(shape.verts[p]);
+	}
+	split.verts.push_back(shape.verts[numVerts - 1]);
+	return split;
+}
 
-		extrude(transformedShape, shape.closed);
+std::shared_ptr<CapTriangulation> Tube::capTriangulation(Shape& shape, const std::vector<glm::vec3>& verts) {
+	// Tubes may be swept from one shape on several threads at once
+	auto triangulation = std::atomic_load(&shape.capTriangulation);
+	if (triangulation == nullptr || triangulation->verts() != verts) {
+		triangulation = std::make_shared<CapTriangulation>(verts);
+		std::atomic_store(&shape.capTriangulation, triangulation);
+	}
+	return triangulation;
+}
+
+ShapeSoA Tube::profileNormals(const Shape& shape) {
+	size_t numVerts = shape.verts.size();
+	auto normals = std::vector<glm::vec3>(numVerts, glm::vec3(0.0f));
+	if (numVerts < 2)
+		return ShapeSoA(normals);
+
+	const auto& verts = shape.verts;
+	auto edges = std::vector<glm::vec2>(numVerts - 1);
+	float longestEdge = 0.0f;
+	for (size_t p = 0; p + 1 < numVerts; p++) {
+		edges[p] = edgeNormal(verts[p], verts[p + 1]);
+		longestEdge = fmaxf(longestEdge, glm::distance(verts[p], verts[p + 1]));
+	}
+
+	// Closed profiles usually repeat the first vertex at the end, up to
+	// rounding like in Shapes::circle. The seam vertices then take the edge
+	// on the other side of the seam
+	glm::vec2 seamBefore = glm::vec2(0.0f);
+	glm::vec2 seamAfter = glm::vec2(0.0f);
+	if (shape.closed && numVerts > 2) {
+		bool repeatsStart = glm::distance(verts[numVerts - 1], verts[0]) <= longestEdge * 1e-4f;
+		glm::vec2 closing = repeatsStart ? glm::vec2(0.0f) : edgeNormal(verts[numVerts - 1], verts[0]);
+		seamBefore = repeatsStart ? edges[numVerts - 2] : closing;
+		seamAfter = repeatsStart ? edges[0] : closing;
+		if (isCrease(seamBefore, edges[0], shape.creaseAngle)) {
+			seamBefore = glm::vec2(0.0f);
+			seamAfter = glm::vec2(0.0f);
+		}
+	}
+
+	for (size_t p = 0; p < numVerts; p++) {
+		glm::vec2 before = p > 0 ? edges[p - 1] : seamBefore;
+		glm::vec2 after = p + 1 < numVerts ? edges[p] : seamAfter;
+		glm::vec2 normal = before + after;
+		float len = glm::length(normal);
+		normal = len > 0.0f ? normal / len : normal;
+		normals[p] = glm::vec3(normal, glm::dot(normal, glm::vec2(verts[p].x, verts[p].y)));
+	}
+	return ShapeSoA(normals);
+}
+
+float Tube::radiusSlope(const Point* points, size_t n, bool closed, size_t i) {
+	if (n < 2)
+		return 0.0f;
+
+	// Closed polylines repeat the first point at the end
+	bool repeatsStart = closed && n > 2 && points[0].pos == points[n - 1].pos;
+	size_t before = i > 0 ? i - 1 : (repeatsStart ? n - 2 : i);
+	size_t after = i + 1 < n ? i + 1 : (repeatsStart ? 1 : i);
+
+	float len = glm::distance(points[before].pos, points[i].pos) +
+		glm::distance(points[i].pos, points[after].pos);
+	if (len <= 0.0f)
+		return 0.0f;
+	return (points[after].radius - points[before].radius) / len;
+}
+
+// Limit of the stretch of a miter ring, like the default miter limit of SVG
+static const float MAX_MITER_STRETCH = 4.0f;
+
+void Tube::miterRing(const Point* points, size_t n, bool closed, size_t i, RingTransform& transform) {
+	bool repeatsStart = closed && n > 2 && points[0].pos == points[n - 1].pos;
+	size_t before = i > 0 ? i - 1 : (repeatsStart ? n - 2 : i);
+	size_t after = i + 1 < n ? i + 1 : (repeatsStart ? 1 : i);
+
+	glm::vec3 in = safeNormalize(points[i].pos - points[before].pos);
+	glm::vec3 out = safeNormalize(points[after].pos - points[i].pos);
+	glm::vec3 across = out - in;
+	float acrossLength = glm::length(across);
+	if (acrossLength <= 1e-6f || glm::length(in) == 0.0f || glm::length(out) == 0.0f)
+		return;
+	across /= acrossLength;
+
+	// The ring lies on the plane halfway between the segments, which cuts
+	// a tube around either of them in an ellipse that is longer across the
+	// turn by 1 / cos of half the turn
+	float halfTurnCos = glm::length(in + out) * 0.5f;
+	float stretch = halfTurnCos * MAX_MITER_STRETCH > 1.0f ? 1.0f / halfTurnCos : MAX_MITER_STRETCH;
+	transform.axisX += across * (glm::dot(transform.axisX, across) * (stretch - 1.0f));
+	transform.axisY += across * (glm::dot(transform.axisY, across) * (stretch - 1.0f));
+}
+
+void Tube::ringNormals(const Point& point, const Frame& frame, float slope,
+	const ShapeSoA& profile, glm::vec3* out)
+{
+	// The surface leans back along the tangent where the radius grows
+	RingTransform transform = ringTransform(point, frame);
+	float invRadius = point.radius != 0.0f ? 1.0f / point.radius : 0.0f;
+	transform.axisX *= invRadius;
+	transform.axisY *= invRadius;
+	transform.axisZ = -frame.tangent * slope;
+	transform.origin = glm::vec3(0.0f);
+	transformRing(transform, profile, out);
+
+	for (size_t p = 0; p < profile.size(); p++) {
+		float len = glm::length(out[p]);
+		if (len > 0.0f)
+			out[p] /= len;
+	}
+}
+
+// #include <iostream>
+
+void Tube::sweep(const Point* points, const Frame* frames, size_t numPoints, bool closed,
+	const ShapeSoA& shape, const ShapeSoA& profile,
+	glm::vec3* vertices, glm::vec3* normals, glm::vec2* texCoords, int* indices, int baseVertex,
+	const VertexLayout& layout, unsigned char* vertexData, size_t numVertices)
+{
+	TUBE_STATS_STAGE(BuildStage::SWEEP);
+	TUBE_STATS_COUNT(numRings, numPoints);
+	TUBE_STATS_COUNT(numTriangles, numSweepIndices(numPoints, shape.size()) / 3);
+	int shapeNumVerts = (int)shape.size();
+
+	// Need for generating texture coordinates
+
+	float pathLength = 0.0f;
+	for (size_t i = 1; i < numPoints; i++)
+		pathLength += glm::distance(points[i - 1].pos, points[i].pos);
+	if (closed && numPoints > 1)
+		pathLength += glm::distance(points[numPoints - 1].pos, points[0].pos);
+	float curLength = 0.0f;
+
+	auto ringKernel = bestRingKernel();
+
+	for (size_t i = 0; i < numPoints; i++) {
+		bool isStart = i == 0;
+		bool isEnd = i == numPoints - 1;
+
+		const Point& curPoint = points[i];
+		const Point& nextPoint = !isEnd ? points[i + 1LL] : curPoint;
+		const Frame& frame = frames[i];
+
+		RingTransform transform = ringTransform(curPoint, frame);
+		if (curPoint.isMiter)
+			miterRing(points, numPoints, closed, i, transform);
+		transformRing(ringKernel, transform, shape, vertices + i * shapeNumVerts);
+		if (normals != nullptr) {
+			float slope = radiusSlope(points, numPoints, closed, i);
+			ringNormals(curPoint, frame, slope, profile, normals + i * shapeNumVerts);
+		}
+
+		// Connect the ring with the previous one
+
+		if (!isStart) {
+			int firstPart  = baseVertex + (int)(i - 1) * shapeNumVerts;
+			int secondPart = baseVertex + (int)i * shapeNumVerts;
+			for (int edge = 0; edge < shapeNumVerts - 1; edge++) {
+				int a1 = firstPart + edge;
+				int a2 = firstPart + edge + 1;
+				int b1 = secondPart + edge;
+				int b2 = secondPart + edge + 1;
+				indices[0] = b1;
+				indices[1] = a1;
+				indices[2] = a2;
+				indices[3] = a2;
+				indices[4] = b2;
+				indices[5] = b1;
+				indices += 6;
+			}
+		}
 
 		// Generate texture coordinates
 
-		float shapeEnd = (float)shape.verts.size() - 1.0f;
-		for (int p = 0; p < shape.verts.size(); p++) {
+		float shapeEnd = (float)shapeNumVerts - 1.0f;
+		glm::vec2* ringTexCoords = texCoords + i * shapeNumVerts;
+		for (int p = 0; p < shapeNumVerts; p++) {
 			float u = p / shapeEnd;
 			float v = curLength / pathLength;
 			// std::cout << u << ", " << v << std::endl;
-			texCoords.push_back(glm::vec2(u, v));
+			ringTexCoords[p] = glm::vec2(u, v);
+		}
+
+		// Pack the ring while it is still in cache
+
+		if (vertexData != nullptr) {
+			const glm::vec3* ring = vertices + i * shapeNumVerts;
+			size_t ringStart = (size_t)baseVertex + i * shapeNumVerts;
+			for (int p = 0; p < shapeNumVerts; p++) {
+				layout.writePosition(vertexData, numVertices, ringStart + p, ring[p]);
+				layout.writeTexCoord(vertexData, numVertices, ringStart + p, ringTexCoords[p]);
+				if (normals != nullptr)
+					layout.writeNormal(vertexData, numVertices, ringStart + p, normals[i * shapeNumVerts + p]);
+			}
 		}
 		curLength += glm::length(curPoint.pos - nextPoint.pos);
 	}
 	// if (path.closed)
 	//	connectStartWithEnd((int)shape.verts.size());
+}
+
+void Tube::build(size_t numSources, const PathSource& source, Shape& profile,
+	Tessellation tessellation, unsigned int numThreads, VertexLayout layout, TubeNormals normals, Arena* arena)
+{
+	this->mLayout = layout;
+	if (numSources == 0)
+		return;
+	bool hasNormals = normals == TubeNormals::ANALYTIC;
+	Shape shape = hasNormals ? splitCreases(profile) : profile;
+	auto shapeSoA = ShapeSoA(shape.verts);
+	auto profileSoA = hasNormals ? profileNormals(shape) : ShapeSoA(std::vector<glm::vec3>());
+
+	// Polylines and frames only live during the build, they come from
+	// the arena instead of the heap
+
+	Arena localArena;
+	std::pmr::memory_resource* memory = arena != nullptr ? arena : &localArena;
+
+	// Convert the pathes of every source to polylines to learn the size of
+	// every tube. Pathes only exist while they are converted
+
+	auto sweepPolylines = toSweepPolylines(numSources, source, tessellation, numThreads, memory);
+	const auto& polylines = sweepPolylines.polylines;
+	const auto& closed = sweepPolylines.closed;
+	size_t numPathes = polylines.size();
+
+	size_t shapeNumVerts = shape.verts.size();
+	auto vertexStarts = std::pmr::vector<size_t>(numPathes + 1, 0, memory);
+	auto indexStarts = std::pmr::vector<size_t>(numPathes + 1, 0, memory);
+	for (size_t i = 0; i < numPathes; i++) {
+		size_t numRings = polylines[i]->size();
+		vertexStarts[i + 1] = vertexStarts[i] + numRings * shapeNumVerts;
+		indexStarts[i + 1] = indexStarts[i] + numSweepIndices(numRings, shapeNumVerts);
+	}
+
+	// Allocate the whole mesh up front and write rings and quads in place
+
+	this->vertices.resize(vertexStarts.back());
+	this->texCoords.resize(vertexStarts.back());
+	this->normals.resize(hasNormals ? vertexStarts.back() : 0);
+	this->indices.resize(indexStarts.back());
+	this->mVertexData.resize(layout.size(this->vertices.size()));
+	unsigned char* vertexData = layout.isEmpty() ? nullptr : this->mVertexData.data();
+
+	// Every tube writes its own slice of the merged mesh
+
+	parallelFor(numPathes, numThreads, [&](size_t i) {
+		const auto& points = *polylines[i];
+		auto frames = std::pmr::vector<Frame>(points.size(), memory);
+		{
+			TUBE_STATS_STAGE(BuildStage::FRAMES);
+			rotationMinimizingFrames(points.data(), points.size(), closed[i], frames.data());
+		}
+		sweep(points.data(), frames.data(), points.size(), closed[i], shapeSoA, profileSoA,
+			this->vertices.data() + vertexStarts[i],
+			hasNormals ? this->normals.data() + vertexStarts[i] : nullptr,
+			this->texCoords.data() + vertexStarts[i],
+			this->indices.data() + indexStarts[i],
+			(int)vertexStarts[i],
+			layout, vertexData, this->vertices.size());
+	});
 
 	this->mShapeNumVerts = (int)shape.verts.size();
+	this->mCapTriangulation = capTriangulation(profile, shape.verts);
+}
+
+// Pathes of a vector, freed after conversion when release is set
+static PathSource vectorSource(std::vector<Path>& pathes, bool release) {
+	return [&pathes, release](size_t i, const std::function<void(const Path&)>& sink) {
+		sink(pathes[i]);
+		if (release)
+			pathes[i] = Path();
+	};
+}
+
+Tube::Tube(Path path, Shape& profile, Tessellation tessellation, VertexLayout layout, TubeNormals normals,
+	Arena* arena)
+{
+	auto source = [&path](size_t, const std::function<void(const Path&)>& sink) {
+		sink(path);
+		path = Path();
+	};
+	build(1, source, profile, tessellation, 1, layout, normals, arena);
+}
+
+Tube::Tube(std::vector<Path>& pathes, Shape& profile, Tessellation tessellation, unsigned int numThreads,
+	VertexLayout layout, TubeNormals normals, Arena* arena)
+{
+	build(pathes.size(), vectorSource(pathes, false), profile, tessellation, numThreads, layout, normals, arena);
+}
+
+Tube::Tube(std::vector<Path>&& pathes, Shape& profile, Tessellation tessellation, unsigned int numThreads,
+	VertexLayout layout, TubeNormals normals, Arena* arena)
+{
+	build(pathes.size(), vectorSource(pathes, true), profile, tessellation, numThreads, layout, normals, arena);
+	pathes.clear();
+}
+
+Tube::Tube(size_t numSources, const PathSource& source, Shape& profile, Tessellation tessellation,
+	unsigned int numThreads, VertexLayout layout, TubeNormals normals, Arena* arena)
+{
+	build(numSources, source, profile, tessellation, numThreads, layout, normals, arena);
 }
 
 Tube::Tube(std::vector<Tube> tubes) {
 	if (tubes.size() == 0)
 		return;
+	TUBE_STATS_STAGE(BuildStage::MERGE);
 	this->mShapeNumVerts = tubes[0].mShapeNumVerts;
+	this->mCapTriangulation = tubes[0].mCapTriangulation;
+	this->mLayout = tubes[0].mLayout;
+	size_t numVertices = 0;
+	size_t numIndices = 0;
+	for (auto& tube : tubes) {
+		numVertices += tube.vertices.size();
+		numIndices += tube.indices.size();
+	}
+	this->vertices.reserve(numVertices);
+	this->normals.reserve(numVertices);
+	this->texCoords.reserve(numVertices);
+	this->indices.reserve(numIndices);
+
 	size_t indicesEnd = 0;
     size_t verticesEnd = 0;
 	for (auto& tube : tubes) {
@@ -179,6 +547,7 @@ Tube::Tube(std::vector<Tube> tubes) {
 		indicesEnd += tube.indices.size();
         verticesEnd += tube.vertices.size();
 	}
+	packVertices();
 }
 
 Tube::Tube()
@@ -188,6 +557,9 @@ Tube::Tube()
 Tube Tube::copy() {
 	auto c = Tube();
 	c.mShapeNumVerts = this->mShapeNumVerts;
+	c.mCapTriangulation = this->mCapTriangulation;
+	c.mLayout = this->mLayout;
+	c.mVertexData = this->mVertexData;
 	c.vertices.insert(c.vertices.end(), this->vertices.begin(), this->vertices.end());
 	c.normals.insert(c.normals.end(), this->normals.begin(), this->normals.end());
 	c.texCoords.insert(c.texCoords.end(), this->texCoords.begin(), this->texCoords.end());
@@ -247,6 +619,10 @@ std::vector<float> Tube::toXYZUVNormal() {
 }
 
 Tube Tube::fillCaps(TubeCaps capsType) {
+	TUBE_STATS_STAGE(BuildStage::FILL_CAPS);
+	// Reordered tubes have no end rings, see optimizeVertexCache()
+	if (this->mShapeNumVerts <= 0)
+		throw std::logic_error("fillCaps() needs the rings of the tube, call it before optimizeVertexCache()");
 	if (capsType == TubeCaps::TRIANGE_FAN) {
 		int start = 0;
 		int end = (int)this->vertices.size() - mShapeNumVerts;
@@ -254,11 +630,27 @@ Tube Tube::fillCaps(TubeCaps capsType) {
 		glm::vec3 startCenter = getCentroidOfShape(start, mShapeNumVerts);
 		glm::vec3 endCenter = getCentroidOfShape(end, mShapeNumVerts);
 
-		auto tips = std::vector<glm::vec3>({ startCenter, endCenter });
-		this->vertices.insert(this->vertices.end(), tips.begin(), tips.end());
+		// Grow every buffer once
+		bool hasNormals = this->normals.size() == this->vertices.size();
+		this->vertices.reserve(this->vertices.size() + 2);
+		this->texCoords.reserve(this->texCoords.size() + 2);
+		if (hasNormals)
+			this->normals.reserve(this->normals.size() + 2);
+		this->indices.reserve(this->indices.size() + (size_t)mShapeNumVerts * 6);
+
+		this->vertices.push_back(startCenter);
+		this->vertices.push_back(endCenter);
 
-		auto tipTexCoords = std::vector<glm::vec2>({ glm::vec2(0.5f, 0.0f), glm::vec2(0.5f, 1.0f) });
-		this->texCoords.insert(this->texCoords.end(), tipTexCoords.begin(), tipTexCoords.end());
+		this->texCoords.push_back(glm::vec2(0.5f, 0.0f));
+		this->texCoords.push_back(glm::vec2(0.5f, 1.0f));
+
+		if (hasNormals) {
+			// Tips face away from the neighbouring rings
+			int afterStart = std::min(start + mShapeNumVerts, end);
+			int beforeEnd = std::max(end - mShapeNumVerts, start);
+			this->normals.push_back(safeNormalize(startCenter - getCentroidOfShape(afterStart, mShapeNumVerts)));
+			this->normals.push_back(safeNormalize(endCenter - getCentroidOfShape(beforeEnd, mShapeNumVerts)));
+		}
 
 		int startTipIdx = (int)this->vertices.size() - 2;
 		int endTipIdx = (int)this->vertices.size() - 1;
@@ -270,6 +662,24 @@ Tube Tube::fillCaps(TubeCaps capsType) {
 		// (start tip) to not connect start tip with end tip
 		triangleFan(end, mShapeNumVerts - 1, endTipIdx);
 	}
+	else if (capsType == TubeCaps::EAR_CUT && mShapeNumVerts >= 3) {
+		int start = 0;
+		int end = (int)this->vertices.size() - mShapeNumVerts;
+
+		// The end rings are the profile moved by their ring transforms, so
+		// the triangles of the profile fill them too
+		std::vector<int> ringTriangles;
+		const std::vector<int>* triangles = &ringTriangles;
+		if (this->mCapTriangulation != nullptr && this->mCapTriangulation->verts().size() == (size_t)mShapeNumVerts)
+			triangles = &this->mCapTriangulation->indices();
+		else
+			ringTriangles = earCut(this->vertices.data() + start, mShapeNumVerts);
+
+		this->indices.reserve(this->indices.size() + triangles->size() * 2);
+		capRing(start, std::min(start + mShapeNumVerts, end), *triangles);
+		capRing(end, std::max(end - mShapeNumVerts, start), *triangles);
+	}
+	packVertices();
 	return *this;
 }
 
@@ -282,6 +692,7 @@ glm::vec3 computeFaceNormal(glm::vec3 p1, glm::vec3 p2, glm::vec3 p3) {
 }
 
 Tube Tube::calculateNormals() {
+	TUBE_STATS_STAGE(BuildStage::NORMALS);
 	this->normals = std::vector<glm::vec3>(this->vertices.size());
 	// For each face calculate normals and append to the corresponding vertices of the face
 	for (unsigned int i = 0; i < this->indices.size(); i += 3) {
@@ -298,22 +709,324 @@ Tube Tube::calculateNormals() {
 	for (unsigned int i = 0; i < this->normals.size(); i++)
 		this->normals[i] = glm::normalize(this->normals[i]);
 
+	if (!this->mLayout.isEmpty()) {
+		for (size_t i = 0; i < this->normals.size(); i++)
+			this->mLayout.writeNormal(this->mVertexData.data(), this->vertices.size(), i, this->normals[i]);
+	}
 	return *this;
 }
 
 Tube Tube::join(Tube a, Tube& b) {
+	TUBE_STATS_STAGE(BuildStage::MERGE);
 	size_t indicesEnd = a.indices.size();
     size_t verticesEnd = a.vertices.size();
 	a.mShapeNumVerts = b.mShapeNumVerts;
+	a.mCapTriangulation = b.mCapTriangulation;
 	a.vertices.insert(a.vertices.end(), b.vertices.begin(), b.vertices.end());
 	a.normals.insert(a.normals.end(), b.normals.begin(), b.normals.end());
 	a.texCoords.insert(a.texCoords.end(), b.texCoords.begin(), b.texCoords.end());
 	a.indices.resize(a.indices.size() + b.indices.size());
 	for (size_t i = 0; i < b.indices.size(); i++)
 		a.indices[indicesEnd + i] = (int)verticesEnd + b.indices[i];
+	a.packVertices();
 	return a;
 }
 
+void Tube::packVertices() {
+	size_t numVertices = this->vertices.size();
+	this->mVertexData.assign(this->mLayout.size(numVertices), 0);
+	if (this->mLayout.isEmpty())
+		return;
+
+	unsigned char* data = this->mVertexData.data();
+	for (size_t i = 0; i < numVertices; i++)
+		this->mLayout.writePosition(data, numVertices, i, this->vertices[i]);
+	for (size_t i = 0; i < this->texCoords.size() && i < numVertices; i++)
+		this->mLayout.writeTexCoord(data, numVertices, i, this->texCoords[i]);
+	for (size_t i = 0; i < this->normals.size() && i < numVertices; i++)
+		this->mLayout.writeNormal(data, numVertices, i, this->normals[i]);
+}
+
+Tube Tube::pack(VertexLayout layout) {
+	this->mLayout = layout;
+	packVertices();
+	return *this;
+}
+
+const VertexLayout& Tube::layout() const {
+	return this->mLayout;
+}
+
+Span<const unsigned char> Tube::vertexData() const {
+	return Span<const unsigned char>{ this->mVertexData.data(), this->mVertexData.size() };
+}
+
+Span<const unsigned char> Tube::attributeData(VertexAttribute attribute) const {
+	if (this->mLayout.attributeSize(attribute) == 0)
+		return Span<const unsigned char>();
+	size_t offset = this->mLayout.offset(attribute, this->vertices.size());
+	return Span<const unsigned char>{ this->mVertexData.data() + offset, this->mVertexData.size() - offset };
+}
+
+Span<const int> Tube::indexData() const {
+	return Span<const int>{ this->indices.data(), this->indices.size() };
+}
+
+// Number of indices of the quads between two rings starting at i, in the
+// order Tube::sweep writes them, or zero when other triangles start there
+static size_t ringPairLength(const int* indices, size_t numIndices, size_t i, int shapeNumVerts) {
+	if (shapeNumVerts < 2)
+		return 0;
+	size_t length = (size_t)(shapeNumVerts - 1) * 6;
+	if (i + length > numIndices)
+		return 0;
+	int b = indices[i];
+	int a = indices[i + 1];
+	if (b != a + shapeNumVerts)
+		return 0;
+	const int* quad = indices + i;
+	for (int edge = 0; edge < shapeNumVerts - 1; edge++, quad += 6) {
+		if (quad[0] != b + edge || quad[1] != a + edge || quad[2] != a + edge + 1 ||
+			quad[3] != a + edge + 1 || quad[4] != b + edge + 1 || quad[5] != b + edge)
+			return 0;
+	}
+	return length;
+}
+
+IndexBuffer Tube::packIndices(IndexFormat format, IndexTopology topology) const {
+	IndexBuffer buffer;
+	buffer.format = format;
+	buffer.topology = topology;
+	const int* indices = this->indices.data();
+	size_t numIndices = this->indices.size();
+
+	// Strips lose the restart index to vertices
+	uint32_t restart = buffer.restartIndex();
+	size_t maxVertices = topology == IndexTopology::TRIANGLE_STRIP ? (size_t)restart : (size_t)restart + 1;
+	if (this->vertices.size() > maxVertices)
+		throw std::length_error("Too many vertices for the index format, split() the tube first");
+
+	if (topology == IndexTopology::TRIANGLES) {
+		buffer.data.reserve(numIndices * buffer.indexSize());
+		for (size_t i = 0; i < numIndices; i++)
+			buffer.push((uint32_t)indices[i]);
+		return buffer;
+	}
+
+	// A ring pair a, b becomes a0 a0 b0 a1 b1 ... The repeated first vertex
+	// makes an empty triangle, so the quads keep their winding and diagonal
+	int shapeNumVerts = this->mShapeNumVerts;
+	buffer.data.reserve((numIndices / 3 + 1) * buffer.indexSize() * 2);
+	for (size_t i = 0; i < numIndices;) {
+		if (i > 0)
+			buffer.push(restart);
+		size_t length = ringPairLength(indices, numIndices, i, shapeNumVerts);
+		if (length > 0) {
+			int b = indices[i];
+			int a = indices[i + 1];
+			buffer.push((uint32_t)a);
+			for (int p = 0; p < shapeNumVerts; p++) {
+				buffer.push((uint32_t)(a + p));
+				buffer.push((uint32_t)(b + p));
+			}
+			i += length;
+		}
+		else {
+			for (size_t k = i; k < i + 3 && k < numIndices; k++)
+				buffer.push((uint32_t)indices[k]);
+			i += 3;
+		}
+	}
+	return buffer;
+}
+
+std::vector<Tube> Tube::split(size_t maxVertices) const {
+	int shapeNumVerts = this->mShapeNumVerts;
+	if (shapeNumVerts <= 0)
+		throw std::logic_error("split() needs the rings of the tube, call it before optimizeVertexCache()");
+	assert(maxVertices >= 3 && maxVertices >= (size_t)shapeNumVerts * 2);
+	bool hasNormals = this->normals.size() == this->vertices.size();
+	bool hasTexCoords = this->texCoords.size() == this->vertices.size();
+	const int* indices = this->indices.data();
+	size_t numIndices = this->indices.size();
+
+	std::vector<Tube> parts;
+	Tube part;
+	// Vertex of the part for every vertex of this tube, -1 when not in it
+	std::vector<int> local(this->vertices.size(), -1);
+	std::vector<int> used;
+
+	auto finishPart = [&]() {
+		if (part.indices.empty())
+			return;
+		part.mShapeNumVerts = shapeNumVerts;
+		part.mCapTriangulation = this->mCapTriangulation;
+		part.mLayout = this->mLayout;
+		part.packVertices();
+		parts.push_back(std::move(part));
+		part = Tube();
+		for (int v : used)
+			local[v] = -1;
+		used.clear();
+	};
+	auto localVertex = [&](int v) {
+		if (local[v] < 0) {
+			local[v] = (int)part.vertices.size();
+			used.push_back(v);
+			part.vertices.push_back(this->vertices[v]);
+			if (hasNormals)
+				part.normals.push_back(this->normals[v]);
+			if (hasTexCoords)
+				part.texCoords.push_back(this->texCoords[v]);
+		}
+		return local[v];
+	};
+	auto fits = [&](const int* vertices, size_t count) {
+		size_t numNew = 0;
+		for (size_t k = 0; k < count; k++)
+			numNew += local[vertices[k]] < 0 ? 1 : 0;
+		return part.vertices.size() + numNew <= maxVertices;
+	};
+
+	std::vector<int> pairVertices((size_t)shapeNumVerts * 2);
+	for (size_t i = 0; i < numIndices;) {
+		size_t length = ringPairLength(indices, numIndices, i, shapeNumVerts);
+		if (length > 0) {
+			// Both rings in order, so the part keeps b = a + shapeNumVerts
+			int b = indices[i];
+			int a = indices[i + 1];
+			for (int p = 0; p < shapeNumVerts; p++) {
+				pairVertices[p] = a + p;
+				pairVertices[(size_t)shapeNumVerts + p] = b + p;
+			}
+			if (!fits(pairVertices.data(), pairVertices.size()))
+				finishPart();
+			for (int v : pairVertices)
+				localVertex(v);
+		}
+		else {
+			length = std::min((size_t)3, numIndices - i);
+			if (!fits(indices + i, length))
+				finishPart();
+		}
+		for (size_t k = i; k < i + length; k++)
+			part.indices.push_back(localVertex(indices[k]));
+		i += length;
+	}
+	finishPart();
+	return parts;
+}
+
+// Sweep quads of consecutive ring pairs are walked in bands of columns
+// narrow enough that the band of both rings stays in the cache, so every
+// vertex is transformed about once per band instead of once per pair.
+// Other triangles keep their place
+void Tube::reorderForVertexCache(size_t cacheSize) {
+	assert(cacheSize >= 4);
+	TUBE_STATS_STAGE(BuildStage::VERTEX_CACHE);
+	int shapeNumVerts = this->mShapeNumVerts;
+	int numEdges = shapeNumVerts - 1;
+	int bandEdges = std::max(1, std::min(numEdges, (int)cacheSize / 2 - 1));
+	const int* indices = this->indices.data();
+	size_t numIndices = this->indices.size();
+
+	std::vector<int> ordered;
+	ordered.reserve(numIndices);
+	for (size_t i = 0; i < numIndices;) {
+		size_t length = ringPairLength(indices, numIndices, i, shapeNumVerts);
+		if (length == 0) {
+			size_t end = std::min(i + 3, numIndices);
+			ordered.insert(ordered.end(), indices + i, indices + end);
+			i = end;
+			continue;
+		}
+
+		// Pairs continuing each other, the second ring of one is the first
+		// ring of the next
+		size_t runStart = i;
+		size_t numPairs = 0;
+		do {
+			i += length;
+			numPairs++;
+		} while (ringPairLength(indices, numIndices, i, shapeNumVerts) > 0 && indices[i + 1] == indices[i - length]);
+
+		for (int band = 0; band < numEdges; band += bandEdges) {
+			int bandEnd = std::min(band + bandEdges, numEdges);
+			for (size_t pair = 0; pair < numPairs; pair++) {
+				const int* quads = indices + runStart + pair * length;
+				ordered.insert(ordered.end(), quads + (size_t)band * 6, quads + (size_t)bandEnd * 6);
+			}
+		}
+	}
+
+	// Number vertices in the order the triangles first use them, so the
+	// vertex fetch reads the buffer front to back. Unused vertices go last
+	size_t numVertices = this->vertices.size();
+	std::vector<int> remap(numVertices, -1);
+	int next = 0;
+	for (int& index : ordered) {
+		if (remap[index] < 0)
+			remap[index] = next++;
+		index = remap[index];
+	}
+	for (size_t v = 0; v < numVertices; v++) {
+		if (remap[v] < 0)
+			remap[v] = next++;
+	}
+
+	auto permute = [&](auto& attribute) {
+		if (attribute.size() != numVertices)
+			return;
+		auto moved = attribute;
+		for (size_t v = 0; v < numVertices; v++)
+			moved[remap[v]] = attribute[v];
+		attribute = std::move(moved);
+	};
+	permute(this->vertices);
+	permute(this->normals);
+	permute(this->texCoords);
+	this->indices = std::move(ordered);
+	// Vertices no longer make rings of the profile
+	this->mShapeNumVerts = 0;
+	this->mCapTriangulation = nullptr;
+	packVertices();
+}
+
+Tube Tube::optimizeVertexCache(size_t cacheSize) {
+	reorderForVertexCache(cacheSize);
+	return *this;
+}
+
+VertexCacheStats Tube::vertexCacheStats(size_t cacheSize) const {
+	assert(cacheSize > 0);
+	VertexCacheStats stats;
+	size_t numTriangles = this->indices.size() / 3;
+	if (numTriangles == 0)
+		return stats;
+
+	// A vertex stays in the FIFO until cacheSize more misses came after
+	// the one that loaded it
+	std::vector<size_t> loadedAt(this->vertices.size(), 0);
+	std::vector<bool> isUsed(this->vertices.size(), false);
+	size_t misses = 0;
+	size_t numUsed = 0;
+	for (size_t i = 0; i < numTriangles * 3; i++) {
+		int v = this->indices[i];
+		if (!isUsed[v]) {
+			isUsed[v] = true;
+			numUsed++;
+		}
+		else if (misses - loadedAt[v] <= cacheSize) {
+			continue;
+		}
+		loadedAt[v] = misses;
+		misses++;
+	}
+	stats.acmr = (float)misses / (float)numTriangles;
+	stats.atvr = (float)misses / (float)numUsed;
+	return stats;
+}
+
 Shape Shapes::circle(float radius, int segments)
 {
 	auto shape = Shape();
@@ -0,0 +1,307 @@
+#include "TubeFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace tube;
+
+namespace {
+
+const char MAGIC[4] = { 'T', 'U', 'B', 'E' };
+// Reads back as another number on a machine of the other byte order
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+const uint64_t BUFFER_ALIGNMENT = 16;
+
+enum Buffer {
+	VERTICES,
+	NORMALS,
+	TEX_COORDS,
+	INDICES,
+	VERTEX_DATA,
+	NUM_BUFFERS
+};
+
+const uint64_t ELEMENT_SIZES[NUM_BUFFERS] = {
+	sizeof(glm::vec3), sizeof(glm::vec3), sizeof(glm::vec2), sizeof(int), 1
+};
+
+struct FileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t headerSize;
+	int32_t shapeNumVerts;
+	// Attribute formats of the vertex layout and whether it is interleaved
+	uint8_t position;
+	uint8_t texCoord;
+	uint8_t normal;
+	uint8_t interleaved;
+	float boundsMin[3];
+	float boundsMax[3];
+	// Number of elements and byte offset of every buffer
+	uint64_t counts[NUM_BUFFERS];
+	uint64_t offsets[NUM_BUFFERS];
+};
+
+static_assert(sizeof(FileHeader) == 128, "The header has no padding");
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float) && sizeof(glm::vec2) == 2 * sizeof(float),
+	"Vectors are stored as packed floats");
+static_assert(sizeof(int) == 4, "Indices are stored as 32-bit integers");
+
+uint64_t alignUp(uint64_t offset) {
+	return (offset + BUFFER_ALIGNMENT - 1) / BUFFER_ALIGNMENT * BUFFER_ALIGNMENT;
+}
+
+bool isFormat(uint8_t format) {
+	return format <= (uint8_t)AttributeFormat::UNORM16;
+}
+
+}
+
+bool tube::saveTube(const Tube& tube, const std::string& fileName) {
+	// Loading needs the ring size to check the vertex count
+	if (tube.mShapeNumVerts <= 0)
+		return false;
+
+	FileHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = TUBE_FILE_VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.headerSize = sizeof(FileHeader);
+	header.shapeNumVerts = tube.mShapeNumVerts;
+	header.position = (uint8_t)tube.mLayout.position;
+	header.texCoord = (uint8_t)tube.mLayout.texCoord;
+	header.normal = (uint8_t)tube.mLayout.normal;
+	header.interleaved = tube.mLayout.interleaved ? 1 : 0;
+
+	glm::vec3 boundsMin = tube.vertices.empty() ? glm::vec3(0.0f) : tube.vertices[0];
+	glm::vec3 boundsMax = boundsMin;
+	for (const auto& vertex : tube.vertices) {
+		boundsMin = glm::min(boundsMin, vertex);
+		boundsMax = glm::max(boundsMax, vertex);
+	}
+	for (int k = 0; k < 3; k++) {
+		header.boundsMin[k] = boundsMin[k];
+		header.boundsMax[k] = boundsMax[k];
+	}
+
+	const void* buffers[NUM_BUFFERS] = {
+		tube.vertices.data(), tube.normals.data(), tube.texCoords.data(),
+		tube.indices.data(), tube.mVertexData.data()
+	};
+	header.counts[VERTICES] = tube.vertices.size();
+	header.counts[NORMALS] = tube.normals.size();
+	header.counts[TEX_COORDS] = tube.texCoords.size();
+	header.counts[INDICES] = tube.indices.size();
+	header.counts[VERTEX_DATA] = tube.mVertexData.size();
+	uint64_t offset = sizeof(FileHeader);
+	for (int b = 0; b < NUM_BUFFERS; b++) {
+		offset = alignUp(offset);
+		header.offsets[b] = offset;
+		offset += header.counts[b] * ELEMENT_SIZES[b];
+	}
+
+	std::FILE* file = std::fopen(fileName.c_str(), "wb");
+	if (file == nullptr)
+		return false;
+	bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+	const char padding[BUFFER_ALIGNMENT] = {};
+	uint64_t written = sizeof(FileHeader);
+	for (int b = 0; b < NUM_BUFFERS && ok; b++) {
+		size_t gap = (size_t)(header.offsets[b] - written);
+		size_t size = (size_t)(header.counts[b] * ELEMENT_SIZES[b]);
+		ok = std::fwrite(padding, 1, gap, file) == gap &&
+			(size == 0 || std::fwrite(buffers[b], 1, size, file) == size);
+		written = header.offsets[b] + size;
+	}
+	return std::fclose(file) == 0 && ok;
+}
+
+MappedTube::MappedTube(const std::string& fileName) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+		// The view keeps the mapping and the file open
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr) {
+			this->mData = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			this->mSize = this->mData != nullptr ? (size_t)size.QuadPart : 0;
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+#else
+	int file = open(fileName.c_str(), O_RDONLY);
+	if (file < 0)
+		return;
+	struct stat status;
+	if (fstat(file, &status) == 0 && status.st_size > 0) {
+		void* data = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (data != MAP_FAILED) {
+			this->mData = data;
+			this->mSize = (size_t)status.st_size;
+		}
+	}
+	close(file);
+#endif
+	if (this->mData != nullptr && !readHeader())
+		unmap();
+}
+
+MappedTube::~MappedTube() {
+	unmap();
+}
+
+MappedTube::MappedTube(MappedTube&& other) noexcept {
+	*this = std::move(other);
+}
+
+MappedTube& MappedTube::operator=(MappedTube&& other) noexcept {
+	if (this == &other)
+		return *this;
+	unmap();
+	this->mData = std::exchange(other.mData, nullptr);
+	this->mSize = std::exchange(other.mSize, 0);
+	this->mVertices = std::exchange(other.mVertices, {});
+	this->mNormals = std::exchange(other.mNormals, {});
+	this->mTexCoords = std::exchange(other.mTexCoords, {});
+	this->mIndices = std::exchange(other.mIndices, {});
+	this->mVertexData = std::exchange(other.mVertexData, {});
+	this->mLayout = std::exchange(other.mLayout, VertexLayout::none());
+	this->mShapeNumVerts = std::exchange(other.mShapeNumVerts, 0);
+	this->mBoundsMin = other.mBoundsMin;
+	this->mBoundsMax = other.mBoundsMax;
+	return *this;
+}
+
+void MappedTube::unmap() {
+	if (this->mData != nullptr) {
+#ifdef _WIN32
+		UnmapViewOfFile(this->mData);
+#else
+		munmap(this->mData, this->mSize);
+#endif
+	}
+	this->mData = nullptr;
+	this->mSize = 0;
+	this->mVertices = {};
+	this->mNormals = {};
+	this->mTexCoords = {};
+	this->mIndices = {};
+	this->mVertexData = {};
+	this->mLayout = VertexLayout::none();
+	this->mShapeNumVerts = 0;
+}
+
+bool MappedTube::readHeader() {
+	if (this->mSize < sizeof(FileHeader))
+		return false;
+	FileHeader header;
+	std::memcpy(&header, this->mData, sizeof(header));
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != TUBE_FILE_VERSION ||
+		header.byteOrder != BYTE_ORDER_MARK || header.headerSize != sizeof(FileHeader))
+		return false;
+	if (!isFormat(header.position) || !isFormat(header.texCoord) || !isFormat(header.normal))
+		return false;
+
+	// Every buffer is aligned and inside the file
+	const unsigned char* data = (const unsigned char*)this->mData;
+	for (int b = 0; b < NUM_BUFFERS; b++) {
+		uint64_t offset = header.offsets[b];
+		if (offset % BUFFER_ALIGNMENT != 0 || offset > this->mSize ||
+			header.counts[b] > (this->mSize - offset) / ELEMENT_SIZES[b])
+			return false;
+	}
+	uint64_t numVertices = header.counts[VERTICES];
+	if ((header.counts[NORMALS] != 0 && header.counts[NORMALS] != numVertices) ||
+		(header.counts[TEX_COORDS] != 0 && header.counts[TEX_COORDS] != numVertices))
+		return false;
+	// Vertices are whole rings of the shape
+	if (header.shapeNumVerts <= 0 || numVertices % (uint64_t)header.shapeNumVerts != 0)
+		return false;
+
+	VertexLayout layout;
+	layout.position = (AttributeFormat)header.position;
+	layout.texCoord = (AttributeFormat)header.texCoord;
+	layout.normal = (AttributeFormat)header.normal;
+	layout.interleaved = header.interleaved != 0;
+	if (header.counts[VERTEX_DATA] != layout.size((size_t)numVertices))
+		return false;
+
+	this->mVertices = { (const glm::vec3*)(data + header.offsets[VERTICES]), (size_t)numVertices };
+	this->mNormals = { (const glm::vec3*)(data + header.offsets[NORMALS]), (size_t)header.counts[NORMALS] };
+	this->mTexCoords = { (const glm::vec2*)(data + header.offsets[TEX_COORDS]), (size_t)header.counts[TEX_COORDS] };
+	this->mIndices = { (const int*)(data + header.offsets[INDICES]), (size_t)header.counts[INDICES] };
+	this->mVertexData = { data + header.offsets[VERTEX_DATA], (size_t)header.counts[VERTEX_DATA] };
+	this->mLayout = layout;
+	this->mShapeNumVerts = header.shapeNumVerts;
+	this->mBoundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+	this->mBoundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+	return true;
+}
+
+bool MappedTube::isOpen() const {
+	return this->mData != nullptr;
+}
+
+Span<const glm::vec3> MappedTube::vertices() const {
+	return this->mVertices;
+}
+
+Span<const glm::vec3> MappedTube::normals() const {
+	return this->mNormals;
+}
+
+Span<const glm::vec2> MappedTube::texCoords() const {
+	return this->mTexCoords;
+}
+
+Span<const int> MappedTube::indices() const {
+	return this->mIndices;
+}
+
+Span<const unsigned char> MappedTube::vertexData() const {
+	return this->mVertexData;
+}
+
+const VertexLayout& MappedTube::layout() const {
+	return this->mLayout;
+}
+
+glm::vec3 MappedTube::boundsMin() const {
+	return this->mBoundsMin;
+}
+
+glm::vec3 MappedTube::boundsMax() const {
+	return this->mBoundsMax;
+}
+
+Tube MappedTube::toTube() const {
+	Tube tube;
+	tube.mShapeNumVerts = this->mShapeNumVerts;
+	tube.mLayout = this->mLayout;
+	tube.vertices.assign(this->mVertices.begin(), this->mVertices.end());
+	tube.normals.assign(this->mNormals.begin(), this->mNormals.end());
+	tube.texCoords.assign(this->mTexCoords.begin(), this->mTexCoords.end());
+	tube.indices.assign(this->mIndices.begin(), this->mIndices.end());
+	tube.mVertexData.assign(this->mVertexData.begin(), this->mVertexData.end());
+	return tube;
+}
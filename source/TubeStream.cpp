@@ -0,0 +1,191 @@
+#include "TubeStream.h"
+#include "Frames.h"
+
+#include <algorithm>
+#include <cassert>
+#include <memory_resource>
+
+using namespace tube;
+
+TubeStream::TubeStream(Shape shape, TubeChunkCallback callback, size_t ringsPerChunk,
+	Tessellation tessellation, VertexLayout layout, TubeNormals normals, float vScale):
+	mShape(normals == TubeNormals::ANALYTIC ? Tube::splitCreases(shape) : shape),
+	mShapeSoA(mShape.verts),
+	mProfileNormals(normals == TubeNormals::ANALYTIC ? Tube::profileNormals(mShape) : ShapeSoA(std::vector<glm::vec3>())),
+	mTessellation(tessellation),
+	mLayout(layout),
+	mHasNormals(normals == TubeNormals::ANALYTIC),
+	mRingsPerChunk(ringsPerChunk),
+	mVScale(vScale),
+	mCallback(std::move(callback)),
+	mRingKernel(bestRingKernel()),
+	mScratch(4 * 1024)
+{
+	assert(this->mRingsPerChunk > 0);
+	assert(this->mCallback);
+
+	// A chunk holds the ring carried over from the previous chunk and
+	// ringsPerChunk new ones, its buffers never grow after this
+	size_t shapeNumVerts = this->mShape.verts.size();
+	size_t maxVertices = (this->mRingsPerChunk + 1) * shapeNumVerts;
+	this->mVertices.resize(maxVertices);
+	if (this->mHasNormals)
+		this->mNormals.resize(maxVertices);
+	this->mTexCoords.resize(maxVertices);
+	this->mIndices.reserve(Tube::numSweepIndices(this->mRingsPerChunk + 1, shapeNumVerts));
+	this->mVertexData.resize(this->mLayout.size(maxVertices));
+}
+
+void TubeStream::push(const Point& point) {
+	assert(!this->mIsFinished);
+	bool isCurve = this->mNumPathPoints > 0 && (this->mLastPathPoint.hasRightHandle || point.hasLeftHandle);
+	if (!isCurve) {
+		addPolyPoint(point);
+	}
+	else {
+		{
+			std::pmr::vector<Point> polyline(&this->mScratch);
+			Point::toPoly(this->mLastPathPoint, point, this->mTessellation, polyline, false);
+			for (const auto& polyPoint : polyline)
+				addPolyPoint(polyPoint);
+		}
+		this->mScratch.reset();
+	}
+	this->mLastPathPoint = point;
+	this->mNumPathPoints++;
+}
+
+void TubeStream::finish() {
+	assert(!this->mIsFinished);
+	this->mIsFinished = true;
+	if (this->mNumPolyPoints == 0)
+		return;
+	writeRing(nullptr);
+	emitChunk(true);
+}
+
+size_t TubeStream::numRings() const {
+	return this->mNumRings;
+}
+
+size_t TubeStream::numChunks() const {
+	return this->mNumChunks;
+}
+
+float TubeStream::length() const {
+	return this->mLength;
+}
+
+void TubeStream::addPolyPoint(const Point& point) {
+	if (this->mNumPolyPoints > 0) {
+		writeRing(&point);
+		this->mPrevious = this->mCurrent;
+	}
+	this->mCurrent = point;
+	this->mNumPolyPoints++;
+}
+
+void TubeStream::writeRing(const Point* next) {
+	// The chunk is handed out when the next ring arrives, so the last
+	// chunk is never empty
+	if (this->mChunkRings == this->mRingsPerChunk + (this->mNumChunks > 0 ? 1 : 0))
+		emitChunk(false);
+
+	// Points around the ring, the same ones a Tube of the whole polyline
+	// looks at for tangents and radius slopes
+	Point window[3];
+	size_t n = 0;
+	if (this->mNumRings > 0)
+		window[n++] = this->mPrevious;
+	size_t i = n;
+	window[n++] = this->mCurrent;
+	if (next != nullptr)
+		window[n++] = *next;
+
+	if (n == 1) {
+		this->mFrame = initialFrame(glm::vec3(0.0f));
+	}
+	else {
+		glm::vec3 tangent = pointTangent(window, n, false, i, this->mTangent);
+		this->mFrame = this->mNumRings == 0
+			? initialFrame(tangent)
+			: transportFrame(this->mFrame, this->mPrevious.pos, this->mCurrent.pos, tangent);
+		this->mTangent = tangent;
+	}
+
+	int shapeNumVerts = (int)this->mShape.verts.size();
+	size_t ring = this->mChunkRings;
+	size_t ringStart = ring * shapeNumVerts;
+
+	RingTransform transform = Tube::ringTransform(this->mCurrent, this->mFrame);
+	if (this->mCurrent.isMiter)
+		Tube::miterRing(window, n, false, i, transform);
+	transformRing(this->mRingKernel, transform, this->mShapeSoA, this->mVertices.data() + ringStart);
+	if (this->mHasNormals) {
+		float slope = Tube::radiusSlope(window, n, false, i);
+		Tube::ringNormals(this->mCurrent, this->mFrame, slope, this->mProfileNormals,
+			this->mNormals.data() + ringStart);
+	}
+
+	float shapeEnd = (float)shapeNumVerts - 1.0f;
+	float v = this->mLength * this->mVScale;
+	for (int p = 0; p < shapeNumVerts; p++)
+		this->mTexCoords[ringStart + p] = glm::vec2(p / shapeEnd, v);
+
+	// Connect the ring with the previous one, in the same order as Tube::sweep
+	if (ring > 0) {
+		int firstPart = (int)(ring - 1) * shapeNumVerts;
+		int secondPart = (int)ring * shapeNumVerts;
+		for (int edge = 0; edge < shapeNumVerts - 1; edge++) {
+			int a1 = firstPart + edge;
+			int a2 = firstPart + edge + 1;
+			int b1 = secondPart + edge;
+			int b2 = secondPart + edge + 1;
+			this->mIndices.insert(this->mIndices.end(), { b1, a1, a2, a2, b2, b1 });
+		}
+	}
+
+	if (next != nullptr)
+		this->mLength += glm::distance(this->mCurrent.pos, next->pos);
+	this->mChunkRings++;
+	this->mNumRings++;
+}
+
+void TubeStream::emitChunk(bool isLast) {
+	size_t shapeNumVerts = this->mShape.verts.size();
+	size_t numVertices = this->mChunkRings * shapeNumVerts;
+
+	if (!this->mLayout.isEmpty()) {
+		unsigned char* data = this->mVertexData.data();
+		for (size_t v = 0; v < numVertices; v++) {
+			this->mLayout.writePosition(data, numVertices, v, this->mVertices[v]);
+			this->mLayout.writeTexCoord(data, numVertices, v, this->mTexCoords[v]);
+			if (this->mHasNormals)
+				this->mLayout.writeNormal(data, numVertices, v, this->mNormals[v]);
+		}
+	}
+
+	TubeChunk chunk;
+	chunk.index = this->mNumChunks;
+	chunk.firstRing = this->mNumRings - this->mChunkRings;
+	chunk.numRings = this->mChunkRings;
+	chunk.isLast = isLast;
+	chunk.vertices = { this->mVertices.data(), numVertices };
+	if (this->mHasNormals)
+		chunk.normals = { this->mNormals.data(), numVertices };
+	chunk.texCoords = { this->mTexCoords.data(), numVertices };
+	chunk.indices = { this->mIndices.data(), this->mIndices.size() };
+	if (!this->mLayout.isEmpty())
+		chunk.vertexData = { this->mVertexData.data(), this->mLayout.size(numVertices) };
+	this->mCallback(chunk);
+	this->mNumChunks++;
+
+	// The last ring starts the next chunk
+	size_t lastRing = numVertices - shapeNumVerts;
+	std::copy(this->mVertices.begin() + lastRing, this->mVertices.begin() + numVertices, this->mVertices.begin());
+	if (this->mHasNormals)
+		std::copy(this->mNormals.begin() + lastRing, this->mNormals.begin() + numVertices, this->mNormals.begin());
+	std::copy(this->mTexCoords.begin() + lastRing, this->mTexCoords.begin() + numVertices, this->mTexCoords.begin());
+	this->mIndices.clear();
+	this->mChunkRings = 1;
+}
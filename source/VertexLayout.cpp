@@ -0,0 +1,248 @@
+#include "VertexLayout.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+using namespace tube;
+
+namespace {
+
+size_t formatSize(AttributeFormat format, int components) {
+	switch (format) {
+	case AttributeFormat::FLOAT32:
+		return (size_t)components * 4;
+	case AttributeFormat::FLOAT16:
+	case AttributeFormat::SNORM16:
+	case AttributeFormat::UNORM16:
+		// Padded to a multiple of four bytes
+		return (size_t)((components + 1) / 2) * 4;
+	default:
+		return 0;
+	}
+}
+
+int numComponents(VertexAttribute attribute) {
+	return attribute == VertexAttribute::TEX_COORD ? 2 : 3;
+}
+
+void writeComponents(unsigned char* out, AttributeFormat format, const float* values, int components) {
+	switch (format) {
+	case AttributeFormat::FLOAT32:
+		memcpy(out, values, (size_t)components * sizeof(float));
+		break;
+	case AttributeFormat::FLOAT16: {
+		uint16_t halves[4] = { 0, 0, 0, 0 };
+		for (int i = 0; i < components; i++)
+			halves[i] = floatToHalf(values[i]);
+		memcpy(out, halves, formatSize(format, components));
+		break;
+	}
+	case AttributeFormat::SNORM16: {
+		int16_t norms[4] = { 0, 0, 0, 0 };
+		for (int i = 0; i < components; i++) {
+			float v = fminf(fmaxf(values[i], -1.0f), 1.0f);
+			norms[i] = (int16_t)lrintf(v * 32767.0f);
+		}
+		memcpy(out, norms, formatSize(format, components));
+		break;
+	}
+	case AttributeFormat::UNORM16: {
+		uint16_t norms[4] = { 0, 0, 0, 0 };
+		for (int i = 0; i < components; i++) {
+			float v = fminf(fmaxf(values[i], 0.0f), 1.0f);
+			norms[i] = (uint16_t)lrintf(v * 65535.0f);
+		}
+		memcpy(out, norms, formatSize(format, components));
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+}
+
+VertexLayout VertexLayout::none() {
+	VertexLayout layout;
+	layout.position = AttributeFormat::NONE;
+	layout.texCoord = AttributeFormat::NONE;
+	layout.normal = AttributeFormat::NONE;
+	return layout;
+}
+
+bool VertexLayout::isEmpty() const {
+	return this->vertexSize() == 0;
+}
+
+AttributeFormat VertexLayout::format(VertexAttribute attribute) const {
+	switch (attribute) {
+	case VertexAttribute::POSITION:
+		return this->position;
+	case VertexAttribute::TEX_COORD:
+		return this->texCoord;
+	default:
+		return this->normal;
+	}
+}
+
+size_t VertexLayout::attributeSize(VertexAttribute attribute) const {
+	return formatSize(this->format(attribute), numComponents(attribute));
+}
+
+size_t VertexLayout::vertexSize() const {
+	return this->attributeSize(VertexAttribute::POSITION) +
+		this->attributeSize(VertexAttribute::TEX_COORD) +
+		this->attributeSize(VertexAttribute::NORMAL);
+}
+
+size_t VertexLayout::offset(VertexAttribute attribute, size_t numVertices) const {
+	// Attributes before this one, per vertex or per block
+	size_t before = 0;
+	if (attribute != VertexAttribute::POSITION)
+		before += this->attributeSize(VertexAttribute::POSITION);
+	if (attribute == VertexAttribute::NORMAL)
+		before += this->attributeSize(VertexAttribute::TEX_COORD);
+	return this->interleaved ? before : before * numVertices;
+}
+
+size_t VertexLayout::stride(VertexAttribute attribute) const {
+	return this->interleaved ? this->vertexSize() : this->attributeSize(attribute);
+}
+
+size_t VertexLayout::size(size_t numVertices) const {
+	return this->vertexSize() * numVertices;
+}
+
+void VertexLayout::writePosition(unsigned char* data, size_t numVertices, size_t index, glm::vec3 position) const {
+	assert(this->position == AttributeFormat::NONE ||
+		this->position == AttributeFormat::FLOAT32 ||
+		this->position == AttributeFormat::FLOAT16);
+	auto attribute = VertexAttribute::POSITION;
+	unsigned char* out = data + this->offset(attribute, numVertices) + index * this->stride(attribute);
+	writeComponents(out, this->position, &position.x, 3);
+}
+
+void VertexLayout::writeTexCoord(unsigned char* data, size_t numVertices, size_t index, glm::vec2 texCoord) const {
+	assert(this->texCoord != AttributeFormat::SNORM16);
+	auto attribute = VertexAttribute::TEX_COORD;
+	unsigned char* out = data + this->offset(attribute, numVertices) + index * this->stride(attribute);
+	writeComponents(out, this->texCoord, &texCoord.x, 2);
+}
+
+void VertexLayout::writeNormal(unsigned char* data, size_t numVertices, size_t index, glm::vec3 normal) const {
+	assert(this->normal != AttributeFormat::UNORM16);
+	auto attribute = VertexAttribute::NORMAL;
+	unsigned char* out = data + this->offset(attribute, numVertices) + index * this->stride(attribute);
+	writeComponents(out, this->normal, &normal.x, 3);
+}
+
+unsigned short tube::floatToHalf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint32_t sign = (bits >> 16) & 0x8000u;
+	uint32_t exponent = (bits >> 23) & 0xffu;
+	uint32_t mantissa = bits & 0x7fffffu;
+
+	// NaN and infinity
+	if (exponent == 0xffu)
+		return (unsigned short)(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+
+	int halfExponent = (int)exponent - 127 + 15;
+	if (halfExponent >= 31)
+		return (unsigned short)(sign | 0x7c00u);
+
+	if (halfExponent <= 0) {
+		// Subnormal half or zero
+		if (halfExponent < -10)
+			return (unsigned short)sign;
+		mantissa |= 0x800000u;
+		uint32_t shift = (uint32_t)(14 - halfExponent);
+		uint32_t half = mantissa >> shift;
+		uint32_t rest = mantissa & ((1u << shift) - 1u);
+		uint32_t halfway = 1u << (shift - 1u);
+		if (rest > halfway || (rest == halfway && (half & 1u)))
+			half++;
+		return (unsigned short)(sign | half);
+	}
+
+	uint32_t half = ((uint32_t)halfExponent << 10) | (mantissa >> 13);
+	uint32_t rest = mantissa & 0x1fffu;
+	// Rounding may carry into the exponent, which is still correct
+	if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+		half++;
+	return (unsigned short)(sign | half);
+}
+
+float tube::halfToFloat(unsigned short half) {
+	uint32_t sign = (uint32_t)(half & 0x8000u) << 16;
+	uint32_t exponent = (half >> 10) & 0x1fu;
+	uint32_t mantissa = half & 0x3ffu;
+
+	uint32_t bits;
+	if (exponent == 0) {
+		if (mantissa == 0) {
+			bits = sign;
+		}
+		else {
+			// Normalize the subnormal half
+			int e = -1;
+			do {
+				e++;
+				mantissa <<= 1;
+			} while ((mantissa & 0x400u) == 0);
+			bits = sign | ((uint32_t)(127 - 15 - e) << 23) | ((mantissa & 0x3ffu) << 13);
+		}
+	}
+	else if (exponent == 0x1fu) {
+		bits = sign | 0x7f800000u | (mantissa << 13);
+	}
+	else {
+		bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+size_t IndexBuffer::indexSize() const {
+	return this->format == IndexFormat::UINT16 ? 2 : 4;
+}
+
+size_t IndexBuffer::numIndices() const {
+	return this->data.size() / this->indexSize();
+}
+
+uint32_t IndexBuffer::restartIndex() const {
+	return this->format == IndexFormat::UINT16 ? 0xFFFFu : 0xFFFFFFFFu;
+}
+
+void IndexBuffer::push(uint32_t index) {
+	// Checked in release builds too, a truncated index draws garbage
+	if (this->format == IndexFormat::UINT16 && index > 0xFFFFu)
+		throw std::out_of_range("Index does not fit in 16 bits");
+	size_t end = this->data.size();
+	this->data.resize(end + this->indexSize());
+	if (this->format == IndexFormat::UINT16) {
+		uint16_t value = (uint16_t)index;
+		memcpy(this->data.data() + end, &value, sizeof(value));
+	}
+	else {
+		memcpy(this->data.data() + end, &index, sizeof(index));
+	}
+}
+
+uint32_t IndexBuffer::operator[](size_t i) const {
+	if (this->format == IndexFormat::UINT16) {
+		uint16_t value;
+		memcpy(&value, this->data.data() + i * 2, sizeof(value));
+		return value;
+	}
+	uint32_t value;
+	memcpy(&value, this->data.data() + i * 4, sizeof(value));
+	return value;
+}